@@ -0,0 +1,161 @@
+/*
+ * subpixel: time the sub-pixel estimators of SubPixel.h, and measure how far
+ * off they put synthetic particles.
+ *
+ * Usage: subpixel [particles] [sigma] [noise]
+ *
+ * Renders particles (Gaussian spots of the given width in pixels, 1 by
+ * default) at random sub-pixel positions, one to a 16x16 cell, into 8- and
+ * 16-bit images with uniform noise of up to the given number of 8-bit grey
+ * levels (2 by default).  The local maxima are found once; then each
+ * estimator is timed over them (best of a few runs) and its error against the
+ * true centres is reported, as the RMS distance and the mean offset along
+ * each axis, over the maxima within a pixel of a true centre.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+
+#include <Image.h>
+#include <PeakScan.h>
+#include <PixelTraits.h>
+#include <SubPixel.h>
+
+using namespace std;
+
+// the number of times each estimator is timed
+static const int RUNS = 5;
+// the size of the cell around each particle
+static const int CELL = 16;
+
+static double Seconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+static double Uniform()
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+// a particle's true centre, with pixel centres at +0.5
+struct Truth {
+	double x;
+	double y;
+};
+
+// draw the particles into an image whose brightest value is top
+template <class T>
+static void Render(Image<T>& pixels, const vector<Truth>& truth, const vector<double>& peak, double sigma,
+                   double noise, int top)
+{
+	int cells = pixels.Cols() / CELL;
+	double scale = top / 255.0;
+	for (int i = 0; i < pixels.Rows(); ++i) {
+		for (int j = 0; j < pixels.Cols(); ++j) {
+			const Truth& t = truth[(i / CELL) * cells + j / CELL];
+			double dx = j + 0.5 - t.x;
+			double dy = i + 0.5 - t.y;
+			double v = peak[(i / CELL) * cells + j / CELL] * exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+			v = scale * (v + noise * (2 * Uniform() - 1));
+			pixels(i, j) = static_cast<T>(max(0.0, min(static_cast<double>(top), floor(v + 0.5))));
+		}
+	}
+}
+
+// time one estimator over the candidates, and compare it with the truth
+template <class T, class E>
+static void Run(const char* name, const Image<T>& pixels, const vector<PeakCandidate>& candidates,
+                const vector<Truth>& truth)
+{
+	int cells = pixels.Cols() / CELL;
+	vector<double> x(candidates.size());
+	vector<double> y(candidates.size());
+	vector<bool> good(candidates.size());
+	double best = 1e30;
+	for (int r = 0; r < RUNS; ++r) {
+		double t0 = Seconds();
+		for (unsigned int k = 0; k < candidates.size(); ++k) {
+			good[k] = E::Fit(pixels, candidates[k].row, candidates[k].col, x[k], y[k]);
+		}
+		best = min(best, Seconds() - t0);
+	}
+
+	double sq = 0;
+	double biasx = 0;
+	double biasy = 0;
+	int n = 0;
+	for (unsigned int k = 0; k < candidates.size(); ++k) {
+		if (!good[k]) {
+			continue;
+		}
+		// maxima of the noise away from the particles are left out
+		const Truth& t = truth[(candidates[k].row / CELL) * cells + candidates[k].col / CELL];
+		if (fabs(candidates[k].col + 0.5 - t.x) > 1 || fabs(candidates[k].row + 0.5 - t.y) > 1) {
+			continue;
+		}
+		double dx = x[k] - t.x;
+		double dy = y[k] - t.y;
+		sq += dx * dx + dy * dy;
+		biasx += dx;
+		biasy += dy;
+		++n;
+	}
+	cout << "  " << setw(12) << left << name << right
+	     << setw(9) << setprecision(3) << 1e9 * best / candidates.size() << " ns/particle"
+	     << setw(9) << setprecision(3) << 1e-6 * candidates.size() / best << " M/s"
+	     << "   rms " << setprecision(4) << sqrt(sq / max(n, 1))
+	     << "  mean (" << biasx / max(n, 1) << ", " << biasy / max(n, 1) << ")"
+	     << "  placed " << n << endl;
+}
+
+template <class T, class L>
+static void RunAll(const char* title, const Image<T>& pixels, const vector<Truth>& truth)
+{
+	vector<PeakCandidate> candidates;
+	FindPeakCandidates(pixels, PixelTraits<T>::MAXVALUE / 8, candidates);
+	cout << title << ": " << candidates.size() << " local maxima" << endl;
+	Run< T, Gaussian3<T, L> >("gaussian", pixels, candidates, truth);
+	Run< T, Centroid<T> >("centroid", pixels, candidates, truth);
+	Run< T, Gaussian5x5<T, L> >("gaussian5x5", pixels, candidates, truth);
+}
+
+int main(int argc, char** argv) {
+	int n = (argc > 1) ? atoi(argv[1]) : 65536;
+	double sigma = (argc > 2) ? atof(argv[2]) : 1.0;
+	double noise = (argc > 3) ? atof(argv[3]) : 2.0;
+	if (n <= 0 || sigma <= 0 || noise < 0) {
+		cerr << "Usage: " << argv[0] << " [particles] [sigma] [noise]" << endl;
+		exit(1);
+	}
+	Log8::Prepare();
+	Log16::Prepare();
+
+	// a square of cells, each with a particle near its middle
+	int cells = static_cast<int>(ceil(sqrt(static_cast<double>(n))));
+	vector<Truth> truth(cells * cells);
+	vector<double> peak(cells * cells);
+	srand(1);
+	for (int c = 0; c < cells * cells; ++c) {
+		truth[c].x = (c % cells) * CELL + CELL / 2 + Uniform();
+		truth[c].y = (c / cells) * CELL + CELL / 2 + Uniform();
+		peak[c] = 60 + 190 * Uniform();
+	}
+
+	Image8 pixels8(cells * CELL, cells * CELL);
+	Render(pixels8, truth, peak, sigma, noise, 255);
+	Image16 pixels16(cells * CELL, cells * CELL);
+	Render(pixels16, truth, peak, sigma, noise, 65535);
+
+	cout << cells * cells << " particles, sigma " << sigma << " pixels, noise " << noise << endl;
+	RunAll<unsigned char, Log8>("8-bit", pixels8, truth);
+	RunAll<unsigned short, Log16>("16-bit", pixels16, truth);
+	return 0;
+}
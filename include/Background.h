@@ -0,0 +1,95 @@
+/*
+ *  Background.h
+ *
+ *  A background model of one camera, subtracted from each frame before the
+ *  particles are found, so that reflections and bright spots that stay put
+ *  are not found as particles in every frame.
+ *
+ *  The model is given in the tracking configuration as one of
+ *
+ *    none               no background
+ *    min:frames=N       the dimmest value of each pixel over the last N frames
+ *    median:frames=N    the median value of each pixel over the last N frames
+ *    mean:alpha=a       a running mean of each pixel, each frame weighted a
+ *
+ *  and is taken from the frames before the current one, so a particle is not
+ *  subtracted from itself.
+ *
+ *  A pixel that has been dark over the window (or long enough for its mean to
+ *  round to zero) has a background of zero, so only the pixels lit recently
+ *  are modelled: the work per frame follows the number of lit pixels, which
+ *  the CPV decoder lists, rather than the size of the frame.
+ *
+ */
+
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <Image.h>
+
+class BackgroundModel {
+
+public:
+	enum Mode { NONE, MINIMUM, MEDIAN, MEAN };
+
+	// a model from its configuration entry
+	BackgroundModel(const std::string& spec) throw(std::invalid_argument);
+
+	// subtract the background from the next frame, and add the frame to the
+	// model; lit lists the pixels (row * cols + col) that may be above zero,
+	// or is NULL to look at them all
+	template <class T>
+	void Subtract(Image<T>& pixels, const std::vector<int>* lit = NULL);
+
+	Mode GetMode() const;
+	// the number of pixels being modelled
+	int Tracked() const;
+
+private:
+	// the background of a slot for this frame, after catching up on the
+	// frames it was dark in
+	double Background(int s);
+	// add a pixel's value in this frame to its slot
+	void Add(int s, int value);
+	// forget the slots of pixels that have gone dark
+	void Expire();
+
+	Mode mode;
+	int window;
+	double alpha;
+
+	// the number of frames seen
+	int frame;
+	// the slot of each pixel, or -1
+	std::vector<int> slot;
+	// per slot: its pixel, the last frame it was lit, and its history (window
+	// values, by frame % window) or running mean
+	std::vector<int> owner;
+	std::vector<int> last;
+	std::vector<unsigned short> history;
+	std::vector<double> mean;
+	std::vector<int> active;
+	std::vector<int> spare;
+
+	// scratch space
+	std::vector<int> scan;
+	std::vector<unsigned short> sorted;
+};
+
+// Inline Function Definitions
+
+inline BackgroundModel::Mode BackgroundModel::GetMode() const
+{
+	return mode;
+}
+
+inline int BackgroundModel::Tracked() const
+{
+	return active.size();
+}
+
+#endif // BACKGROUND_H
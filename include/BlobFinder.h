@@ -0,0 +1,43 @@
+/*
+ *  BlobFinder.h
+ *
+ *  The blob engine of the particle finder: every 8-connected region of pixels
+ *  at or above the threshold is one particle, placed at its intensity-weighted
+ *  centroid.  This suits large or overlapping particles, which give the
+ *  3-point Gaussian estimator several peaks to squash.
+ *
+ *  The image is split into horizontal bands, one per thread.  Each band cuts
+ *  its rows into runs of bright pixels, sums each run, and joins the runs that
+ *  touch with a union-find; the bands are then joined where they meet.  The
+ *  blobs come out in the raster order of their first pixels, with the same
+ *  sums in the same order, whatever the number of threads.
+ *
+ */
+
+#ifndef BLOBFINDER_H
+#define BLOBFINDER_H
+
+#include <vector>
+
+#include <Image.h>
+
+// a connected region of bright pixels
+struct Blob {
+	// the intensity-weighted centroid, with pixel centres at +0.5, as for the
+	// Gaussian estimator
+	double x;
+	double y;
+	// the number of pixels, the brightest one, and the sum of them all
+	int area;
+	int peak;
+	double intensity;
+};
+
+// find the blobs in rows first to end - 1 and columns firstcol to endcol - 1
+// of an image (by default, all of them), using up to nthreads threads; blobs
+// is cleared first
+template <class T>
+void FindBlobs(const Image<T>& pixels, int threshold, int nthreads, std::vector<Blob>& blobs,
+               int first = 0, int end = -1, int firstcol = 0, int endcol = -1);
+
+#endif // BLOBFINDER_H
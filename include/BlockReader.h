@@ -0,0 +1,137 @@
+/*
+ *  BlockReader.h
+ *
+ *  A BlockReader is a read-only, seekable input file that fetches its data in
+ *  large blocks through an IOBackend and keeps a window of blocks ahead of the
+ *  read position in flight.  It offers the subset of the ifstream interface that
+ *  the input decoders use (read, seekg, tellg, eof, gcount), so that WesleyanCPV
+ *  and GDF can switch between backends without changing their parsing code.
+ *  Fetch() hands out whole records without copying them when they lie inside a
+ *  single block.
+ *
+ *  Several BlockReaders may share one IOBackend (and so one io_uring ring).
+ *
+ */
+
+#ifndef BLOCKREADER_H
+#define BLOCKREADER_H
+
+#include <string>
+#include <vector>
+#include <ios>
+#include <stdexcept>
+#include <sys/types.h>
+
+#include <IOBackend.h>
+
+class BlockReader {
+public:
+	// open a file; if io is NULL, a private pread backend is used
+	BlockReader(const std::string& filename, IOBackend* io = NULL, size_t blocksize = DEFAULT_BLOCKSIZE) throw(std::runtime_error);
+	~BlockReader();
+
+	bool is_open() const;
+	bool good() const;
+	bool eof() const;
+	void clear();
+
+	// copy the next n bytes into dst (sets eof if the file ends first)
+	BlockReader& read(char* dst, std::streamsize n);
+	// return a pointer to the next n bytes and move past them; the pointer is
+	// good until the next read or Fetch.  gcount() tells how many bytes are valid.
+	const char* Fetch(std::streamsize n);
+	// the number of bytes delivered by the last read or Fetch
+	std::streamsize gcount() const;
+	// move the read position
+	BlockReader& seekg(off_t off, std::ios::seekdir dir = std::ios::beg);
+	// the current read position
+	off_t tellg() const;
+	// size of the file in bytes, and the time it was last modified (in
+	// nanoseconds since the epoch), as they were when it was opened
+	off_t Size() const;
+	long long ModTime() const;
+
+	static const size_t DEFAULT_BLOCKSIZE = 1 << 20;
+
+private:
+	struct Slot {
+		off_t block;
+		char* buf;
+		int ticket;
+		ssize_t len;
+		bool pending;
+	};
+
+	int fd;
+	off_t size;
+	long long mtime;
+	off_t pos;
+	bool eofflag;
+	size_t blocksize;
+	off_t lastblock;
+	std::streamsize count;
+
+	IOBackend* io;
+	bool ownio;
+
+	// one slot per block in the read-ahead window
+	std::vector<Slot> slots;
+	// records that straddle two blocks are gathered here
+	std::vector<char> scratch;
+
+	// return the slot holding this block, reading it if necessary
+	Slot& Load(off_t block) throw(std::runtime_error);
+	// start reading the blocks after this one
+	void Prefetch(off_t block) throw(std::runtime_error);
+	// find a slot that can be reused, away from the window starting at block
+	// (-1 if every slot is in the window)
+	int Victim(off_t block) const;
+	// finish any read still pending on a slot
+	void Settle(Slot& s) throw(std::runtime_error);
+
+	// no copying
+	BlockReader(const BlockReader&);
+	BlockReader& operator=(const BlockReader&);
+};
+
+inline bool BlockReader::is_open() const
+{
+	return fd >= 0;
+}
+
+inline bool BlockReader::good() const
+{
+	return fd >= 0 && !eofflag;
+}
+
+inline bool BlockReader::eof() const
+{
+	return eofflag;
+}
+
+inline void BlockReader::clear()
+{
+	eofflag = false;
+}
+
+inline std::streamsize BlockReader::gcount() const
+{
+	return count;
+}
+
+inline off_t BlockReader::tellg() const
+{
+	return pos;
+}
+
+inline off_t BlockReader::Size() const
+{
+	return size;
+}
+
+inline long long BlockReader::ModTime() const
+{
+	return mtime;
+}
+
+#endif // BLOCKREADER_H
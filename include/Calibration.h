@@ -23,7 +23,9 @@
 
 #include <Camera.h>
 #include <Frame.h>
+#include <DetectionStore.h>
 #include <Position.h>
+#include <GDFWriter.h>
 
 class Calibration {
 public:
@@ -35,15 +37,28 @@ public:
     
     int mcam;
 	
-    void writeGDFHeader(std::string filename);
-	void fixHeader(int nr, int cols);
-	// do the stereomatching
-	Frame Stereomatch(const std::deque<Frame>& iframes, int framenumber) throw(std::runtime_error);
+	// open the file for the stereomatched particles (with the given precision
+	// and framing, see GDFWriter.h), and finish it off
+	void OpenOutput(std::string filename, std::string precision = "double", int framing = GDFWriter::AUTO)
+		throw(std::runtime_error, std::invalid_argument);
+	void CloseOutput() throw(std::runtime_error);
+	// do the stereomatching.  Given the particles of each camera's frame with
+	// their features (in the order of the frames), candidate pairs whose
+	// features disagree are dropped as the pair lists are built.
+	Frame Stereomatch(const std::deque<Frame>& iframes, int framenumber,
+	                  const std::deque<Detections>* features = NULL) throw(std::runtime_error);
+	// the feature gate: "none", or "ratio:peak=P,area=A", to drop candidate
+	// pairs whose brightest pixels differ by more than a factor of P, or
+	// whose areas differ by more than a factor of A (either may be left out;
+	// an unknown feature, zero, always passes)
+	void SetFeatureGate(const std::string& spec) throw(std::invalid_argument);
+	// the region of interest of a camera
+	const RegionOfInterest& ROI(int cam) const;
 		
 private:
 
 	std::string outname;
-	std::ofstream outfile;
+	GDFWriter outfile;
 
 	int ncams;
     
@@ -53,11 +68,19 @@ private:
 	double mindist_2D;
 	// threshold distance between nearby lines of sight (in 3D, in mm) to match a particle
 	double mindist_3D;
+	// the largest ratios of the features of a candidate pair (0: not checked)
+	double maxpeakratio;
+	double maxarearatio;
 	
 	// create a 3D world position from multiple positions on image planes
 	std::pair<double,Position> WorldPosition(std::deque<Position> ipos) throw(std::runtime_error);
 	
 };
+inline const RegionOfInterest& Calibration::ROI(int cam) const
+{
+	return cams[cam].ROI();
+}
+
 inline Position Calibration::m_pos()
 {
     return Position(mcam, mcam, mcam, mcam);
@@ -16,20 +16,27 @@
 #define CAMERA_H
 
 #include <fstream>
+#include <stdexcept>
 
 #include <Position.h>
-#include <Matrix.h>
+#include <Vec3.h>
+#include <Projection.h>
+#include <RegionOfInterest.h>
 #include <string.h>
 #include <limits.h>
 
 class Camera {
 public:
-	Camera(std::istream& is);
+	// read the model parameters, then any region of interest entries; a bad
+	// entry throws runtime_error
+	Camera(std::istream& is) throw(std::runtime_error);
 	Camera(const Camera& c);
 	~Camera() {};
 	
 	// return camera projective center (in world coordinates)
-	Position Center() const;
+	const Vec3& Center() const;
+	// the part of the sensor to look for particles in
+	const RegionOfInterest& ROI() const;
 	
 	// remove distortion; return centered coordinates in physical units
 	Position UnDistort(const Position& p) const;
@@ -38,8 +45,18 @@ public:
 	
 	// project a position (distorted, in pixels!) on the image plane to 3D world coordinates (in mm)
 	Position ImageToWorld(const Position& p) const;
+	Vec3 ImageToWorld(const Vec3& p) const;
 	// project a 3D world position (in mm) to a position on the image plane (undistorted, in mm)
 	Position WorldToImage(const Position& p) const;
+	Vec3 WorldToImage(const Vec3& p) const;
+
+	// the same for points 0 to n - 1 of separate coordinate arrays, which may
+	// also be the outputs (see Projection.h)
+	void UnDistort(int n, const double* x, const double* y, double* ox, double* oy) const;
+	void Distort(int n, const double* x, const double* y, double* ox, double* oy) const;
+	void ImageToWorld(int n, const double* x, const double* y, double* ox, double* oy, double* oz) const;
+	void WorldToImage(int n, const double* x, const double* y, const double* z,
+	                  double* ox, double* oy, double* oz) const;
 
 private:
 	// model parameters; names should be more or less the same as from calibTsai.m!
@@ -50,23 +67,31 @@ private:
 	double f_eff;
 	double kr;
 	double kx;
-	Matrix R;
-	Position T;
-	Matrix Rinv;
-	Position Tinv;
+	Mat3 R;
+	Vec3 T;
+	Mat3 Rinv;
+	Vec3 Tinv;
+	RegionOfInterest roi;
+	// the above, worked out once for the batch projections
+	ProjectionConstants proj;
 		
 };
 
 inline Camera::Camera(const Camera& c)
 : Npixw(c.Npixw), Npixh(c.Npixh), wpix(c.wpix), hpix(c.hpix), f_eff(c.f_eff),
-kr(c.kr), kx(c.kx), R(c.R), T(c.T), Rinv(c.Rinv), Tinv(c.Tinv)
+kr(c.kr), kx(c.kx), R(c.R), T(c.T), Rinv(c.Rinv), Tinv(c.Tinv), roi(c.roi), proj(c.proj)
 {}
 
-inline Position Camera::Center() const
+inline const Vec3& Camera::Center() const
 {
 	return Tinv;
 }
 
+inline const RegionOfInterest& Camera::ROI() const
+{
+	return roi;
+}
+
 inline Position Camera::UnDistort(const Position& p) const
 {
 	//Position centered(p);
@@ -74,10 +99,11 @@ inline Position Camera::UnDistort(const Position& p) const
 	//centered -= Position(Npixw/2, Npixh/2, 0);
 	
 	// account for left-handed coordinate system...
-	Position centered(p.X() - Npixw/2, -p.Y() + Npixh/2, p.Z(), p.Ori());
+	Vec3 centered(p.X() - Npixw/2, -p.Y() + Npixh/2, p.Z());
 	
 	// scale into physical units
-	centered *= Position(wpix, hpix, 1, 1);
+	centered.x *= wpix;
+	centered.y *= hpix;
 	// remove possible cylindrical distortion
 	// 	cout << corrframes[0] << endl;should this be 1.0/kx? i.e., should kx be bigger or smaller than 1?
 // 	centered *= Position(kx, 1, 1);
@@ -87,7 +113,7 @@ inline Position Camera::UnDistort(const Position& p) const
 // 	centered *= rad;
 	// finally, return the undistorted coordinates, but keep them centered and in mm
 	// std::cout << centered << std::endl;
-	return Position(centered.X(),centered.Y(),centered.Z(),p.Ori());
+	return Position(centered.x, centered.y, centered.z, p.Ori());
 }
 
 inline Position Camera::Distort(const Position& p) const
@@ -95,33 +121,64 @@ inline Position Camera::Distort(const Position& p) const
 	// compute the radial distortion factor
 // 	double rad = 1.0 + kr * p.Magnitude2();
 // 	Position pixelcoords(p / rad);
-    Position pixelcoords(p);
+    Vec3 pixelcoords(p);
 	// remove potential cylindrical distortion
 // 	pixelcoords *= Position(1.0 / kx, 1, 0, 0);
 	// scale into pixel units
-	pixelcoords *= Position(1.0 / wpix, 1.0 / hpix, 1, 1);
+	pixelcoords.x *= proj.invwpix;
+	pixelcoords.y *= proj.invhpix;
 	// shift origin
-	return Position(pixelcoords.X() + Npixw/2, -1.0 * (pixelcoords.Y() - Npixh/2), p.Z(), p.Ori());
+	return Position(pixelcoords.x + Npixw/2, -1.0 * (pixelcoords.y - Npixh/2), p.Z(), p.Ori());
 }
 
-inline Position Camera::ImageToWorld(const Position& p) const
+inline Vec3 Camera::ImageToWorld(const Vec3& p) const
 {
-	Position pp(p.X(),p.Y(),p.Z());
-	Position tmp(pp * T.Z() / f_eff);
-	Position proj(tmp.X(), tmp.Y(), T.Z());
+	Vec3 tmp(p * T.z / f_eff);
+	Vec3 proj(tmp.x, tmp.y, T.z);
 	// return coordinates of p in 3D world coordinates
 	//return ((proj - T) * R);
-	Position tmpi(Rinv * (proj - T));
-	return Position(tmpi.X(),tmpi.Y(),tmpi.Z(),p.Ori());
+	return Rinv * (proj - T);
 }
 
-inline Position Camera::WorldToImage(const Position& p) const
+inline Position Camera::ImageToWorld(const Position& p) const
+{
+	Vec3 tmpi(ImageToWorld(Vec3(p)));
+	return Position(tmpi.x, tmpi.y, tmpi.z, p.Ori());
+}
+
+inline Vec3 Camera::WorldToImage(const Vec3& p) const
 {
 	//Position proj(p * Rinv + T);
-	Position pp(p.X(),p.Y(),p.Z());
-	Position proj(R * pp + T);
-	Position tmpi(proj * (f_eff / proj.Z()));
-	return Position(tmpi.X(),tmpi.Y(),tmpi.Z(),p.Ori());
+	Vec3 proj(R * p + T);
+	return proj * (f_eff / proj.z);
+}
+
+inline Position Camera::WorldToImage(const Position& p) const
+{
+	Vec3 tmpi(WorldToImage(Vec3(p)));
+	return Position(tmpi.x, tmpi.y, tmpi.z, p.Ori());
+}
+
+inline void Camera::UnDistort(int n, const double* x, const double* y, double* ox, double* oy) const
+{
+	UnDistortPoints(proj, n, x, y, ox, oy);
+}
+
+inline void Camera::Distort(int n, const double* x, const double* y, double* ox, double* oy) const
+{
+	DistortPoints(proj, n, x, y, ox, oy);
+}
+
+inline void Camera::ImageToWorld(int n, const double* x, const double* y,
+                                 double* ox, double* oy, double* oz) const
+{
+	ImageToWorldPoints(proj, n, x, y, ox, oy, oz);
+}
+
+inline void Camera::WorldToImage(int n, const double* x, const double* y, const double* z,
+                                 double* ox, double* oy, double* oz) const
+{
+	WorldToImagePoints(proj, n, x, y, z, ox, oy, oz);
 }
 
 #endif // CAMERA_H
@@ -0,0 +1,199 @@
+/*
+ *  CompactTrack.h
+ *
+ *  A compact encoding of track files.  Where a track GDF repeats the track
+ *  index and a double time on every row, the compact file stores each track
+ *  once with a small header (id, start frame, length), a bitmap of the fake
+ *  points, and each column as quantized values: the first one and then the
+ *  differences from point to point, as zigzag varints.  The quantization step
+ *  of every column is stored in the file, so values come back to within half
+ *  a step; a step of zero keeps the column's doubles exactly.
+ *
+ *  FORMAT (little-endian):
+ *    HEADER:
+ *    magic number: 82993                                  (4-byte int)
+ *    version: 1                                           (4-byte int)
+ *    frames per second                                    (8-byte double)
+ *    number of columns                                    (4-byte int)
+ *    for each column: role (0 value, 1 track index,       (4-byte int)
+ *                     2 time, 3 fake bit)
+ *                     quantization step (0: raw doubles)  (8-byte double)
+ *                     length of the name, then the name   (4-byte int, chars)
+ *
+ *    EACH TRACK:
+ *    number of points (0 ends the tracks)                 (varint)
+ *    number of bytes in the rest of the record            (varint)
+ *    track id minus the previous track's id               (zigzag varint)
+ *    start frame minus the previous track's start frame   (zigzag varint)
+ *    flags: bit 0 - frame numbers are listed              (varint)
+ *           bit 1+c - value column c is stored raw
+ *    if listed, the frame differences (one fewer than     (zigzag varints)
+ *      the points); otherwise the frames are consecutive
+ *    fake bitmap: bit i%8 of byte i/8 for point i         ((points+7)/8 bytes)
+ *    for each value column: the first quantized value,    (zigzag varints)
+ *      then the differences; or the raw values            (8-byte doubles)
+ *
+ *    TRAILER:
+ *    number of tracks, number of points                   (8-byte ints)
+ *    magic number                                         (4-byte int)
+ *
+ *  The values are the columns of the track GDF, so the file can be turned back
+ *  into one (see working/ctk2gdf.cpp).  Nothing is ever rewritten, so the file
+ *  can be written to a pipe, or to stdout (file name "-").
+ *
+ */
+
+#ifndef COMPACTTRACK_H
+#define COMPACTTRACK_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#include <Track.h>
+#include <TrackOutput.h>
+
+// the roles of the columns
+enum CompactRole { CT_VALUE = 0, CT_INDEX, CT_TIME, CT_FAKE };
+
+// one decoded track
+struct CompactTrack {
+	long long id;
+	// frame number and fake bit of each point
+	std::vector<int> frames;
+	std::vector<unsigned char> fake;
+	// the values of each value column (empty for the other columns)
+	std::vector< std::vector<double> > values;
+
+	int Length() const;
+};
+
+class CompactTrackWriter : public TrackOutput {
+public:
+	// open a file; steps holds quantization step overrides, as "x=1e-5,y=1e-5"
+	CompactTrackWriter(const std::string& filename, double fps, const std::string& steps = "")
+		throw(std::runtime_error, std::invalid_argument);
+	~CompactTrackWriter();
+
+	void Write(const Track& t, double index) throw(std::runtime_error);
+	void Close() throw(std::runtime_error);
+
+	static const int MAGIC = 82993;
+	static const int VERSION = 1;
+	static const size_t BUFFERSIZE = 4 << 20;
+
+private:
+	int fd;
+	std::string filename;
+	double fps;
+	std::vector<std::string> names;
+	std::vector<int> roles;
+	std::vector<double> steps;
+
+	long long ntracks;
+	long long npoints;
+	long long lastid;
+	int laststart;
+
+	// the record being built, and the values of one column of a track
+	std::vector<unsigned char> record;
+	std::vector<double> column;
+	// bytes waiting to be written
+	std::vector<char> pending;
+
+	// append to the file, through the buffer
+	void Put(const void* p, size_t n) throw(std::runtime_error);
+	// write out what is buffered
+	void WriteOut() throw(std::runtime_error);
+
+	// no copying
+	CompactTrackWriter(const CompactTrackWriter&);
+	CompactTrackWriter& operator=(const CompactTrackWriter&);
+};
+
+class CompactTrackReader {
+public:
+	CompactTrackReader(const std::string& filename) throw(std::runtime_error);
+	~CompactTrackReader() {};
+
+	// read the next track; false after the last one
+	bool Next(CompactTrack& t) throw(std::runtime_error);
+
+	int NumColumns() const;
+	const std::string& ColumnName(int col) const;
+	int ColumnRole(int col) const;
+	double ColumnStep(int col) const;
+	double Fps() const;
+
+	// the GDF row for point i of a track
+	void Row(const CompactTrack& t, int i, double* row) const;
+
+	// the totals from the trailer (valid once Next has returned false)
+	long long NumTracks() const;
+	long long NumPoints() const;
+
+private:
+	std::ifstream infile;
+	std::string filename;
+	double fps;
+	std::vector<std::string> names;
+	std::vector<int> roles;
+	std::vector<double> steps;
+
+	long long ntracks;
+	long long npoints;
+	long long lastid;
+	int laststart;
+	bool done;
+
+	std::vector<unsigned char> record;
+
+	// no copying
+	CompactTrackReader(const CompactTrackReader&);
+	CompactTrackReader& operator=(const CompactTrackReader&);
+};
+
+// Inline Function Definitions
+
+inline int CompactTrack::Length() const
+{
+	return frames.size();
+}
+
+inline int CompactTrackReader::NumColumns() const
+{
+	return names.size();
+}
+
+inline const std::string& CompactTrackReader::ColumnName(int col) const
+{
+	return names[col];
+}
+
+inline int CompactTrackReader::ColumnRole(int col) const
+{
+	return roles[col];
+}
+
+inline double CompactTrackReader::ColumnStep(int col) const
+{
+	return steps[col];
+}
+
+inline double CompactTrackReader::Fps() const
+{
+	return fps;
+}
+
+inline long long CompactTrackReader::NumTracks() const
+{
+	return ntracks;
+}
+
+inline long long CompactTrackReader::NumPoints() const
+{
+	return npoints;
+}
+
+#endif // COMPACTTRACK_H
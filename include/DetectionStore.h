@@ -0,0 +1,121 @@
+/*
+ *  DetectionStore.h
+ *
+ *  The particles found in the frames of one camera, kept until the frames
+ *  are stereomatched.  A frame's particles are a run of entries in a few
+ *  contiguous columns (x, y, brightest pixel, area, orientation), so that a
+ *  whole movie's worth costs a handful of growing arrays rather than a Frame
+ *  of Position objects per frame; the Frame that stereomatching takes is
+ *  made from a run on demand.
+ *
+ */
+
+#ifndef DETECTIONSTORE_H
+#define DETECTIONSTORE_H
+
+#include <vector>
+
+#include <Frame.h>
+
+// the particles of one frame, in storage that is cleared and refilled frame
+// after frame without giving back its memory
+struct Detections {
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<int> peak;
+	std::vector<int> area;
+
+	void Clear();
+	int Size() const;
+	void Add(double nx, double ny, int npeak, int narea);
+	// swap the contents (and memory) with another set
+	void Swap(Detections& d);
+};
+
+class DetectionStore {
+
+public:
+	DetectionStore();
+
+	// add the next frame: its particles (with their orientations, if they
+	// have any), or no particles
+	void Append(const Detections& d, const std::vector<double>* ori = NULL);
+	void AppendEmpty();
+
+	int NumFrames() const;
+	// the number of particles in a frame, and in all of them
+	int NumParticles(int frame) const;
+	int NumParticles() const;
+
+	// particle k of a frame
+	double X(int frame, int k) const;
+	double Y(int frame, int k) const;
+	int Peak(int frame, int k) const;
+	int Area(int frame, int k) const;
+
+	// make a Frame object with the particle positions of a frame, and get
+	// all of its particles (out is cleared first)
+	Frame CreateFrame(int frame) const;
+	void Get(int frame, Detections& out) const;
+
+private:
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<int> peak;
+	std::vector<int> area;
+	std::vector<double> ori;
+	// the particles of frame i are entries start[i] to start[i + 1] - 1
+	std::vector<int> start;
+};
+
+// Inline Function Definitions
+
+inline int Detections::Size() const
+{
+	return x.size();
+}
+
+inline void Detections::Add(double nx, double ny, int npeak, int narea)
+{
+	x.push_back(nx);
+	y.push_back(ny);
+	peak.push_back(npeak);
+	area.push_back(narea);
+}
+
+inline int DetectionStore::NumFrames() const
+{
+	return start.size() - 1;
+}
+
+inline int DetectionStore::NumParticles(int frame) const
+{
+	return start[frame + 1] - start[frame];
+}
+
+inline int DetectionStore::NumParticles() const
+{
+	return x.size();
+}
+
+inline double DetectionStore::X(int frame, int k) const
+{
+	return x[start[frame] + k];
+}
+
+inline double DetectionStore::Y(int frame, int k) const
+{
+	return y[start[frame] + k];
+}
+
+inline int DetectionStore::Peak(int frame, int k) const
+{
+	return peak[start[frame] + k];
+}
+
+inline int DetectionStore::Area(int frame, int k) const
+{
+	return area[start[frame] + k];
+}
+
+#endif // DETECTIONSTORE_H
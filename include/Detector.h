@@ -0,0 +1,81 @@
+/*
+ *  Detector.h
+ *
+ *  The particle finder of a whole camera stream.  A Detector is made once per
+ *  movie with the finder's settings, and keeps the memory it works in (the
+ *  peak candidates, the bands of each thread, the grid of the cluster
+ *  squash, the particles of each frame) from one frame to the next, so that
+ *  after the first few frames finding particles allocates nothing.
+ *
+ *  Frames are handed over in batches, and their particles appended to a
+ *  DetectionStore in order.  With several threads, the frames of a batch are
+ *  shared out among them, one whole frame per thread at a time; a batch of
+ *  one frame is split into horizontal bands instead, as ParticleFinder does.
+ *  Either way the particles come out exactly as one thread would find them.
+ *
+ */
+
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <vector>
+
+#include <Image.h>
+#include <ParticleFinder.h>
+#include <DetectionStore.h>
+#include <RegionOfInterest.h>
+
+class Detector {
+
+public:
+	// find particles in images of the given depth (see ParticleFinder.h) with
+	// up to nthreads threads, looking only at the bounding box of a region of
+	// interest if one is given, and squashing the clusters of the PEAKS
+	// engine within squash pixels (none if less than 1)
+	Detector(int depth, int nthreads = 1, ParticleFinder::Engine engine = ParticleFinder::PEAKS,
+	         ParticleFinder::Estimator estimator = ParticleFinder::GAUSSIAN3,
+	         const RegionOfInterest* roi = NULL, double squash = 0);
+	~Detector();
+
+	// find the particles of n frames, each with its own threshold, and append
+	// them to a store in order; a NULL frame (one that could not be read)
+	// appends a frame with no particles
+	template <class T>
+	void Detect(const Image<T>* const* frames, const int* thresholds, int n, DetectionStore& store);
+
+	// find the particles of one frame; out is cleared first
+	template <class T>
+	void Find(const Image<T>& pixels, int threshold, Detections& out);
+
+	// merge the particles within rad of each other (see ParticleFinder.h)
+	void Squash(Detections& d, double rad);
+
+	// the working memory of one thread
+	struct Workspace;
+
+private:
+	// one frame, with the memory of one thread, split over bands threads
+	template <class T>
+	void FindWith(Workspace& w, const Image<T>& pixels, int threshold, int bands, Detections& out);
+	void SquashWith(Workspace& w, Detections& d, double rad);
+	// a thread's share of the frames of a batch
+	template <class T>
+	static void* FindShare(void* arg);
+
+	int depth;
+	int nthreads;
+	ParticleFinder::Engine engine;
+	ParticleFinder::Estimator estimator;
+	const RegionOfInterest* roi;
+	double squash;
+	// one per thread
+	std::vector<Workspace*> workspaces;
+	// the particles of each frame of a batch
+	std::vector<Detections> found;
+
+	// not copyable
+	Detector(const Detector&);
+	Detector& operator=(const Detector&);
+};
+
+#endif // DETECTOR_H
@@ -13,15 +13,38 @@
 
 #include <string>
 #include <deque>
+#include <fstream>
+#include <cstring>
 #include <stdexcept>
+#include <vector>
 
 #include <Frame.h>
+#include <DetectionStore.h>
+#include <BlockReader.h>
+#include <GDFIndex.h>
+
+// a read-only view of one column in a block of GDF rows, converting from the
+// file's data type (4: float, 5: double) on access
+class GDFColumn {
+public:
+	GDFColumn();
+	GDFColumn(const char* first, int rowbytes, int type, int n);
+
+	double operator[](int i) const;
+	int size() const;
+
+private:
+	const char* base;
+	int stride;
+	int type;
+	int n;
+};
 
 class GDF{
 
 public:
-	// constructor: process the given pixel array
-	GDF(std::string filename) throw(std::out_of_range);
+	// constructor: open a GDF file, optionally reading it through the given I/O backend
+	GDF(std::string filename, IOBackend* io = NULL) throw(std::out_of_range);
 	// destructor
 	~GDF();
 	
@@ -30,48 +53,88 @@ public:
 
     int seekGDF(int start);
 	
-	// fix header information
-	void fixHeader(int nr, int cols);
-	
 	// make a Frame object with the particle positions.
 	Frame CreateFrame();
+	// get the particles with their features (see DetectionStore.h): the
+	// brightness column gives the peak, and there is no area; out and ori
+	// are cleared first
+	void CreateDetections(Detections& out, std::vector<double>& ori);
 	// return the number of particles found
 	int NumParticles() const;;
+
+	// views of the columns of the frame read last; valid until the next read
+	GDFColumn Column(int col) const;
+
+	// the columns of a 2D detection file
+	enum Columns { X = 0, Y, BRIGHTNESS, ORI, COUNT, FRAMENUM };
 	
 private:
 
 	std::string outname;
-	std::ifstream infile;
-	std::ofstream outfile;
-	double filePos[3];
+	BlockReader infile;
+	// where the rows of each frame are
+	GDFIndex index;
 
-	int magic,tmpi, cols, rows;
-	double xi, yi, fi, orii;
+	int magic,tmpi, cols, rows, type;
+	// the type of each column (4: float, 5: double), where it starts in a
+	// row, and the size of one row, in bytes
+	std::vector<int> types;
+	std::vector<int> offsets;
+	int rowbytes;
+	// where the rows start: after the header, and the column types if the
+	// file has mixed types (see GDFWriter.h)
+	off_t dataoffset;
     
-	int prevFrameNum;
 	int currentFrameNum;
-	int nextFrameNum;
-    int startFrameNum;
 	int missedFrame;
-	
-	int waiting_to_be_written;
-	
-	// store vectors of the x and y coordinates of the particles
-	std::deque<double> x;
-	std::deque<double> y;
-	std::deque<double> ori;
+
+	// the rows of the current frame, straight from the reader, or gathered
+	// from the chunks of a streamed file
+	const char* block;
+	std::vector<char> gathered;
+	int nparticles;
+
+	// where the rows are: one run, or the chunks of a streamed file
+	std::vector<GDFIndex::Segment> Segments();
 
 };
 
+inline GDFColumn::GDFColumn() : base(NULL), stride(0), type(5), n(0)
+{}
+
+inline GDFColumn::GDFColumn(const char* first, int rowbytes, int t, int count)
+: base(first), stride(rowbytes), type(t), n(count)
+{}
+
+inline double GDFColumn::operator[](int i) const
+{
+	const char* p = base + i * stride;
+	if (type == 4) {
+		float f;
+		memcpy(&f, p, 4);
+		return f;
+	}
+	double d;
+	memcpy(&d, p, 8);
+	return d;
+}
+
+inline int GDFColumn::size() const
+{
+	return n;
+}
+
 inline int GDF::NumParticles() const
 {
-  return x.size();
+  return nparticles;
 }
 
-inline GDF::~GDF()
+inline GDFColumn GDF::Column(int col) const
 {
-  infile.close();
-  outfile.close();
+	return GDFColumn(block + offsets[col], rowbytes, types[col], nparticles);
 }
 
+inline GDF::~GDF()
+{}
+
 #endif // GDF_H
@@ -0,0 +1,87 @@
+/*
+ *  GDFIndex.h
+ *
+ *  A GDFIndex maps each frame number in a frame-sorted GDF file to the block of
+ *  rows holding that frame: the file position of the first row and the number
+ *  of rows.  It is built once, by a single sequential pass over the frame
+ *  column, and can be saved next to the data file (as <file>.idx) so that later
+ *  runs skip the pass.  Lookups are binary searches over the sorted entries.
+ *
+ *  The rows may lie in several segments (the chunks of a streamed file, see
+ *  GDFWriter.h); a frame that runs across the end of a segment then has one
+ *  entry per segment, and these entries follow each other.
+ *
+ */
+
+#ifndef GDFINDEX_H
+#define GDFINDEX_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <BlockReader.h>
+
+class GDFIndex {
+public:
+	struct Entry {
+		int frame;
+		long long offset;
+		int count;
+	};
+	// a run of consecutive rows
+	struct Segment {
+		long long start;
+		long long rows;
+	};
+
+	GDFIndex();
+	~GDFIndex() {};
+
+	// scan the frame column (offset bytes into each row, of values of the given
+	// data type) of the rows, of rowbytes bytes each, in the segments
+	void Build(BlockReader& in, const std::vector<Segment>& segments, int rowbytes, int offset, int type);
+
+	// read or write the sidecar file; the size and modification time of the
+	// data file (see BlockReader::ModTime) and rowbytes identify it, so that a
+	// file rewritten at the same length is not taken for the one indexed.
+	// both return false on failure (a missing or stale sidecar, say)
+	bool Load(const std::string& name, off_t filesize, long long mtime, int rowbytes);
+	bool Save(const std::string& name, off_t filesize, long long mtime, int rowbytes) const;
+
+	// the (first) entry for a frame, or NULL if the frame has no rows
+	const Entry* Find(int frame) const;
+	// position of the first entry with a frame number of at least frame
+	int LowerBound(int frame) const;
+
+	// the number of entries (more than the number of frames if some frames
+	// are split over several segments)
+	int NumEntries() const;
+	const Entry& operator[](int i) const;
+
+	// the sidecar name for a data file
+	static std::string SidecarName(const std::string& filename);
+
+private:
+	std::vector<Entry> entries;
+};
+
+inline GDFIndex::GDFIndex()
+{}
+
+inline int GDFIndex::NumEntries() const
+{
+	return entries.size();
+}
+
+inline const GDFIndex::Entry& GDFIndex::operator[](int i) const
+{
+	return entries[i];
+}
+
+inline std::string GDFIndex::SidecarName(const std::string& filename)
+{
+	return filename + ".idx";
+}
+
+#endif // GDFINDEX_H
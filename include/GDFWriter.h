@@ -0,0 +1,175 @@
+/*
+ *  GDFWriter.h
+ *
+ *  A GDFWriter writes a GDF file with a fixed set of named columns.  Rows are
+ *  appended into a large user-space buffer, which goes to the file in big
+ *  sequential writes; the header is written with placeholder sizes when the
+ *  file is opened and finalized (rows and total number of values) by Close().
+ *
+ *  Every GDF output goes through this class: the stereomatched particles
+ *  (Calibration), and the tracks (Tracker and Track).
+ *
+ *  Rows can be appended whole, from an array of values in column order, or
+ *  built up one value at a time with Set() and then committed with EndRow().
+ *  Values are always passed as doubles and converted to the column types.
+ *
+ *  The precision of the columns is given by a string: "double" (the default)
+ *  or "float" for the whole file, which then has the usual header with type
+ *  code 5 or 4.  A float file refuses (runtime_error) a frame number or track
+ *  index that a float cannot hold exactly, that is one beyond 2^24.
+ *
+ *  Files with columns of different types must be asked for, with "mixed:"
+ *  and a type for the whole file, optionally followed by per-column
+ *  overrides, as in "mixed:float" or "mixed:float:time=double,x=double".  The
+ *  frame and index columns are double in such a file unless overridden.
+ *  Overrides naming columns the file does not have are ignored, so one string
+ *  can serve several outputs.  A file that does end up with mixed types has
+ *  the code MIXED (0), and the header is followed by one 4-byte type code per
+ *  column.  GDF reads both kinds, but read_gdf and IDL read only the usual
+ *  one.
+ *
+ *  Framing: a FIXED file has the row count in its header, patched in by
+ *  Close() with a positioned write, and so needs a seekable output.  A STREAM
+ *  file never seeks back and can go to a pipe or to stdout (file name "-"):
+ *  its header has a row count and total of -1, and the rows follow in chunks,
+ *  each an int32 row count and then that many rows.  A chunk of zero rows ends
+ *  the data, followed by a trailer of the real row count and total (int32).
+ *  AUTO picks STREAM for "-" and for outputs that cannot seek, FIXED otherwise.
+ *
+ */
+
+#ifndef GDFWRITER_H
+#define GDFWRITER_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <sys/types.h>
+
+class GDFWriter {
+public:
+	// constructor: a writer with no file open
+	GDFWriter();
+	// constructor: open a file with the given columns
+	GDFWriter(const std::string& filename, const std::vector<std::string>& columns,
+	          const std::string& precision = "double", int framing = AUTO,
+	          size_t buffersize = DEFAULT_BUFFERSIZE) throw(std::runtime_error, std::invalid_argument);
+	// destructor: closes the file if it is still open
+	~GDFWriter();
+
+	// create the file and write a header with placeholder sizes
+	void Open(const std::string& filename, const std::vector<std::string>& columns,
+	          const std::string& precision = "double", int framing = AUTO,
+	          size_t buffersize = DEFAULT_BUFFERSIZE) throw(std::runtime_error, std::invalid_argument);
+	// write out what is buffered and finalize the header
+	void Close() throw(std::runtime_error);
+	bool is_open() const;
+	// is the file being written in STREAM framing?
+	bool Streaming() const;
+
+	// the schema
+	int NumColumns() const;
+	const std::string& ColumnName(int col) const;
+	// the data type of a column (FLOAT or DOUBLE)
+	int ColumnType(int col) const;
+	// the position of a column by name, or -1 if there is no such column
+	int Column(const std::string& name) const;
+	// does a column (by name) hold whole numbers: frame numbers or track indices?
+	static bool IntegerColumn(const std::string& name);
+
+	// append a row: values holds one value per column, in column order
+	void AppendRow(const double* values) throw(std::runtime_error);
+	// set one value of the row being built; unset values are written as zero
+	void Set(int col, double value);
+	// append the row being built and start a new one
+	void EndRow() throw(std::runtime_error);
+
+	// the number of rows appended so far
+	long long Rows() const;
+
+	// hand the buffered rows to the operating system
+	void Flush() throw(std::runtime_error);
+
+	static const size_t DEFAULT_BUFFERSIZE = 4 << 20;
+	static const int MAGIC = 82991;
+	// data type codes
+	static const int MIXED = 0;
+	static const int FLOAT = 4;
+	static const int DOUBLE = 5;
+	// framings
+	enum Framing { AUTO, FIXED, STREAM };
+	// parse "auto", "fixed" or "stream"
+	static Framing ParseFraming(const std::string& name) throw(std::invalid_argument);
+
+private:
+	int fd;
+	std::string filename;
+	std::vector<std::string> names;
+	std::vector<int> types;
+	// the float columns that must hold whole numbers exactly
+	std::vector<int> exact;
+	// the type code in the header, and the size of a row in the file
+	int filetype;
+	size_t rowbytes;
+	long long nrows;
+	// the row being built by Set()
+	std::vector<double> row;
+	// rows waiting to be written; when streaming, the first 4 bytes are kept
+	// for the chunk's row count
+	std::vector<char> buffer;
+	size_t used;
+	size_t start;
+	bool streaming;
+
+	// set up the column types from a precision string
+	void SetTypes(const std::string& precision) throw(std::invalid_argument);
+	// the header, with the given sizes
+	std::vector<int> Header(int rows, int total) const;
+	// write the header, with the current sizes, at the start of the file
+	void WriteHeader() throw(std::runtime_error);
+	// write len bytes at the end of the file
+	void WriteOut(const char* data, size_t len) throw(std::runtime_error);
+
+	// no copying: a writer owns its file
+	GDFWriter(const GDFWriter&);
+	GDFWriter& operator=(const GDFWriter&);
+};
+
+// Inline Function Definitions
+
+inline bool GDFWriter::is_open() const
+{
+	return fd >= 0;
+}
+
+inline bool GDFWriter::Streaming() const
+{
+	return streaming;
+}
+
+inline int GDFWriter::NumColumns() const
+{
+	return names.size();
+}
+
+inline const std::string& GDFWriter::ColumnName(int col) const
+{
+	return names[col];
+}
+
+inline int GDFWriter::ColumnType(int col) const
+{
+	return types[col];
+}
+
+inline void GDFWriter::Set(int col, double value)
+{
+	row[col] = value;
+}
+
+inline long long GDFWriter::Rows() const
+{
+	return nrows;
+}
+
+#endif // GDFWRITER_H
@@ -0,0 +1,58 @@
+/*
+ *  IOBackend.h
+ *
+ *  An IOBackend performs the positioned reads behind the input readers
+ *  (BlockReader, and through it WesleyanCPV and GDF).  Reads are queued,
+ *  submitted as a batch and then waited for individually, so that one backend
+ *  can keep many reads for many cameras in flight at once.
+ *
+ *  Two backends are available:
+ *    pread  - plain synchronous pread(2) calls; works everywhere.
+ *    uring  - a single Linux io_uring ring with a fixed queue depth. Build with
+ *             -DNO_IO_URING to leave it out on systems without io_uring headers.
+ *
+ *  The backend is selected at runtime by name; if io_uring is not available
+ *  the pread backend is used instead.
+ *
+ */
+
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <string>
+#include <stdexcept>
+#include <sys/types.h>
+
+class IOBackend {
+public:
+	// build a backend by name ("pread" or "uring") with the given queue depth
+	static IOBackend* Create(const std::string& name, int depth = 8);
+	virtual ~IOBackend() {};
+
+	// queue a read of len bytes at offset from fd into buf; returns a ticket
+	virtual int Queue(int fd, char* buf, size_t len, off_t offset) throw(std::runtime_error) = 0;
+	// hand all queued reads to the device
+	virtual void Submit() throw(std::runtime_error) = 0;
+	// block until the read with this ticket has finished; return the bytes read
+	virtual ssize_t Wait(int ticket) throw(std::runtime_error) = 0;
+
+	// the name of this backend
+	virtual std::string Name() const = 0;
+	// the maximum number of reads in flight
+	int Depth() const;
+
+protected:
+	IOBackend(int d);
+
+	int depth;
+};
+
+inline IOBackend::IOBackend(int d) : depth(d < 1 ? 1 : d)
+{}
+
+inline int IOBackend::Depth() const
+{
+	return depth;
+}
+
+#endif // IOBACKEND_H
@@ -0,0 +1,170 @@
+/*
+ *  Image.h
+ *
+ *  An Image holds one camera frame as a single contiguous block of pixels of
+ *  type T (unsigned char for 8-bit cameras, unsigned short for 16-bit ones).
+ *  Each row starts on an ALIGNMENT-byte boundary: Stride() is the distance
+ *  between rows in pixels, and is at least Cols().  The padding at the end of
+ *  every row is kept at zero, so whole rows can be scanned with vector loads.
+ *
+ *  The decoders write into an Image directly and ParticleFinder reads from it.
+ *
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+template <class T>
+class Image {
+public:
+	// constructor: an empty image
+	Image();
+	// constructor: a zeroed image of the given size
+	Image(int r, int c) throw(std::runtime_error);
+	// destructor
+	~Image();
+
+	// reallocate for a new size; the contents are zeroed
+	void Resize(int r, int c) throw(std::runtime_error);
+	// set every pixel to zero
+	void Clear();
+
+	int Rows() const;
+	int Cols() const;
+	// distance between the starts of two rows, in pixels
+	int Stride() const;
+
+	// pointer to the first pixel of a row
+	T* Row(int r);
+	const T* Row(int r) const;
+	// pointer to the first pixel
+	T* Data();
+	const T* Data() const;
+
+	// access a single pixel
+	T& operator()(int r, int c);
+	const T& operator()(int r, int c) const;
+
+	static const int ALIGNMENT = 64;
+
+private:
+	T* data;
+	int rows;
+	int cols;
+	int stride;
+
+	// no copying: images are large, pass them by reference
+	Image(const Image&);
+	Image& operator=(const Image&);
+};
+
+typedef Image<unsigned char> Image8;
+typedef Image<unsigned short> Image16;
+
+// Inline Function Definitions
+
+template <class T>
+inline Image<T>::Image() : data(NULL), rows(0), cols(0), stride(0)
+{}
+
+template <class T>
+inline Image<T>::Image(int r, int c) throw(std::runtime_error)
+: data(NULL), rows(0), cols(0), stride(0)
+{
+	Resize(r, c);
+}
+
+template <class T>
+inline Image<T>::~Image()
+{
+	free(data);
+}
+
+template <class T>
+inline void Image<T>::Resize(int r, int c) throw(std::runtime_error)
+{
+	free(data);
+	data = NULL;
+	rows = r;
+	cols = c;
+	// round each row up to a whole number of aligned blocks
+	int perblock = ALIGNMENT / sizeof(T);
+	stride = ((cols + perblock - 1) / perblock) * perblock;
+	if (rows * stride == 0) {
+		return;
+	}
+	void* p;
+	if (posix_memalign(&p, ALIGNMENT, rows * stride * sizeof(T)) != 0) {
+		throw std::runtime_error("Failure to allocate pixels in Image::Resize");
+	}
+	data = static_cast<T*>(p);
+	Clear();
+}
+
+template <class T>
+inline void Image<T>::Clear()
+{
+	if (data != NULL) {
+		memset(data, 0, rows * stride * sizeof(T));
+	}
+}
+
+template <class T>
+inline int Image<T>::Rows() const
+{
+	return rows;
+}
+
+template <class T>
+inline int Image<T>::Cols() const
+{
+	return cols;
+}
+
+template <class T>
+inline int Image<T>::Stride() const
+{
+	return stride;
+}
+
+template <class T>
+inline T* Image<T>::Row(int r)
+{
+	return data + r * stride;
+}
+
+template <class T>
+inline const T* Image<T>::Row(int r) const
+{
+	return data + r * stride;
+}
+
+template <class T>
+inline T* Image<T>::Data()
+{
+	return data;
+}
+
+template <class T>
+inline const T* Image<T>::Data() const
+{
+	return data;
+}
+
+template <class T>
+inline T& Image<T>::operator()(int r, int c)
+{
+	return data[r * stride + c];
+}
+
+template <class T>
+inline const T& Image<T>::operator()(int r, int c) const
+{
+	return data[r * stride + c];
+}
+
+#endif // IMAGE_H
@@ -29,12 +29,30 @@
 #include <stdexcept>
 
 #include <Frame.h>
+#include <Image.h>
+#include <RegionOfInterest.h>
 
 class ParticleFinder {
 
 public:
-  // constructor: process the given pixel array
-  ParticleFinder(int**& p, int rows, int cols, int depth, int threshold /*int thresh*/) throw(std::out_of_range);
+  // the ways of finding particles: a sub-pixel estimator at each local
+  // maximum, or the centroids of connected bright regions (see
+  // BlobFinder.h), which need no squashing
+  enum Engine { PEAKS, BLOBS };
+  // the sub-pixel estimators of the PEAKS engine (see SubPixel.h)
+  enum Estimator { GAUSSIAN3, CENTROID, GAUSSIAN5X5 };
+  static const int NESTIMATORS = 3;
+
+  // constructor: process the given image (8- or 16-bit pixels, none above
+  // depth: the decoders check this, see PixelTraits.h), split into
+  // horizontal bands processed by up to nthreads threads; the particles come
+  // out in the same order whatever the number of threads.  Given a region
+  // of interest, only the rows and columns of its bounding box are looked at.
+  // (A Detector, see Detector.h, does the same for every frame of a movie.)
+  template <class T>
+  ParticleFinder(const Image<T>& p, int depth, int threshold, int nthreads = 1,
+                 Engine engine = PEAKS, Estimator estimator = GAUSSIAN3, const RegionOfInterest* roi = NULL)
+  throw(std::out_of_range);
   // destructor
   ~ParticleFinder() {};
 
@@ -45,19 +63,31 @@ public:
    
   // return the number of particles found
   int NumParticles() const;
+  // the brightest pixel of a particle, and its area in pixels: for a local
+  // maximum, the pixels around it at or above half its value (see
+  // Detector.cpp); for a blob, all of its pixels
+  int Peak(int i) const;
+  int Area(int i) const;
+
+  // "gaussian", "centroid" or "gaussian5x5" (local maxima, placed by that
+  // estimator) or "blobs"
+  static void ParseFinder(const std::string& name, Engine& engine, Estimator& estimator)
+  throw(std::invalid_argument);
+  // the name of an estimator, as ParseFinder takes it
+  static const char* EstimatorName(Estimator estimator);
   
   // remove large clusters
   void Squash(double rad);
 
+  // the fewest rows worth giving a thread of their own
+  static const int MINBANDROWS = 32;
+
 private:
-	int** pixels;
-	
   // store vectors of the x and y coordinates of the particles
   std::deque<double> x;
   std::deque<double> y;
-
-	// helper function
-  bool IsLocalMax(int r, int c);
+  std::deque<int> peak;
+  std::deque<int> area;
 
 };
 
@@ -66,4 +96,14 @@ inline int ParticleFinder::NumParticles() const
   return x.size();
 }
 
+inline int ParticleFinder::Peak(int i) const
+{
+  return peak[i];
+}
+
+inline int ParticleFinder::Area(int i) const
+{
+  return area[i];
+}
+
 #endif // PARTICLEFINDER_H
@@ -0,0 +1,38 @@
+/*
+ *  PeakScan.h
+ *
+ *  The candidate pass of the particle finder: the pixels of an image, away
+ *  from its border, that are at or above a threshold and at least as bright
+ *  as their four neighbours (above, below, left and right).
+ *
+ *  Whole runs of a row are compared at once with SIMD instructions where the
+ *  CPU has them: AVX2 if it reports it at runtime, else SSE2, else plain
+ *  loops.  All three give the same candidates in the same (row-major) order.
+ *  Building with -DNO_SIMD leaves only the plain loops.
+ *
+ */
+
+#ifndef PEAKSCAN_H
+#define PEAKSCAN_H
+
+#include <vector>
+
+#include <Image.h>
+
+// a local maximum found by the scan
+struct PeakCandidate {
+	int row;
+	int col;
+};
+
+// find the candidates in rows first to end - 1 and columns firstcol to
+// endcol - 1 of an image (by default, all of them); out is cleared first
+void FindPeakCandidates(const Image8& pixels, int threshold, std::vector<PeakCandidate>& out,
+                        int first = 1, int end = -1, int firstcol = 1, int endcol = -1);
+void FindPeakCandidates(const Image16& pixels, int threshold, std::vector<PeakCandidate>& out,
+                        int first = 1, int end = -1, int firstcol = 1, int endcol = -1);
+
+// the instructions the scan uses on this machine: "avx2", "sse2" or "scalar"
+const char* PeakScanName();
+
+#endif // PEAKSCAN_H
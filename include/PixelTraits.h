@@ -0,0 +1,124 @@
+/*
+ *  PixelTraits.h
+ *
+ *  What the particle finder needs to know about a pixel type at compile time:
+ *  its largest value, and how to take the logarithm of a pixel for the
+ *  Gaussian fit.  A zero pixel is taken as 0.0001 so that it has a logarithm.
+ *
+ *  The logarithms come from a table, with the zero entry filled in, when the
+ *  camera uses the whole range of the type (255 for 8 bits, 65535 for 16); a
+ *  camera with fewer bits in a wider type (12 bits in 16, say) uses LogAny.
+ *  The tables are made the first time Prepare() is called.  The 8-bit table
+ *  is kept in double and in single precision (LogF); its doubles hold log(v)
+ *  rounded to 15 significant digits, as the literal table it replaces did, so
+ *  that 8-bit particle positions come out exactly as before.  The 16-bit
+ *  table is kept in single precision only, and Log16::Log reads it too: at
+ *  256 KB rather than 512 KB it leaves more of the L2 cache to the frames,
+ *  and the logs lose nothing the Gaussian fit of a 16-bit pixel needs.
+ *
+ *  Pixels are checked against the camera's range once, when a frame is
+ *  decoded (CheckPixelRange), rather than by the particle finder.
+ *
+ */
+
+#ifndef PIXELTRAITS_H
+#define PIXELTRAITS_H
+
+#include <cmath>
+#include <stdexcept>
+
+#include <Image.h>
+
+template <class T>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<unsigned char> {
+	static const int MAXVALUE = 255;
+};
+
+template <>
+struct PixelTraits<unsigned short> {
+	static const int MAXVALUE = 65535;
+};
+
+// logarithms of 8-bit pixels, from a table
+struct Log8 {
+	// make the tables; call before the first Log or LogF
+	static void Prepare();
+	static double Log(unsigned char v);
+	static float LogF(unsigned char v);
+
+	static double table[256];
+	static float ftable[256];
+};
+
+// logarithms of 16-bit pixels, from a single-precision table
+struct Log16 {
+	// make the table; call before the first Log or LogF
+	static void Prepare();
+	static double Log(unsigned short v);
+	static float LogF(unsigned short v);
+
+	static float ftable[65536];
+};
+
+// logarithms of any pixel values, computed
+template <class T>
+struct LogAny {
+	static double Log(T v);
+};
+
+// throw out_of_range if any pixel is above colors; nothing to do when colors
+// covers the whole pixel type
+template <class T>
+void CheckPixelRange(const Image<T>& pixels, int colors) throw(std::out_of_range);
+
+// Inline Function Definitions
+
+inline double Log8::Log(unsigned char v)
+{
+	return table[v];
+}
+
+inline double Log16::Log(unsigned short v)
+{
+	return ftable[v];
+}
+
+inline float Log8::LogF(unsigned char v)
+{
+	return ftable[v];
+}
+
+inline float Log16::LogF(unsigned short v)
+{
+	return ftable[v];
+}
+
+template <class T>
+inline double LogAny<T>::Log(T v)
+{
+	return (v == 0) ? log(0.0001) : log(static_cast<double>(v));
+}
+
+template <class T>
+inline void CheckPixelRange(const Image<T>& pixels, int colors) throw(std::out_of_range)
+{
+	if (colors >= PixelTraits<T>::MAXVALUE) {
+		return;
+	}
+	for (int i = 0; i < pixels.Rows(); ++i) {
+		const T* row = pixels.Row(i);
+		T worst = 0;
+		for (int j = 0; j < pixels.Cols(); ++j) {
+			worst = (row[j] > worst) ? row[j] : worst;
+		}
+		if (worst > colors) {
+			// this is a serious problem: we can't continue
+			throw std::out_of_range("Pixel out of range!");
+		}
+	}
+}
+
+#endif // PIXELTRAITS_H
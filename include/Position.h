@@ -140,7 +140,12 @@ inline Position::Position(double NewX, double NewY, double NewZ) : x(NewX), y(Ne
 {}
 
 inline Position::Position(double NewX, double NewY, double NewZ, double NewOri) 
-: x(NewX), y(NewY), z(NewZ), ori(NewOri), fake(false)
+: x(NewX), y(NewY), z(NewZ), ori(NewOri),
+	x1(0), y1(0), ori1(0),
+	x2(0), y2(0), ori2(0),
+	x3(0), y3(0), ori3(0),
+	x4(0), y4(0), ori4(0),
+	info(0), fake(false)
 {}
 
 inline Position::Position(
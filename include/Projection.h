@@ -0,0 +1,53 @@
+/*
+ *  Projection.h
+ *
+ *  The camera model (see Camera.h) applied to whole frames of points at once.
+ *  The points are given as separate arrays of coordinates, and each camera
+ *  works out the constants of its model once, so that a pass over a frame is
+ *  a handful of multiplications and additions per point, done two or four
+ *  points at a time with SIMD instructions where the CPU has them: AVX if it
+ *  reports it at runtime, else SSE2, else plain loops.  Building with
+ *  -DNO_SIMD leaves only the plain loops.
+ *
+ *  Every kernel does the same floating-point operations in the same order as
+ *  the Camera function for one point, and no fused multiply-adds, so the
+ *  results are the same to the bit whichever is used.
+ *
+ */
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+// the constants of a camera's model
+struct ProjectionConstants {
+	// the middle of the sensor, in whole pixels
+	double halfw;
+	double halfh;
+	// the size of a pixel (in mm) and its inverse
+	double wpix;
+	double hpix;
+	double invwpix;
+	double invhpix;
+	double f_eff;
+	// the rotation and translation into camera coordinates, and the inverse
+	// rotation (row by row)
+	double R[9];
+	double T[3];
+	double Rinv[9];
+};
+
+// for points 0 to n - 1; the outputs may be the inputs.  UnDistort and
+// Distort leave z alone, and ImageToWorld does not look at it.
+void UnDistortPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                     double* ox, double* oy);
+void DistortPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                   double* ox, double* oy);
+void ImageToWorldPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                        double* ox, double* oy, double* oz);
+void WorldToImagePoints(const ProjectionConstants& c, int n, const double* x, const double* y, const double* z,
+                        double* ox, double* oy, double* oz);
+
+// the instructions the kernels use on this machine: "avx", "sse2" or "scalar"
+const char* ProjectionName();
+
+#endif // PROJECTION_H
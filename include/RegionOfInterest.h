@@ -0,0 +1,118 @@
+/*
+ *  RegionOfInterest.h
+ *
+ *  The part of a camera's sensor that particles are looked for in.  Pixels
+ *  outside it (tank walls, parts of the image outside the lit volume) are
+ *  dropped when a frame is decoded, and the particle finder only scans the
+ *  rows and columns of its bounding box.
+ *
+ *  A camera in the camera configuration file may be followed by any number
+ *  of entries
+ *
+ *    roi col0 row0 col1 row1    the pixels in columns col0 to col1 - 1 of
+ *                               rows row0 to row1 - 1
+ *    mask file.pgm              the non-zero pixels of a binary (P5) PGM
+ *                               image the size of the sensor
+ *
+ *  and the region is all the pixels they give.  A camera with none of them
+ *  uses its whole sensor.
+ *
+ */
+
+#ifndef REGIONOFINTEREST_H
+#define REGIONOFINTEREST_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+class RegionOfInterest {
+
+public:
+	// the whole of a sensor
+	RegionOfInterest(int rows = 0, int cols = 0);
+
+	// add a rectangle (clipped to the sensor), or the pixels of a mask
+	void AddRectangle(int col0, int row0, int col1, int row1);
+	void AddMask(const std::string& filename) throw(std::runtime_error);
+
+	// is the whole sensor in the region?
+	bool Whole() const;
+	bool Contains(int row, int col) const;
+	// the number of pixels in the region
+	int Size() const;
+
+	int Rows() const;
+	int Cols() const;
+	// the bounding box of the region: rows FirstRow() to EndRow() - 1 and
+	// columns FirstCol() to EndCol() - 1 (empty if the region is)
+	int FirstRow() const;
+	int EndRow() const;
+	int FirstCol() const;
+	int EndCol() const;
+
+private:
+	// start an empty region, the first time a part of it is given
+	void Start();
+	void Include(int row, int col);
+
+	int rows;
+	int cols;
+	bool whole;
+	// one byte per pixel, row by row
+	std::vector<unsigned char> inside;
+	int size;
+	int firstrow;
+	int endrow;
+	int firstcol;
+	int endcol;
+};
+
+// Inline Function Definitions
+
+inline bool RegionOfInterest::Whole() const
+{
+	return whole;
+}
+
+inline bool RegionOfInterest::Contains(int row, int col) const
+{
+	return whole || inside[row * cols + col];
+}
+
+inline int RegionOfInterest::Size() const
+{
+	return whole ? rows * cols : size;
+}
+
+inline int RegionOfInterest::Rows() const
+{
+	return rows;
+}
+
+inline int RegionOfInterest::Cols() const
+{
+	return cols;
+}
+
+inline int RegionOfInterest::FirstRow() const
+{
+	return firstrow;
+}
+
+inline int RegionOfInterest::EndRow() const
+{
+	return endrow;
+}
+
+inline int RegionOfInterest::FirstCol() const
+{
+	return firstcol;
+}
+
+inline int RegionOfInterest::EndCol() const
+{
+	return endcol;
+}
+
+#endif // REGIONOFINTEREST_H
@@ -0,0 +1,215 @@
+/*
+ *  SubPixel.h
+ *
+ *  The sub-pixel estimators of the particle finder.  Given a local maximum at
+ *  row i and column j of an image, each places the centre of the particle to
+ *  a fraction of a pixel, with pixel centres at +0.5:
+ *
+ *    Gaussian3     a 1D Gaussian through the maximum and its neighbours,
+ *                  along the row and down the column (the original fit)
+ *    Centroid      the intensity-weighted centroid of the 3x3 pixels around
+ *                  the maximum: the cheapest, biased towards the centre pixel
+ *    Gaussian5x5   a 2D Gaussian (along the axes) fitted by least squares to
+ *                  the logarithms of the 5x5 pixels around the maximum,
+ *                  weighted by the square of each pixel so that the dark
+ *                  edges count for little: the slowest and least noisy
+ *
+ *  Each is a policy class with a static, inline Fit, so that the particle
+ *  finder builds one fully inlined kernel for each estimator, pixel type and
+ *  source of logarithms (L, see PixelTraits.h), and picks one from a table
+ *  at runtime.  Fit returns false for a particle to be dropped.
+ *
+ */
+
+#ifndef SUBPIXEL_H
+#define SUBPIXEL_H
+
+#include <cmath>
+
+#include <Image.h>
+
+template <class T, class L>
+struct Gaussian3 {
+	static bool Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc);
+};
+
+template <class T>
+struct Centroid {
+	static bool Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc);
+};
+
+template <class T, class L>
+struct Gaussian5x5 {
+	static bool Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc);
+};
+
+// Inline Function Definitions
+
+template <class T, class L>
+inline bool Gaussian3<T, L>::Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc)
+{
+	const T* up = pixels.Row(i - 1);
+	const T* row = pixels.Row(i);
+	const T* down = pixels.Row(i + 1);
+
+	// the local maximum pixel value as well as the values to its left and
+	// right and top and bottom give the particle center.  note: add 0.5 to
+	// row and column values to put the pixel origin in its center
+	double x1 = (j - 1) + 0.5;
+	double x2 = j + 0.5;
+	double x3 = (j + 1) + 0.5;
+	double y1 = (i - 1) + 0.5;
+	double y2 = i + 0.5;
+	double y3 = (i + 1) + 0.5;
+
+	// find the column value
+	double lnz1 = L::Log(row[j - 1]);
+	double lnz2 = L::Log(row[j]);
+	double lnz3 = L::Log(row[j + 1]);
+	xc = -0.5 * ((lnz1 * ((x2 * x2) - (x3 * x3))) - (lnz2 * ((x1 * x1) - (x3 * x3))) + (lnz3 * ((x1 * x1) - (x2 * x2)))) / ((lnz1 * (x3 - x2)) - (lnz3 * (x1 - x2)) + (lnz2 * (x1 - x3)));
+
+	// find the row value
+	lnz1 = L::Log(up[j]);
+	lnz3 = L::Log(down[j]);
+	yc = -0.5 * ((lnz1 * ((y2 * y2) - (y3 * y3))) - (lnz2 * ((y1 * y1) - (y3 * y3))) +
+	             (lnz3 * ((y1 * y1) - (y2 * y2))))
+	             / ((lnz1 * (y3 - y2)) - (lnz3 * (y1 - y2)) + (lnz2 * (y1 - y3)));
+
+	// were these numbers valid?  if not, drop this particle
+	return finite(xc) && finite(yc);
+}
+
+template <class T>
+inline bool Centroid<T>::Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc)
+{
+	double sum = 0;
+	double sumx = 0;
+	double sumy = 0;
+	for (int di = -1; di <= 1; ++di) {
+		const T* row = pixels.Row(i + di);
+		double rowsum = static_cast<double>(row[j - 1]) + row[j] + row[j + 1];
+		sum += rowsum;
+		sumx += static_cast<double>(row[j + 1]) - row[j - 1];
+		sumy += di * rowsum;
+	}
+	if (sum <= 0) {
+		return false;
+	}
+	xc = j + 0.5 + sumx / sum;
+	yc = i + 0.5 + sumy / sum;
+	return true;
+}
+
+template <class T, class L>
+inline bool Gaussian5x5<T, L>::Fit(const Image<T>& pixels, int i, int j, double& xc, double& yc)
+{
+	// ln z = a + b u + c v + d u^2 + e v^2 about the maximum (u across, v
+	// down), from the weighted normal equations; near the edge of the image
+	// the window is cut short.  The equations only need the weighted sums of
+	// u^p v^q (M) and of ln z u^p v^q (R), built up a row at a time.
+	int top = (i >= 2) ? -2 : -i;
+	int bottom = (i + 2 < pixels.Rows()) ? 2 : pixels.Rows() - 1 - i;
+	int left = (j >= 2) ? -2 : -j;
+	int right = (j + 2 < pixels.Cols()) ? 2 : pixels.Cols() - 1 - j;
+	double M00 = 0, M10 = 0, M01 = 0, M20 = 0, M02 = 0, M11 = 0, M30 = 0, M21 = 0, M12 = 0, M03 = 0;
+	double M40 = 0, M22 = 0, M04 = 0;
+	double R00 = 0, R10 = 0, R01 = 0, R20 = 0, R02 = 0;
+	int n = 0;
+	for (int v = top; v <= bottom; ++v) {
+		const T* row = pixels.Row(i + v);
+		double a0 = 0, a1 = 0, a2 = 0, a3 = 0, a4 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		for (int u = left; u <= right; ++u) {
+			// a dark pixel has no weight, and needs no branch
+			T z = row[j + u];
+			double w = static_cast<double>(z) * z;
+			double wl = w * L::Log(z);
+			double uu = u * u;
+			a0 += w;
+			a1 += w * u;
+			a2 += w * uu;
+			a3 += w * uu * u;
+			a4 += w * uu * uu;
+			b0 += wl;
+			b1 += wl * u;
+			b2 += wl * uu;
+			n += (z != 0);
+		}
+		double vv = v * v;
+		M00 += a0;
+		M10 += a1;
+		M20 += a2;
+		M30 += a3;
+		M40 += a4;
+		M01 += a0 * v;
+		M11 += a1 * v;
+		M21 += a2 * v;
+		M02 += a0 * vv;
+		M12 += a1 * vv;
+		M22 += a2 * vv;
+		M03 += a0 * vv * v;
+		M04 += a0 * vv * vv;
+		R00 += b0;
+		R10 += b1;
+		R20 += b2;
+		R01 += b0 * v;
+		R02 += b0 * vv;
+	}
+	double m[5][6] = {
+		{ M00, M10, M01, M20, M02, R00 },
+		{ M10, M20, M11, M30, M12, R10 },
+		{ M01, M11, M02, M21, M03, R01 },
+		{ M20, M30, M21, M40, M22, R20 },
+		{ M02, M12, M03, M22, M04, R02 }
+	};
+
+	// solve by elimination with partial pivoting
+	bool good = (n >= 5);
+	for (int k = 0; good && k < 5; ++k) {
+		int pivot = k;
+		for (int r = k + 1; r < 5; ++r) {
+			if (fabs(m[r][k]) > fabs(m[pivot][k])) {
+				pivot = r;
+			}
+		}
+		if (m[pivot][k] == 0) {
+			good = false;
+			break;
+		}
+		for (int c = k; c < 6; ++c) {
+			double t = m[k][c];
+			m[k][c] = m[pivot][c];
+			m[pivot][c] = t;
+		}
+		double inverse = 1 / m[k][k];
+		for (int r = k + 1; r < 5; ++r) {
+			double s = m[r][k] * inverse;
+			for (int c = k; c < 6; ++c) {
+				m[r][c] -= s * m[k][c];
+			}
+		}
+	}
+	double p[5];
+	for (int k = 4; good && k >= 0; --k) {
+		double s = m[k][5];
+		for (int c = k + 1; c < 5; ++c) {
+			s -= m[k][c] * p[c];
+		}
+		p[k] = s / m[k][k];
+	}
+
+	// a fit that does not peak within a pixel of the maximum falls back on
+	// the 3-point fit
+	if (good && p[3] < 0 && p[4] < 0) {
+		double du = -p[1] / (2 * p[3]);
+		double dv = -p[2] / (2 * p[4]);
+		if (fabs(du) <= 1 && fabs(dv) <= 1) {
+			xc = j + 0.5 + du;
+			yc = i + 0.5 + dv;
+			return true;
+		}
+	}
+	return Gaussian3<T, L>::Fit(pixels, i, j, xc, yc);
+}
+
+#endif // SUBPIXEL_H
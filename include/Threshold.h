@@ -0,0 +1,93 @@
+/*
+ *  Threshold.h
+ *
+ *  The particle threshold of one camera, fixed or adapted to each frame from
+ *  the histogram of its pixels, so that the number of particles found stays
+ *  steady when the illumination drifts.
+ *
+ *  The threshold is given in the tracking configuration as one of
+ *
+ *    fixed                    the threshold given above it, for every frame
+ *    percentile:p=99.5        the lowest value that the brightest 0.5% of the
+ *                             pixels reach
+ *    otsu                     the split of the histogram into a dark and a
+ *                             bright class with the largest variance between
+ *                             them (Otsu's method)
+ *
+ *  and an adaptive threshold may be followed by more comma-separated options:
+ *  smooth=w (the weight of each new frame in the running threshold, from 0
+ *  to 1; 1 follows every frame), min=N and max=N (bounds on the threshold),
+ *  and step=N (histogram every Nth row only).
+ *
+ *  16-bit pixels are binned into at most 4096 bins, so a threshold from them
+ *  is a multiple of the bin width.
+ *
+ */
+
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <Image.h>
+
+// count the pixels of every step-th row of an image with no pixel above
+// colors, into bins 1 << shift values wide; returns shift, and hist holds
+// (colors >> shift) + 1 bins
+template <class T>
+int BuildHistogram(const Image<T>& pixels, int colors, int step, std::vector<unsigned int>& hist);
+
+// the instructions the histogram uses on this machine: "avx2", "sse2" or "scalar"
+const char* HistogramName();
+
+class AdaptiveThreshold {
+
+public:
+	enum Mode { FIXED, PERCENTILE, OTSU };
+
+	// a threshold from its configuration entry; fixed is the fixed threshold
+	AdaptiveThreshold(const std::string& spec, int fixed) throw(std::invalid_argument);
+
+	// the threshold for a new frame (no pixel above colors), updating the
+	// running threshold
+	template <class T>
+	int Update(const Image<T>& pixels, int colors);
+
+	// the threshold of the last frame
+	int Threshold() const;
+	Mode GetMode() const;
+
+private:
+	int FromHistogram(int shift) const;
+
+	Mode mode;
+	double percentile;
+	double smooth;
+	int lo;
+	int hi;
+	int step;
+
+	// the running threshold, once there is one
+	bool primed;
+	double running;
+	int current;
+
+	// the histogram of the last frame, kept to save reallocating it
+	std::vector<unsigned int> hist;
+};
+
+// Inline Function Definitions
+
+inline int AdaptiveThreshold::Threshold() const
+{
+	return current;
+}
+
+inline AdaptiveThreshold::Mode AdaptiveThreshold::GetMode() const
+{
+	return mode;
+}
+
+#endif // THRESHOLD_H
@@ -27,8 +27,11 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <Position.h>
+#include <GDFWriter.h>
 
 class Track {
 
@@ -71,7 +74,13 @@ public:
   int NumFake() const;
 
   // write the track as part of a GDF file (see Tracker.h for format)
-  void WriteGDF(std::ofstream& output, double index, double fps = 1) const;
+  void WriteGDF(GDFWriter& output, double index, double fps = 1) const;
+  // fill in the values of one point as written by WriteGDF
+  void GDFRow(int i, double index, double fps, double* row) const;
+  // the columns written by WriteGDF
+  static std::vector<std::string> GDFColumns();
+  // the number of columns written by WriteGDF
+  static const int GDFCOLUMNS = 19;
   
   // member operators
   Track& operator=(const Track& t);
@@ -0,0 +1,38 @@
+/*
+ *  TrackOutput.h
+ *
+ *  A TrackOutput is where the Tracker puts finished tracks.  The format is
+ *  chosen at runtime by a string of the form name[:options]:
+ *    gdf      - the usual row-per-point GDF file (see Tracker.h), written with
+ *               the precision and framing given to Create (see GDFWriter.h).
+ *    compact  - the compact track encoding (see CompactTrack.h); the options
+ *               are per-column quantization steps, e.g. compact:x=1e-5,z=1e-5
+ *    columnar - the chunked columnar track store (see TrackStore.h); the
+ *               option is the number of rows per chunk, e.g. columnar:rows=65536
+ *
+ */
+
+#ifndef TRACKOUTPUT_H
+#define TRACKOUTPUT_H
+
+#include <string>
+#include <stdexcept>
+
+#include <Track.h>
+#include <GDFWriter.h>
+
+class TrackOutput {
+public:
+	// open a track output of the given format
+	static TrackOutput* Create(const std::string& format, const std::string& filename, double fps,
+	                           const std::string& precision = "double", int framing = GDFWriter::AUTO)
+		throw(std::runtime_error, std::invalid_argument);
+	virtual ~TrackOutput() {};
+
+	// write one finished track with the given index
+	virtual void Write(const Track& t, double index) throw(std::runtime_error) = 0;
+	// finish the file
+	virtual void Close() throw(std::runtime_error) = 0;
+};
+
+#endif // TRACKOUTPUT_H
@@ -0,0 +1,161 @@
+/*
+ *  TrackQuery.h
+ *
+ *  Space-time queries over a track file: which tracks pass through a box in
+ *  x, y, z and time, and which stretches of them lie inside it.
+ *
+ *  Building a TrackQuery takes one pass over the tracks of a Trackfile to find
+ *  each track's bounding box and time span, and then builds a bounding-volume
+ *  hierarchy over those boxes.  A query walks the hierarchy down to the tracks
+ *  whose boxes meet the query box, and only those tracks' points are looked
+ *  at.  The Trackfile must stay open while the TrackQuery is used.
+ *
+ *  The boxes and the hierarchy can be kept in a sidecar file next to the
+ *  track file (<file>.tqx, see SidecarName), together with where the tracks
+ *  start, so that later queries of an unchanged file read them back instead
+ *  of passing over the file at all.  Like the frame index of GDF files (see
+ *  GDFIndex.h), the sidecar names the size and modification time of the file
+ *  it was made from, and one that does not match is made again.
+ *
+ */
+
+#ifndef TRACKQUERY_H
+#define TRACKQUERY_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <Trackfile.h>
+
+// a box in space and time; each dimension runs from lo to hi, inclusive
+struct QueryBox {
+	enum Dimensions { X = 0, Y, Z, T, NDIMS };
+
+	double lo[NDIMS];
+	double hi[NDIMS];
+
+	// the box holding everything
+	QueryBox();
+	// the box holding nothing, to grow with Add
+	static QueryBox Empty();
+
+	bool Overlaps(const QueryBox& b) const;
+	bool Contains(const double* p) const;
+	// grow to hold the point p
+	void Add(const double* p);
+	// grow to hold the box b
+	void Add(const QueryBox& b);
+
+	// parse "x=lo:hi", "y=...", "z=..." or "t=..."; an empty bound is open
+	void Parse(const std::string& s) throw(std::invalid_argument);
+};
+
+// a run of consecutive points of one track inside a query box
+struct TrackSlice {
+	// the position of the track in the file, and its id
+	int track;
+	long long id;
+	// the points, from begin to one before end
+	int begin;
+	int end;
+};
+
+class TrackQuery {
+public:
+	// index the tracks of a file, finding the bounding boxes from nthreads threads
+	TrackQuery(const Trackfile& f, int nthreads = 1);
+	// the same, read from a sidecar file if it is current, and then the tracks
+	// of f are read from it too (f may have been opened without finding them);
+	// otherwise indexed as above, and the sidecar written
+	TrackQuery(Trackfile& f, const std::string& sidecar, int nthreads = 1);
+	~TrackQuery() {};
+
+	// the positions of the tracks whose bounding boxes meet q, in file order
+	void Candidates(const QueryBox& q, std::vector<int>& tracks) const;
+	// the stretches of track inside q, in file order
+	void Find(const QueryBox& q, std::vector<TrackSlice>& slices) const;
+	// the bounding box of the track at position i
+	const QueryBox& Bounds(int i) const;
+
+	int NumNodes() const;
+	// did the index come from the sidecar?
+	bool Loaded() const;
+
+	// the sidecar name for a track file
+	static std::string SidecarName(const std::string& filename);
+
+private:
+	struct Node {
+		QueryBox box;
+		// children, or -1 for a leaf
+		int left;
+		int right;
+		// a leaf's tracks, in order[first .. first + count - 1]
+		int first;
+		int count;
+	};
+
+	static const int LEAFSIZE = 4;
+
+	const Trackfile& file;
+	std::vector<QueryBox> boxes;
+	std::vector<Node> nodes;
+	std::vector<int> order;
+	bool loaded;
+
+	// find the boxes and build the hierarchy over them
+	void Index(int nthreads);
+	int Build(int begin, int end);
+	// read or write the sidecar; both return false on failure
+	bool Load(Trackfile& f, const std::string& name);
+	bool Save(const std::string& name) const;
+
+	// no copying
+	TrackQuery(const TrackQuery&);
+	TrackQuery& operator=(const TrackQuery&);
+};
+
+// Inline Function Definitions
+
+inline bool QueryBox::Overlaps(const QueryBox& b) const
+{
+	for (int d = 0; d < NDIMS; ++d) {
+		if (b.hi[d] < lo[d] || b.lo[d] > hi[d]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool QueryBox::Contains(const double* p) const
+{
+	for (int d = 0; d < NDIMS; ++d) {
+		if (p[d] < lo[d] || p[d] > hi[d]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline const QueryBox& TrackQuery::Bounds(int i) const
+{
+	return boxes[i];
+}
+
+inline int TrackQuery::NumNodes() const
+{
+	return nodes.size();
+}
+
+inline bool TrackQuery::Loaded() const
+{
+	return loaded;
+}
+
+inline std::string TrackQuery::SidecarName(const std::string& filename)
+{
+	return filename + ".tqx";
+}
+
+#endif // TRACKQUERY_H
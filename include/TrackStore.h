@@ -0,0 +1,262 @@
+/*
+ *  TrackStore.h
+ *
+ *  A columnar track store: the same columns as the track GDF (see Tracker.h),
+ *  but cut into chunks of a fixed number of rows, with each column of a chunk
+ *  stored on its own.  A footer holds, for every chunk, where each column is
+ *  and its minimum and maximum; for every track, its first row and length;
+ *  and for every frame, the range of rows holding its points.  A reader can
+ *  then fetch only the columns it wants, and only the chunks that can hold
+ *  the rows it is after (see working/store-query.cpp).
+ *
+ *  Rows are in the order the Tracker writes them (track by track); a track may
+ *  run across the end of a chunk.  The writer never seeks, so the store can be
+ *  written to a pipe or to stdout (file name "-"), but reading it takes a
+ *  file.
+ *
+ *  FORMAT (little-endian):
+ *    HEADER:
+ *    magic number: 82994                                  (4-byte int)
+ *    version: 1                                           (4-byte int)
+ *    frames per second                                    (8-byte double)
+ *    number of columns                                    (4-byte int)
+ *    rows per chunk (the last chunk may have fewer)       (4-byte int)
+ *    for each column: length of the name, then the name  (4-byte int, chars)
+ *
+ *    CHUNKS: for each chunk, for each column, its values  (8-byte doubles)
+ *
+ *    FOOTER:
+ *    number of chunks                                     (8-byte int)
+ *    for each chunk: number of rows                       (4-byte int)
+ *                    for each column: file offset,        (8-byte int)
+ *                                     minimum, maximum    (8-byte doubles)
+ *    number of tracks                                     (8-byte int)
+ *    for each track: id, first row                        (8-byte ints)
+ *                    number of rows                       (4-byte int)
+ *    number of frames                                     (8-byte int)
+ *    for each frame: frame number                         (4-byte int)
+ *                    first row, one past the last row     (8-byte ints)
+ *    file offset of the footer                            (8-byte int)
+ *    magic number                                         (4-byte int)
+ *
+ */
+
+#ifndef TRACKSTORE_H
+#define TRACKSTORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdexcept>
+
+#include <Track.h>
+#include <TrackOutput.h>
+
+class TrackStoreWriter : public TrackOutput {
+public:
+	// open a store; options may give the rows per chunk, as "rows=65536"
+	TrackStoreWriter(const std::string& filename, double fps, const std::string& options = "")
+		throw(std::runtime_error, std::invalid_argument);
+	~TrackStoreWriter();
+
+	void Write(const Track& t, double index) throw(std::runtime_error);
+	void Close() throw(std::runtime_error);
+
+	static const int MAGIC = 82994;
+	static const int VERSION = 1;
+	static const int DEFAULT_CHUNKROWS = 65536;
+	static const size_t BUFFERSIZE = 4 << 20;
+
+private:
+	struct ChunkInfo {
+		int rows;
+		std::vector<long long> offsets;
+		std::vector<double> mins;
+		std::vector<double> maxs;
+	};
+	struct TrackInfo {
+		long long id;
+		long long first;
+		int rows;
+	};
+
+	int fd;
+	std::string filename;
+	double fps;
+	int chunkrows;
+	std::vector<std::string> names;
+
+	// the chunk being filled, column by column
+	std::vector< std::vector<double> > chunk;
+	int used;
+	long long nrows;
+	long long written;
+
+	std::vector<ChunkInfo> chunks;
+	std::vector<TrackInfo> tracks;
+	// frame -> (first row, one past the last row)
+	std::map<int, std::pair<long long, long long> > frames;
+
+	// bytes waiting to be written
+	std::vector<char> pending;
+
+	// write out the chunk being filled
+	void Flush() throw(std::runtime_error);
+	// append to the file, through the buffer
+	void Put(const void* p, size_t n) throw(std::runtime_error);
+	// write out what is buffered
+	void WriteOut() throw(std::runtime_error);
+
+	// no copying
+	TrackStoreWriter(const TrackStoreWriter&);
+	TrackStoreWriter& operator=(const TrackStoreWriter&);
+};
+
+class TrackStoreReader {
+public:
+	TrackStoreReader(const std::string& filename) throw(std::runtime_error);
+	~TrackStoreReader() {};
+
+	int NumColumns() const;
+	const std::string& ColumnName(int col) const;
+	// the position of a column by name, or -1 if there is no such column
+	int Column(const std::string& name) const;
+	double Fps() const;
+
+	long long NumRows() const;
+	int NumChunks() const;
+	int ChunkRows(int chunk) const;
+	// the first row of a chunk
+	long long ChunkStart(int chunk) const;
+	double ChunkMin(int chunk, int col) const;
+	double ChunkMax(int chunk, int col) const;
+	// can a chunk hold values of a column between lo and hi?
+	bool ChunkOverlaps(int chunk, int col, double lo, double hi) const;
+
+	// read the values of one column of one chunk
+	void ReadColumn(int chunk, int col, std::vector<double>& values) throw(std::runtime_error);
+	// the number of column chunks read so far
+	long long ColumnsRead() const;
+
+	// the rows of a track; false if there is no such track
+	bool FindTrack(long long id, long long& first, int& rows) const;
+	// read the given columns of a track, one vector per column
+	bool ReadTrack(long long id, const std::vector<int>& cols,
+	               std::vector< std::vector<double> >& values) throw(std::runtime_error);
+
+	// the range of rows holding the points of a frame; false if it has none
+	bool FindFrame(int frame, long long& first, long long& end) const;
+	// read the given columns of all the points in a frame, one vector per
+	// column, skipping the chunks that cannot hold the frame
+	bool ReadFrame(int frame, const std::vector<int>& cols,
+	               std::vector< std::vector<double> >& values) throw(std::runtime_error);
+
+private:
+	struct ChunkInfo {
+		int rows;
+		long long start;
+		std::vector<long long> offsets;
+		std::vector<double> mins;
+		std::vector<double> maxs;
+	};
+	struct TrackInfo {
+		long long id;
+		long long first;
+		int rows;
+	};
+	struct FrameInfo {
+		int frame;
+		long long first;
+		long long end;
+	};
+
+	std::ifstream infile;
+	std::string filename;
+	double fps;
+	int chunkrows;
+	std::vector<std::string> names;
+	long long nrows;
+	long long filesize;
+	long long columnsread;
+
+	std::vector<ChunkInfo> chunks;
+	// sorted by id and by frame, for binary searches
+	std::vector<TrackInfo> tracks;
+	std::vector<FrameInfo> frames;
+
+	// scratch for reading columns
+	std::vector<double> scratch;
+
+	void Get(void* p, size_t n) throw(std::runtime_error);
+	// read a count of footer records of the given size, checked against what
+	// is left of the file
+	long long Count(long long recordbytes) throw(std::runtime_error);
+
+	static bool TrackLess(const TrackInfo& t, long long id);
+	static bool TrackOrder(const TrackInfo& a, const TrackInfo& b);
+	static bool FrameLess(const FrameInfo& f, int frame);
+
+	// no copying
+	TrackStoreReader(const TrackStoreReader&);
+	TrackStoreReader& operator=(const TrackStoreReader&);
+};
+
+// Inline Function Definitions
+
+inline int TrackStoreReader::NumColumns() const
+{
+	return names.size();
+}
+
+inline const std::string& TrackStoreReader::ColumnName(int col) const
+{
+	return names[col];
+}
+
+inline double TrackStoreReader::Fps() const
+{
+	return fps;
+}
+
+inline long long TrackStoreReader::NumRows() const
+{
+	return nrows;
+}
+
+inline int TrackStoreReader::NumChunks() const
+{
+	return chunks.size();
+}
+
+inline int TrackStoreReader::ChunkRows(int chunk) const
+{
+	return chunks[chunk].rows;
+}
+
+inline long long TrackStoreReader::ChunkStart(int chunk) const
+{
+	return chunks[chunk].start;
+}
+
+inline double TrackStoreReader::ChunkMin(int chunk, int col) const
+{
+	return chunks[chunk].mins[col];
+}
+
+inline double TrackStoreReader::ChunkMax(int chunk, int col) const
+{
+	return chunks[chunk].maxs[col];
+}
+
+inline long long TrackStoreReader::ColumnsRead() const
+{
+	return columnsread;
+}
+
+inline bool TrackStoreReader::ChunkOverlaps(int chunk, int col, double lo, double hi) const
+{
+	return chunks[chunk].maxs[col] >= lo && chunks[chunk].mins[col] <= hi;
+}
+
+#endif // TRACKSTORE_H
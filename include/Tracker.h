@@ -60,6 +60,9 @@
 #include <Frame.h>
 #include <Track.h>
 #include <Position.h>
+#include <Vec3.h>
+#include <GDFWriter.h>
+#include <TrackOutput.h>
 
 class Tracker {
 
@@ -74,9 +77,13 @@ public:
     FRAME4
   };
 
-  // constructor
+  // constructor; format is that of the track output (see TrackOutput.h), and
+  // precision and framing those of a GDF output (see GDFWriter.h)
   Tracker(TrackMode m, double md, int mem, double ifps, 
-          std::string name = std::string("track"));
+          std::string name = std::string("track"),
+          std::string precision = std::string("double"),
+          int framing = GDFWriter::AUTO,
+          std::string format = std::string("gdf"));
   // destructor: nothing to do
   ~Tracker();
 
@@ -97,7 +104,7 @@ private:
   TrackMap tracks;
   TrackMode mode;
   std::string outname;
-  std::ofstream outfile;
+  TrackOutput* outfile;
   
   double max_disp;
   int memory;
@@ -115,16 +122,21 @@ private:
   
   // compute the cost function for a possible link
   std::pair<int, float> ComputeCost(Frame& fr1, Frame& fr2, 
-                                    const Position& estimate, 
-                                    const Position& velocity,
-                                    const Position& now, bool stopflag);
+                                    const Vec3& estimate, 
+                                    const Vec3& velocity,
+                                    const Vec3& now, bool stopflag);
 
 };
 
 // Inline Function Definitions
 inline Tracker::~Tracker()
 {
-  outfile.close();
+  try {
+    outfile->Close();
+  } catch (std::runtime_error&) {
+    // MakeTracks has already reported any trouble with the file
+  }
+  delete outfile;
 }
 
 #endif /* TRACKER_H */
@@ -1,6 +1,6 @@
 /*
  *  Trackfile.h
- *  
+ *
  *
  *  Created by Nicholas Ouellette on 7/28/08.
  *  Copyright 2008 __MyCompanyName__. All rights reserved.
@@ -13,47 +13,251 @@
  *                  - data format read in. from .avi files to .cpv and .gdf files
  *                  - write out of intermediate stereomatched data
  *
+ *  A Trackfile reads a track GDF file as written by the Tracker (see Tracker.h
+ *  for the columns), or the older six-column layout (index, x, y, z, t, fake).
+ *  The column count and types come from the header (float, double or mixed,
+ *  see GDFWriter.h).  The file is memory-mapped, and one pass over the index
+ *  column finds where every track starts; after that, a track is a TrackView
+ *  whose columns point straight into the mapping, found by position or by id.
+ *  A streamed file (see GDFWriter.h) has its rows gathered out of the chunks
+ *  once, when it is opened.
+ *
+ *  The pass can be put off (see the constructor), so that a program that has
+ *  kept the tracks of a file (WriteTracks) can read them back (ReadTracks)
+ *  instead; TrackQuery does this with its sidecar file.
+ *
+ *  ForEachTrack() hands the tracks to a TrackVisitor from several threads;
+ *  programs using it link with -lpthread.
+ *
  */
 
 #ifndef TRACKFILE_H
 #define TRACKFILE_H
 
 #include <string>
+#include <iostream>
 #include <stdexcept>
-#include <fstream>
 #include <deque>
+#include <vector>
+#include <sys/types.h>
+
+#include <GDF.h>
+
+// a read-only view of one track in a Trackfile; valid while the file is open
+class TrackView {
+public:
+  TrackView();
+  TrackView(const char* first, int rowbytes, const int* offsets, const int* types,
+            long long id, int length);
+
+  long long Id() const;
+  int Length() const;
+  // any column by position
+  GDFColumn Column(int col) const;
+
+private:
+  const char* base;
+  int rowbytes;
+  const int* offsets;
+  const int* types;
+  long long id;
+  int length;
+};
+
+// something done to every track by Trackfile::ForEachTrack
+class TrackVisitor {
+public:
+  virtual ~TrackVisitor() {};
+  // called once per track, from the given thread (0 to nthreads - 1); the
+  // tracks given to one thread come in file order
+  virtual void Visit(int thread, int track, const TrackView& t) = 0;
+};
 
 class Trackfile {
 
-public: 
-  // constructor: takes a filename
-  Trackfile(std::string filename) throw(std::invalid_argument);
+public:
+  // constructor: takes a filename; the tracks are found at once, or, with
+  // findtracks false, by FindTracks or ReadTracks
+  Trackfile(std::string filename, bool findtracks = true) throw(std::invalid_argument);
   // destructor
   ~Trackfile();
-  
-  int NumTracks();
+
+  int NumTracks() const;
+  long long NumPoints() const;
+  int NumColumns() const;
+
+  // the positions of the standard columns in this file
+  int IndexColumn() const;
+  int XColumn() const;
+  int YColumn() const;
+  int ZColumn() const;
+  int TimeColumn() const;
+  int FakeColumn() const;
+
+  // the size of the file, and the time it was last modified (in nanoseconds
+  // since the epoch), as they were when it was opened
+  off_t Size() const;
+  long long ModTime() const;
+
+  // find where every track starts, with one pass over the index column (once)
+  void FindTracks();
+  // write where the tracks start, and read it back; ReadTracks returns false,
+  // and leaves the tracks alone, if what it reads does not fit this file
+  void WriteTracks(std::ostream& out) const;
+  bool ReadTracks(std::istream& in);
+
+  // the i-th track in the file
+  TrackView GetTrack(int i) const;
+  // the track with the given id; false if there is none
+  bool FindTrack(long long id, TrackView& t) const;
+  // visit every track, from nthreads threads, each taking a contiguous run of tracks
+  void ForEachTrack(TrackVisitor& v, int nthreads = 1) const;
+
+  // sequential reading, as before
   bool eof() const;
   void SkipNextTrack();
-  void GetNextTrack(std::deque<float>* x, std::deque<float>* y, std::deque<float>* z, 
+  void GetNextTrack(std::deque<float>* x, std::deque<float>* y, std::deque<float>* z,
 										std::deque<float>* t, std::deque<float>* fake);
-  
+
+  enum LegacyColumns { L_INDEX = 0, L_X, L_Y, L_Z, L_T, L_FAKE };
+
 private:
 
-  int npoints;
-  int current_index;
-  int ntracks;
-  
-  std::ifstream file;
+  struct TrackEntry {
+    long long id;
+    long long first;
+    int length;
+  };
+
+  std::string filename;
+
+  // the mapping of the whole file, and its modification time
+  char* mapped;
+  size_t mapsize;
+  long long mtime;
+  // the rows: in the mapping, or gathered from the chunks of a streamed file
+  const char* data;
+  std::vector<char> gathered;
+  long long npoints;
+
+  std::vector<int> types;
+  std::vector<int> offsets;
+  int rowbytes;
+  int cindex, cx, cy, cz, ct, cfake;
+
+  // in file order, and sorted by id
+  std::vector<TrackEntry> tracks;
+  std::vector<TrackEntry> byid;
+  bool found;
+
+  int current;
+
+  // make byid from tracks
+  void SortById();
+  TrackView View(const TrackEntry& e) const;
+
+  static bool IdLess(const TrackEntry& e, long long id);
+  static bool IdOrder(const TrackEntry& a, const TrackEntry& b);
+
+  // no copying
+  Trackfile(const Trackfile&);
+  Trackfile& operator=(const Trackfile&);
 };
 
-inline Trackfile::~Trackfile()
+// Inline Function Definitions
+
+inline TrackView::TrackView()
+: base(NULL), rowbytes(0), offsets(NULL), types(NULL), id(-1), length(0)
+{}
+
+inline TrackView::TrackView(const char* first, int rb, const int* o, const int* t,
+                            long long i, int n)
+: base(first), rowbytes(rb), offsets(o), types(t), id(i), length(n)
+{}
+
+inline long long TrackView::Id() const
+{
+  return id;
+}
+
+inline int TrackView::Length() const
+{
+  return length;
+}
+
+inline GDFColumn TrackView::Column(int col) const
+{
+  return GDFColumn(base + offsets[col], rowbytes, types[col], length);
+}
+
+inline int Trackfile::NumTracks() const
+{
+  return tracks.size();
+}
+
+inline long long Trackfile::NumPoints() const
+{
+  return npoints;
+}
+
+inline int Trackfile::NumColumns() const
+{
+  return types.size();
+}
+
+inline off_t Trackfile::Size() const
+{
+  return mapsize;
+}
+
+inline long long Trackfile::ModTime() const
+{
+  return mtime;
+}
+
+inline int Trackfile::IndexColumn() const
+{
+  return cindex;
+}
+
+inline int Trackfile::XColumn() const
+{
+  return cx;
+}
+
+inline int Trackfile::YColumn() const
+{
+  return cy;
+}
+
+inline int Trackfile::ZColumn() const
+{
+  return cz;
+}
+
+inline int Trackfile::TimeColumn() const
+{
+  return ct;
+}
+
+inline int Trackfile::FakeColumn() const
+{
+  return cfake;
+}
+
+inline TrackView Trackfile::View(const TrackEntry& e) const
+{
+  return TrackView(data + e.first * rowbytes, rowbytes, &offsets[0], &types[0], e.id, e.length);
+}
+
+inline TrackView Trackfile::GetTrack(int i) const
 {
-  file.close();
+  return View(tracks[i]);
 }
 
 inline bool Trackfile::eof() const
 {
-  return file.eof();
+  return current >= NumTracks();
 }
 
 #endif // TRACKFILE_H
@@ -0,0 +1,217 @@
+/*
+ *  Vec3.h
+ *
+ *  Small value types for the geometry of the cameras and the predictions of
+ *  the tracker: a vector of three doubles and a 3x3 matrix, with inline
+ *  operators that build nothing but their results.  A Position carries the
+ *  per-camera coordinates of a matched particle and more besides (17 doubles
+ *  and a flag), all of which it copies every time; the arithmetic is done on
+ *  these instead, and Positions made only where one is handed in or out.
+ *
+ *  The operators do the same floating-point operations in the same order as
+ *  those of Position and Matrix, so the results are the same to the bit.
+ *
+ */
+
+#ifndef VEC3_H
+#define VEC3_H
+
+#include <cmath>
+
+#include <Position.h>
+
+struct Vec3 {
+	double x;
+	double y;
+	double z;
+
+	Vec3();
+	Vec3(double nx, double ny, double nz);
+	// the coordinates of a Position
+	explicit Vec3(const Position& p);
+
+	double Magnitude() const;
+	double Magnitude2() const;
+
+	Vec3& operator+=(const Vec3& right);
+	Vec3& operator-=(const Vec3& right);
+	Vec3& operator*=(double right);
+	Vec3& operator/=(double right);
+};
+
+// a 3x3 matrix, stored row by row
+struct Mat3 {
+	double m[9];
+
+	// the zero matrix, or one given row by row
+	Mat3();
+	explicit Mat3(const double buffer[9]);
+
+	double Get(int i, int j) const;
+	void Set(int i, int j, double val);
+
+	Mat3 Invert() const;
+
+	Mat3& operator+=(const Mat3& right);
+};
+
+// Inline Function Definitions
+
+inline Vec3::Vec3()
+: x(0), y(0), z(0)
+{}
+
+inline Vec3::Vec3(double nx, double ny, double nz)
+: x(nx), y(ny), z(nz)
+{}
+
+inline Vec3::Vec3(const Position& p)
+: x(p.X()), y(p.Y()), z(p.Z())
+{}
+
+inline double Vec3::Magnitude() const
+{
+	return sqrt(x * x + y * y + z * z);
+}
+
+inline double Vec3::Magnitude2() const
+{
+	return (x * x + y * y + z * z);
+}
+
+inline Vec3& Vec3::operator+=(const Vec3& right)
+{
+	x += right.x;
+	y += right.y;
+	z += right.z;
+	return *this;
+}
+
+inline Vec3& Vec3::operator-=(const Vec3& right)
+{
+	x -= right.x;
+	y -= right.y;
+	z -= right.z;
+	return *this;
+}
+
+inline Vec3& Vec3::operator*=(double right)
+{
+	x *= right;
+	y *= right;
+	z *= right;
+	return *this;
+}
+
+inline Vec3& Vec3::operator/=(double right)
+{
+	x /= right;
+	y /= right;
+	z /= right;
+	return *this;
+}
+
+inline Vec3 operator+(const Vec3& left, const Vec3& right)
+{
+	return Vec3(left.x + right.x, left.y + right.y, left.z + right.z);
+}
+
+inline Vec3 operator-(const Vec3& left, const Vec3& right)
+{
+	return Vec3(left.x - right.x, left.y - right.y, left.z - right.z);
+}
+
+inline Vec3 operator*(const Vec3& left, double right)
+{
+	return Vec3(left.x * right, left.y * right, left.z * right);
+}
+
+inline Vec3 operator*(double left, const Vec3& right)
+{
+	return Vec3(left * right.x, left * right.y, left * right.z);
+}
+
+inline Vec3 operator/(const Vec3& left, double right)
+{
+	return Vec3(left.x / right, left.y / right, left.z / right);
+}
+
+// scalar product, and the squared distance between two points
+inline double Dot(const Vec3& left, const Vec3& right)
+{
+	return ((left.x * right.x) + (left.y * right.y) + (left.z * right.z));
+}
+
+inline double Distance(const Vec3& p1, const Vec3& p2)
+{
+	return ((p1.x - p2.x) * (p1.x - p2.x)
+	        + (p1.y - p2.y) * (p1.y - p2.y)
+	        + (p1.z - p2.z) * (p1.z - p2.z));
+}
+
+inline Mat3::Mat3()
+{
+	for (int i = 0; i < 9; ++i) {
+		m[i] = 0;
+	}
+}
+
+inline Mat3::Mat3(const double buffer[9])
+{
+	for (int i = 0; i < 9; ++i) {
+		m[i] = buffer[i];
+	}
+}
+
+inline double Mat3::Get(int i, int j) const
+{
+	return m[i * 3 + j];
+}
+
+inline void Mat3::Set(int i, int j, double val)
+{
+	m[i * 3 + j] = val;
+}
+
+inline Mat3 Mat3::Invert() const
+{
+	double determinant = (m[0] * (m[4] * m[8] - m[5] * m[7])
+	                      - m[1] * (m[3] * m[8] - m[5] * m[6])
+	                      + m[2] * (m[3] * m[7] - m[4] * m[6]));
+	Mat3 inverse;
+	inverse.m[0] = (m[4] * m[8] - m[5] * m[7]) / determinant;
+	inverse.m[1] = (m[2] * m[7] - m[1] * m[8]) / determinant;
+	inverse.m[2] = (m[1] * m[5] - m[2] * m[4]) / determinant;
+	inverse.m[3] = (m[5] * m[6] - m[3] * m[8]) / determinant;
+	inverse.m[4] = (m[0] * m[8] - m[2] * m[6]) / determinant;
+	inverse.m[5] = (m[2] * m[3] - m[0] * m[5]) / determinant;
+	inverse.m[6] = (m[3] * m[7] - m[4] * m[6]) / determinant;
+	inverse.m[7] = (m[1] * m[6] - m[0] * m[7]) / determinant;
+	inverse.m[8] = (m[0] * m[4] - m[1] * m[3]) / determinant;
+	return inverse;
+}
+
+inline Mat3& Mat3::operator+=(const Mat3& right)
+{
+	for (int i = 0; i < 9; ++i) {
+		m[i] += right.m[i];
+	}
+	return *this;
+}
+
+// the matrix times a column vector, and a row vector times the matrix
+inline Vec3 operator*(const Mat3& a, const Vec3& p)
+{
+	return Vec3(a.m[0] * p.x + a.m[1] * p.y + a.m[2] * p.z,
+	            a.m[3] * p.x + a.m[4] * p.y + a.m[5] * p.z,
+	            a.m[6] * p.x + a.m[7] * p.y + a.m[8] * p.z);
+}
+
+inline Vec3 operator*(const Vec3& p, const Mat3& a)
+{
+	return Vec3(p.x * a.m[0] + p.y * a.m[3] + p.z * a.m[6],
+	            p.x * a.m[1] + p.y * a.m[4] + p.z * a.m[7],
+	            p.x * a.m[2] + p.y * a.m[5] + p.z * a.m[8]);
+}
+
+#endif // VEC3_H
@@ -19,9 +19,13 @@
 #define WESLEYANCPV_H
 
 #include <string>
-#include <fstream>
+#include <vector>
 #include <stdexcept>
 
+#include <BlockReader.h>
+#include <Image.h>
+#include <RegionOfInterest.h>
+
 #define BUFFERSIZE 4
 
 enum position {
@@ -30,8 +34,8 @@ enum position {
 
 class WesleyanCPV {
 public:
-	// constructor: give a filename
-	WesleyanCPV(const std::string& name, int start = -1, int end = -1) throw(std::runtime_error, std::out_of_range);
+	// constructor: give a filename, and optionally the I/O backend to read it with
+	WesleyanCPV(const std::string& name, int start = -1, int end = -1, IOBackend* io = NULL) throw(std::runtime_error, std::out_of_range);
 	// destructor
 	~WesleyanCPV();
 
@@ -42,14 +46,25 @@ public:
 	int Frames() const;
 	int Colors() const;
 
-	// get the next frame.
-	int DecodeNextFrame(int** pixels, int frame) throw(std::runtime_error, std::out_of_range);
+	// decode only the pixels in a region of interest from now on (NULL for all
+	// of them); a region short of the whole sensor must be the size of the
+	// movie's frames
+	void SetRegion(const RegionOfInterest* roi) throw(std::runtime_error);
+
+	// get the next frame, written straight into an image of Rows() x Cols()
+	// pixels.  If that frame is missing from the movie (1 is returned), the
+	// image is left alone and the frame read in its place is kept for the
+	// call that asks for it, which may give a different image.
+	int DecodeNextFrame(Image8& pixels, int frame) throw(std::runtime_error, std::out_of_range);
+	// the pixels (row * Cols() + col) listed in the last frame decoded, the
+	// only ones that can be lit
+	const std::vector<int>& LitPixels() const;
 
 private:
 	// the filename
 	std::string filename;
 	// the input stream itself
-	std::ifstream file; 
+	BlockReader file;
 	int threshold;
 	// number of rows and columns
 	short int cols;
@@ -68,12 +83,19 @@ private:
 	double filePos[3];
 
 	char Buffer[BUFFERSIZE];
-	unsigned char* buffer;
+	// the pixel records of one frame, read in one go
+	std::vector<unsigned char> records;
+	// and where they went
+	std::vector<int> lit;
+	// the pixels kept, if not all of them
+	const RegionOfInterest* region;
 
 	// assume 8-bit images
 	static const int DEPTH = 1;
 
 	void Open() throw(std::runtime_error);
+	// write the pixel records read last into an image
+	void Scatter(Image8& pixels) throw(std::out_of_range);
 
 };
 
@@ -98,6 +120,11 @@ inline int WesleyanCPV::Frames() const
   return nframes;
 }
 
+inline const std::vector<int>& WesleyanCPV::LitPixels() const
+{
+  return lit;
+}
+
 inline int WesleyanCPV::Colors() const
 {
   return ((1 << (8 * DEPTH)) - 1);
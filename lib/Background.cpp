@@ -0,0 +1,174 @@
+/*
+ *  Background.cpp
+ *
+ *  Implementation of the background model.
+ *
+ *  Each modelled pixel has a slot, handed out when the pixel is first lit and
+ *  taken back when its background has gone to zero: at once for the minimum
+ *  (a dark frame makes the minimum zero until the pixel has been lit for a
+ *  whole window again, which a new slot also gives), after a whole dark
+ *  window for the median, and once the mean rounds to zero (what is left of
+ *  a forgotten mean can move a pixel lit again later by one at most).  The
+ *  frames a pixel is dark in are filled in when it is next lit.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <Background.h>
+
+using namespace std;
+
+BackgroundModel::BackgroundModel(const string& spec) throw(invalid_argument)
+: mode(NONE), window(1), alpha(1), frame(0)
+{
+	size_t colon = spec.find(':');
+	string name = spec.substr(0, colon);
+	string options = (colon == string::npos) ? string() : spec.substr(colon + 1);
+	string key = options.substr(0, options.find('='));
+	double value = (options.find('=') == string::npos) ? -1 : atof(options.c_str() + key.size() + 1);
+	if (name == "none" && options.empty()) {
+		mode = NONE;
+	} else if ((name == "min" || name == "median") && key == "frames" && value >= 1 && value <= 1024) {
+		mode = (name == "min") ? MINIMUM : MEDIAN;
+		window = static_cast<int>(value);
+	} else if (name == "mean" && key == "alpha" && value > 0 && value <= 1) {
+		mode = MEAN;
+		alpha = value;
+	} else {
+		throw invalid_argument("Bad background model \"" + spec
+		                       + "\" (use none, min:frames=N, median:frames=N or mean:alpha=a)");
+	}
+}
+
+double BackgroundModel::Background(int s)
+{
+	// the frames since the pixel was last lit were dark
+	int dark = frame - 1 - last[s];
+	if (mode == MEAN) {
+		if (dark > 0) {
+			mean[s] *= pow(1 - alpha, dark);
+		}
+		return mean[s];
+	}
+	unsigned short* h = &history[s * window];
+	for (int g = last[s] + 1; g < frame && g <= last[s] + window; ++g) {
+		h[g % window] = 0;
+	}
+	if (mode == MINIMUM) {
+		return *min_element(h, h + window);
+	}
+	sorted.assign(h, h + window);
+	nth_element(sorted.begin(), sorted.begin() + window / 2, sorted.end());
+	return sorted[window / 2];
+}
+
+void BackgroundModel::Add(int s, int value)
+{
+	if (mode == MEAN) {
+		mean[s] += alpha * (value - mean[s]);
+	} else {
+		history[s * window + frame % window] = value;
+	}
+	last[s] = frame;
+}
+
+void BackgroundModel::Expire()
+{
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < active.size(); ++i) {
+		int s = active[i];
+		bool alive;
+		if (mode == MINIMUM) {
+			alive = (last[s] == frame);
+		} else if (mode == MEDIAN) {
+			alive = (frame - last[s] < window);
+		} else {
+			alive = (mean[s] * pow(1 - alpha, frame - last[s]) >= 0.5);
+		}
+		if (alive) {
+			active[kept++] = s;
+		} else {
+			slot[owner[s]] = -1;
+			spare.push_back(s);
+		}
+	}
+	active.resize(kept);
+}
+
+template <class T>
+void BackgroundModel::Subtract(Image<T>& pixels, const vector<int>* lit)
+{
+	if (mode == NONE) {
+		return;
+	}
+	int cols = pixels.Cols();
+	int size = pixels.Rows() * cols;
+	if (static_cast<int>(slot.size()) != size) {
+		// a new frame size starts a new model
+		slot.assign(size, -1);
+		owner.clear();
+		last.clear();
+		history.clear();
+		mean.clear();
+		active.clear();
+		spare.clear();
+	}
+	if (lit == NULL) {
+		scan.clear();
+		for (int i = 0; i < pixels.Rows(); ++i) {
+			const T* row = pixels.Row(i);
+			for (int j = 0; j < cols; ++j) {
+				if (row[j] != 0) {
+					scan.push_back(i * cols + j);
+				}
+			}
+		}
+		lit = &scan;
+	}
+
+	for (unsigned int k = 0; k < lit->size(); ++k) {
+		int p = (*lit)[k];
+		T& v = pixels(p / cols, p % cols);
+		if (v == 0) {
+			continue;
+		}
+		int s = slot[p];
+		if (s < 0) {
+			// a pixel dark over the whole model has no background
+			if (spare.empty()) {
+				s = owner.size();
+				owner.push_back(p);
+				last.push_back(0);
+				history.resize(history.size() + (mode == MEAN ? 0 : window));
+				mean.push_back(0);
+			} else {
+				s = spare.back();
+				spare.pop_back();
+				owner[s] = p;
+			}
+			slot[p] = s;
+			last[s] = frame - 1;
+			mean[s] = 0;
+			if (mode != MEAN) {
+				fill(history.begin() + s * window, history.begin() + (s + 1) * window, 0);
+			}
+			active.push_back(s);
+		} else if (last[s] == frame) {
+			// listed twice
+			continue;
+		}
+		int raw = v;
+		int background = static_cast<int>(floor(Background(s) + 0.5));
+		v = (raw > background) ? raw - background : 0;
+		Add(s, raw);
+	}
+	Expire();
+	++frame;
+}
+
+// the pixel types we have decoders for
+template void BackgroundModel::Subtract(Image<unsigned char>&, const vector<int>*);
+template void BackgroundModel::Subtract(Image<unsigned short>&, const vector<int>*);
@@ -0,0 +1,216 @@
+/*
+ *  BlobFinder.cpp
+ *
+ *  Implementation of the blob engine of the particle finder.
+ *
+ */
+
+#include <algorithm>
+#include <pthread.h>
+
+#include <BlobFinder.h>
+#include <ParticleFinder.h>
+
+using namespace std;
+
+// a run of bright pixels in one row, from start to end - 1, and its sums
+struct Run {
+	int row;
+	int start;
+	int end;
+	double sum;
+	double sumx;
+	double sumy;
+	int peak;
+};
+
+// the runs of one band of rows; parent links runs joined into one blob, by
+// their numbers in the band
+template <class T>
+struct BlobBand {
+	const Image<T>* pixels;
+	int threshold;
+	int first;
+	int end;
+	int firstcol;
+	int endcol;
+	vector<Run> runs;
+	vector<int> parent;
+};
+
+static int Root(vector<int>& parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+// join two sets, keeping the lower number as the root so that a blob is
+// named after its first run
+static void Join(vector<int>& parent, int a, int b)
+{
+	a = Root(parent, a);
+	b = Root(parent, b);
+	if (a < b) {
+		parent[b] = a;
+	} else if (b < a) {
+		parent[a] = b;
+	}
+}
+
+// do two runs in neighbouring rows touch, diagonals included?
+static inline bool Touch(const Run& a, const Run& b)
+{
+	return a.start <= b.end && b.start <= a.end;
+}
+
+template <class T>
+static void* FindRuns(void* arg)
+{
+	BlobBand<T>* b = static_cast<BlobBand<T>*>(arg);
+	const Image<T>& pixels = *b->pixels;
+	int endcol = b->endcol;
+	// the runs of the row before
+	int prevfirst = 0;
+	int prevend = 0;
+	for (int i = b->first; i < b->end; ++i) {
+		const T* row = pixels.Row(i);
+		int rowfirst = b->runs.size();
+		for (int j = b->firstcol; j < endcol; ++j) {
+			if (row[j] < b->threshold) {
+				continue;
+			}
+			Run r;
+			r.row = i;
+			r.start = j;
+			r.sum = 0;
+			r.sumx = 0;
+			r.sumy = 0;
+			r.peak = 0;
+			for (; j < endcol && row[j] >= b->threshold; ++j) {
+				double v = row[j];
+				r.sum += v;
+				r.sumx += v * (j + 0.5);
+				r.peak = max(r.peak, static_cast<int>(row[j]));
+			}
+			r.end = j;
+			r.sumy = r.sum * (i + 0.5);
+			int n = b->runs.size();
+			b->runs.push_back(r);
+			b->parent.push_back(n);
+			for (int k = prevfirst; k < prevend; ++k) {
+				if (Touch(b->runs[k], r)) {
+					Join(b->parent, k, n);
+				}
+			}
+		}
+		prevfirst = rowfirst;
+		prevend = b->runs.size();
+	}
+	return NULL;
+}
+
+template <class T>
+void FindBlobs(const Image<T>& pixels, int threshold, int nthreads, vector<Blob>& blobs,
+               int first, int end, int firstcol, int endcol)
+{
+	blobs.clear();
+	// a blob is made of lit pixels, so that it has a centroid
+	threshold = max(threshold, 1);
+	first = max(first, 0);
+	end = (end < 0) ? pixels.Rows() : min(end, pixels.Rows());
+	firstcol = max(firstcol, 0);
+	endcol = (endcol < 0) ? pixels.Cols() : min(endcol, pixels.Cols());
+	if (first >= end || firstcol >= endcol) {
+		return;
+	}
+	int rows = end - first;
+	int nbands = max(1, min(nthreads, rows / ParticleFinder::MINBANDROWS));
+
+	vector< BlobBand<T> > bands(nbands);
+	for (int k = 0; k < nbands; ++k) {
+		bands[k].pixels = &pixels;
+		bands[k].threshold = threshold;
+		bands[k].first = first + rows * k / nbands;
+		bands[k].end = first + rows * (k + 1) / nbands;
+		bands[k].firstcol = firstcol;
+		bands[k].endcol = endcol;
+	}
+	// the first band is done on this thread
+	vector<pthread_t> threads(nbands);
+	vector<bool> started(nbands, false);
+	for (int k = 1; k < nbands; ++k) {
+		started[k] = (pthread_create(&threads[k], NULL, FindRuns<T>, &bands[k]) == 0);
+		if (!started[k]) {
+			FindRuns<T>(&bands[k]);
+		}
+	}
+	FindRuns<T>(&bands[0]);
+	for (int k = 1; k < nbands; ++k) {
+		if (started[k]) {
+			pthread_join(threads[k], NULL);
+		}
+	}
+
+	// number the runs of all the bands in order, and join the bands where
+	// they meet
+	vector<Run> runs;
+	vector<int> parent;
+	int prevfirst = 0;
+	for (int k = 0; k < nbands; ++k) {
+		int offset = runs.size();
+		runs.insert(runs.end(), bands[k].runs.begin(), bands[k].runs.end());
+		for (unsigned int i = 0; i < bands[k].parent.size(); ++i) {
+			parent.push_back(bands[k].parent[i] + offset);
+		}
+		// the last row of the band before, against the first row of this one
+		for (int a = prevfirst; a < offset; ++a) {
+			if (runs[a].row != bands[k].first - 1) {
+				continue;
+			}
+			for (int b = offset; b < static_cast<int>(runs.size()) && runs[b].row == bands[k].first; ++b) {
+				if (Touch(runs[a], runs[b])) {
+					Join(parent, a, b);
+				}
+			}
+		}
+		// where the last row of this band starts
+		prevfirst = runs.size();
+		while (prevfirst > offset && runs[prevfirst - 1].row == bands[k].end - 1) {
+			--prevfirst;
+		}
+	}
+
+	// add the runs up into blobs, in the order of the runs; a run that is its
+	// own root starts a blob
+	vector<int> blob(runs.size(), -1);
+	for (unsigned int i = 0; i < runs.size(); ++i) {
+		int root = Root(parent, i);
+		if (root == static_cast<int>(i)) {
+			blob[i] = blobs.size();
+			Blob b;
+			b.x = 0;
+			b.y = 0;
+			b.area = 0;
+			b.peak = 0;
+			b.intensity = 0;
+			blobs.push_back(b);
+		}
+		Blob& b = blobs[blob[root]];
+		b.x += runs[i].sumx;
+		b.y += runs[i].sumy;
+		b.area += runs[i].end - runs[i].start;
+		b.peak = max(b.peak, runs[i].peak);
+		b.intensity += runs[i].sum;
+	}
+	for (unsigned int i = 0; i < blobs.size(); ++i) {
+		blobs[i].x /= blobs[i].intensity;
+		blobs[i].y /= blobs[i].intensity;
+	}
+}
+
+// the pixel types we have decoders for
+template void FindBlobs(const Image<unsigned char>&, int, int, vector<Blob>&, int, int, int, int);
+template void FindBlobs(const Image<unsigned short>&, int, int, vector<Blob>&, int, int, int, int);
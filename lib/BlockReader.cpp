@@ -0,0 +1,230 @@
+/*
+ *  BlockReader.cpp
+ *
+ *  Implementation of the block-wise, read-ahead input file.
+ *
+ */
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <BlockReader.h>
+
+using namespace std;
+
+BlockReader::BlockReader(const string& filename, IOBackend* iob, size_t bs) throw(runtime_error)
+: size(0), mtime(0), pos(0), eofflag(false), blocksize(bs), lastblock(-1), count(0), io(iob), ownio(false)
+{
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+		size = st.st_size;
+		mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	}
+	if (io == NULL) {
+		io = IOBackend::Create("pread", 2);
+		ownio = true;
+	}
+
+	// one block being consumed plus the read-ahead window
+	int nslots = io->Depth() < 2 ? 2 : io->Depth();
+	try {
+		for (int i = 0; i < nslots; ++i) {
+			Slot s;
+			s.block = -1;
+			s.buf = new char[blocksize];
+			s.ticket = -1;
+			s.len = 0;
+			s.pending = false;
+			slots.push_back(s);
+		}
+	} catch (bad_alloc&) {
+		throw runtime_error("Failure to allocate buffers in BlockReader");
+	}
+}
+
+BlockReader::~BlockReader()
+{
+	for (unsigned int i = 0; i < slots.size(); ++i) {
+		try {
+			Settle(slots[i]);
+		} catch (runtime_error&) {
+			// nothing more to do with this block anyway
+		}
+		delete []slots[i].buf;
+	}
+	if (ownio) {
+		delete io;
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void BlockReader::Settle(Slot& s) throw(runtime_error)
+{
+	if (s.pending) {
+		s.pending = false;
+		s.len = io->Wait(s.ticket);
+	}
+}
+
+int BlockReader::Victim(off_t block) const
+{
+	off_t window = static_cast<off_t>(slots.size());
+	int best = -1;
+	off_t bestscore = -1;
+	for (unsigned int i = 0; i < slots.size(); ++i) {
+		off_t b = slots[i].block;
+		off_t score;
+		if (b < 0) {
+			// empty slot: always the best choice
+			return i;
+		} else if (b < block) {
+			// already consumed; the oldest goes first
+			score = 2 * window + (block - b);
+		} else if (b >= block + window) {
+			// outside the window ahead of us
+			score = b - block;
+		} else {
+			// inside the window; keep it
+			continue;
+		}
+		if (score > bestscore) {
+			bestscore = score;
+			best = i;
+		}
+	}
+	return best;
+}
+
+BlockReader::Slot& BlockReader::Load(off_t block) throw(runtime_error)
+{
+	for (unsigned int i = 0; i < slots.size(); ++i) {
+		if (slots[i].block == block) {
+			Settle(slots[i]);
+			return slots[i];
+		}
+	}
+	// the window always has room for the block we are about to read
+	int v = Victim(block);
+	Slot& s = slots[v < 0 ? 0 : v];
+	Settle(s);
+	s.block = block;
+	s.ticket = io->Queue(fd, s.buf, blocksize, block * static_cast<off_t>(blocksize));
+	s.pending = true;
+	// queue the read-ahead together with this block, then wait for this one
+	Prefetch(block);
+	lastblock = block;
+	Settle(s);
+	return s;
+}
+
+void BlockReader::Prefetch(off_t block) throw(runtime_error)
+{
+	off_t nblocks = (size + blocksize - 1) / blocksize;
+	for (off_t b = block + 1; b < block + static_cast<off_t>(slots.size()) && b < nblocks; ++b) {
+		bool have = false;
+		for (unsigned int i = 0; i < slots.size(); ++i) {
+			if (slots[i].block == b) {
+				have = true;
+				break;
+			}
+		}
+		if (have) {
+			continue;
+		}
+		int v = Victim(block);
+		if (v < 0) {
+			break;
+		}
+		Slot& s = slots[v];
+		Settle(s);
+		s.block = b;
+		s.ticket = io->Queue(fd, s.buf, blocksize, b * static_cast<off_t>(blocksize));
+		s.pending = true;
+	}
+	io->Submit();
+}
+
+BlockReader& BlockReader::read(char* dst, streamsize n)
+{
+	count = 0;
+	while (n > 0) {
+		if (fd < 0 || pos >= size) {
+			eofflag = true;
+			return *this;
+		}
+		off_t block = pos / blocksize;
+		off_t offset = pos - block * blocksize;
+		Slot& s = Load(block);
+		if (block != lastblock) {
+			// stay one window ahead of the reader as it moves into a new block
+			Prefetch(block);
+			lastblock = block;
+		}
+		if (s.len <= offset) {
+			eofflag = true;
+			return *this;
+		}
+		streamsize chunk = s.len - offset;
+		if (chunk > n) {
+			chunk = n;
+		}
+		memcpy(dst, s.buf + offset, chunk);
+		dst += chunk;
+		pos += chunk;
+		n -= chunk;
+		count += chunk;
+	}
+	return *this;
+}
+
+const char* BlockReader::Fetch(streamsize n)
+{
+	if (fd >= 0 && pos < size) {
+		off_t block = pos / blocksize;
+		off_t offset = pos - block * blocksize;
+		if (offset + n <= static_cast<off_t>(blocksize)) {
+			// the whole record is inside one block: hand out a pointer into it
+			Slot& s = Load(block);
+			if (block != lastblock) {
+				Prefetch(block);
+				lastblock = block;
+			}
+			count = s.len > offset ? s.len - offset : 0;
+			if (count < n) {
+				eofflag = true;
+			} else {
+				count = n;
+			}
+			pos += count;
+			return s.buf + offset;
+		}
+	}
+	// the record straddles a block boundary: gather it
+	scratch.resize(n > 0 ? n : 1);
+	read(&scratch[0], n);
+	return &scratch[0];
+}
+
+BlockReader& BlockReader::seekg(off_t off, ios::seekdir dir)
+{
+	eofflag = false;
+	if (dir == ios::cur) {
+		pos += off;
+	} else if (dir == ios::end) {
+		pos = size + off;
+	} else {
+		pos = off;
+	}
+	if (pos < 0) {
+		pos = 0;
+	}
+	return *this;
+}
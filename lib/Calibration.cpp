@@ -16,6 +16,7 @@
 
 #include <sstream>
 #include <iostream>
+#include <cstdlib>
 #include <algorithm>
 #include <list>
 #include <vector>
@@ -27,6 +28,7 @@
 using namespace std;
 
 Calibration::Calibration(std::string& fname)
+: maxpeakratio(0), maxarearatio(0)
 {
 	// remove comments from the file
 	ifstream infile(fname.c_str(), ios::in);
@@ -38,7 +40,8 @@ Calibration::Calibration(std::string& fname)
 			if (commentpos < string::npos) {
 				line.erase(commentpos);
 			}
-			parsed << line << '\t';
+			// lines kept apart, for the entries that must fit on one
+			parsed << line << '\n';
 		}
 	}
 	infile.close();
@@ -55,60 +58,116 @@ Calibration::Calibration(std::string& fname)
 	parsed >> mindist_2D >> mindist_3D;
 }
 
-void Calibration::writeGDFHeader(std::string outname)
+void Calibration::OpenOutput(std::string outname, std::string precision, int framing) throw(runtime_error, invalid_argument)
 {
-	// open the output file with a temporary header
-	outfile.open(outname.c_str(), ios::out | ios::binary);
-	int magic = 82991;
-	outfile.write(reinterpret_cast<const char*>(&magic), 4);
-	// number of dimensions
-	int tmpi = 2;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-	// number of columns
-	tmpi = 17;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-	// number of rows: we don't know this yet!
-	tmpi = 0;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-	// a 4 means single presicion, 5 double precision
-	tmpi = 5;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-	// number of total points: we don't know this yet!
-	tmpi = 0;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	// framenumber, x, y, z, intersect, then x, y and orientation on each camera
+	vector<string> columns;
+	columns.push_back("frame");
+	columns.push_back("x");
+	columns.push_back("y");
+	columns.push_back("z");
+	columns.push_back("raydist");
+	for (int i = 1; i <= ncams; ++i) {
+		stringstream n;
+		n << i;
+		columns.push_back("x" + n.str());
+		columns.push_back("y" + n.str());
+		columns.push_back("ori" + n.str());
+	}
+	outfile.Open(outname, columns, precision, framing);
 
 	cout << "\nHeader information written..." << endl;
 
 }
 
-void Calibration::fixHeader(int nr, int cols){
-	
-	// now fix up the header with the proper sizes
-	outfile.seekp(8, ios::beg);
-	outfile.write(reinterpret_cast<const char*>(&cols), 4);
-	outfile.write(reinterpret_cast<const char*>(&nr), 4);
-	outfile.seekp(4, ios::cur);
-	int tmpi = cols * nr;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-	cout << "\nHeader information updated!" << endl;
+void Calibration::CloseOutput() throw(runtime_error)
+{
+	// the header gets the proper sizes as the file is closed, unless it is
+	// streamed, when they go in the trailer instead
+	bool streaming = outfile.Streaming();
+	outfile.Close();
+	if (!streaming) {
+		cout << "\nHeader information updated!" << endl;
+	}
+}
+
+void Calibration::SetFeatureGate(const string& spec) throw(invalid_argument)
+{
+	maxpeakratio = 0;
+	maxarearatio = 0;
+	if (spec == "none") {
+		return;
+	}
+	bool good = (spec.compare(0, 6, "ratio:") == 0 && spec.size() > 6);
+	stringstream options(good ? spec.substr(6) : string());
+	string option;
+	while (good && getline(options, option, ',')) {
+		size_t equals = option.find('=');
+		string key = option.substr(0, equals);
+		double value = (equals == string::npos) ? 0 : atof(option.c_str() + equals + 1);
+		if (key == "peak" && value >= 1) {
+			maxpeakratio = value;
+		} else if (key == "area" && value >= 1) {
+			maxarearatio = value;
+		} else {
+			good = false;
+		}
+	}
+	if (!good) {
+		throw invalid_argument("Bad feature gate \"" + spec + "\" (use none or ratio:peak=P,area=A, with P and A at least 1)");
+	}
+}
+
+// do two features of a candidate pair agree to within a ratio?
+static inline bool Agree(int a, int b, double ratio)
+{
+	return ratio == 0 || a <= 0 || b <= 0 || max(a, b) <= ratio * min(a, b);
+}
+
+// the storage of a column of coordinates (which may be empty)
+static inline double* Column(vector<double>& v)
+{
+	return v.empty() ? NULL : &v[0];
 }
 
-Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber) throw(runtime_error)
+Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber, const deque<Detections>* features)
+throw(runtime_error)
 {
     if (iframes.size() != cams.size()) {
         throw runtime_error("Number of cameras and number of images do not match!");
     }
+    bool gated = (features != NULL && (maxpeakratio > 0 || maxarearatio > 0));
+    for (int i = 0; gated && i < ncams; ++i) {
+        if (static_cast<int>(features->size()) != ncams || (*features)[i].Size() != iframes[i].NumParticles()) {
+            throw runtime_error("The features do not match the particles!");
+        }
+    }
+    int gatedpairs = 0;
     
     // step 1.
     // correct all the distortions, and move the points into a coordinate
     // system (in mm) with the origin in the middle of the image plane.
+    // the corrected coordinates are also kept camera by camera in arrays,
+    // which the projections below go through a whole camera at a time.
     deque<Frame> corrframes;
+    vector< vector<double> > cx(ncams), cy(ncams), cz(ncams);
     cout << "\tCorrecting distortion..." << endl;
     for (int i = 0; i < ncams; ++i) {
-        deque<Position> corrpos;
+        int n = iframes[i].NumParticles();
+        cx[i].resize(n);
+        cy[i].resize(n);
+        cz[i].resize(n);
         Frame::const_iterator fitend = iframes[i].end();
         for (Frame::const_iterator fit = iframes[i].begin(); fit != fitend; ++fit) {
-            corrpos.push_back(cams[i].UnDistort(*fit));
+            cx[i][fit.where()] = fit->X();
+            cy[i][fit.where()] = fit->Y();
+            cz[i][fit.where()] = fit->Z();
+        }
+        cams[i].UnDistort(n, Column(cx[i]), Column(cy[i]), Column(cx[i]), Column(cy[i]));
+        deque<Position> corrpos;
+        for (Frame::const_iterator fit = iframes[i].begin(); fit != fitend; ++fit) {
+            int j = fit.where();
+            corrpos.push_back(Position(cx[i][j], cy[i][j], cz[i][j], fit->Ori()));
         }
         corrframes.push_back(Frame(corrpos));
     }
@@ -123,39 +182,67 @@ Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber) thr
     mcam = -1;
     // nasty data structure; is there a better way to do this?
     list<Frame::const_iterator> ***pairlists = new list<Frame::const_iterator>**[ncams];
+    vector<double> wx, wy, wz;
+    vector< vector<double> > px(ncams), py(ncams), pz(ncams);
+    vector<Vec3> centers(ncams);
     for (int i = 0 ; i < ncams; ++i) {
         pairlists[i] = new list<Frame::const_iterator>*[corrframes[i].NumParticles()];
+        // the particles of frame i in world space, and projected on each other camera
+        int n = corrframes[i].NumParticles();
+        wx.resize(n);
+        wy.resize(n);
+        wz.resize(n);
+        cams[i].ImageToWorld(n, Column(cx[i]), Column(cy[i]), Column(wx), Column(wy), Column(wz));
+        for (int k = 0; k < ncams; ++k) {
+            if (i == k) {
+                continue;
+            }
+            px[k].resize(n);
+            py[k].resize(n);
+            pz[k].resize(n);
+            cams[k].WorldToImage(n, Column(wx), Column(wy), Column(wz), Column(px[k]), Column(py[k]), Column(pz[k]));
+            // position of camera i's projective center on camera k
+            centers[k] = cams[k].WorldToImage(cams[i].Center());
+        }
         // loop over particles in frame i
         Frame::const_iterator pAend = corrframes[i].end();
 //         cout << "\tList size, corrframes[i].NumParticles(): " << corrframes[i].NumParticles() << endl;
         for (Frame::const_iterator pA = corrframes[i].begin(); pA != pAend; ++pA) {
-            // this particle's coordinates in world space
 //             cout << "\tChecking particle[" << pA.where() << "/" << corrframes[i].NumParticles()-1 << "] at [" << cams[i].Distort(*pA).X() << ", " << cams[i].Distort(*pA).Y() << "] on camera " << i << endl;
-            Position pAworld(cams[i].ImageToWorld(*pA));
-            pairlists[i][pA.where()] = new list<Frame::const_iterator>[ncams];
+            int a = pA.where();
+            pairlists[i][a] = new list<Frame::const_iterator>[ncams];
             for (int k = 0; k < ncams; ++k) {
                 if (i == k) {
                     continue;
                 }
-                // position of camera i's projective center on camera k
-                Position center(cams[k].WorldToImage(cams[i].Center())); /* DIFF */
+                const Vec3& center = centers[k]; /* DIFF */
                 // position of this particle on camera k
-                Position particle(cams[k].WorldToImage(pAworld));
+                Vec3 particle(px[k][a], py[k][a], pz[k][a]);
                 // unit vector in (projected) line of sight direction
-                Position lineofsight(particle - center);
+                Vec3 lineofsight(particle - center);
                 lineofsight /= lineofsight.Magnitude();
                 // unit vector normal to the line of sight
-                Position perpdir(lineofsight.Y(), -lineofsight.X(), 0);
+                Vec3 perpdir(lineofsight.y, -lineofsight.x, 0);
                 
                 // now loop over the particles in frame k
                 Frame::const_iterator pBend = corrframes[k].end();
                 for (Frame::const_iterator pB = corrframes[k].begin(); pB != pBend; ++pB) {
                     // if the distance from camera i's projective center along perpdir
                     // is less than mindist_2D, this is a potential match!
-                    Position pBline(*pB - center);
+                    int b = pB.where();
+                    Vec3 pBline(Vec3(cx[k][b], cy[k][b], cz[k][b]) - center);
                     if (abs(Dot(pBline, perpdir)) < mindist_2D) {
+                        // do the two look like the same particle?
+                        if (gated) {
+                            const Detections& fA = (*features)[i];
+                            const Detections& fB = (*features)[k];
+                            if (!Agree(fA.peak[pA.where()], fB.peak[pB.where()], maxpeakratio)
+                                || !Agree(fA.area[pA.where()], fB.area[pB.where()], maxarearatio)) {
+                                ++gatedpairs;
+                                continue;
+                            }
+                        }
                         pairlists[i][pA.where()][k].push_back(pB);
-                        Position pB_check(*pB);
 //                         cout << "\t\tpairlists[" << i << "][" << pA.where() << "][" << k << "]: Particle[" << pA.where() << "] found a possible match on camera " << k << " at [" << cams[k].Distort(pB_check).X() << ", " << cams[k].Distort(pB_check).Y() << "] distance: " << abs(Dot(pBline, perpdir)) << endl;
                     }
                 }
@@ -175,6 +262,9 @@ Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber) thr
     }
 
 	cout << "\tMean pairlist size: " << static_cast<double>(avgsize)/static_cast<double>(numlists) << endl;
+	if (gated) {
+		cout << "\tFeature gate dropped " << gatedpairs << " candidate pair(s)" << endl;
+	}
 	
 	// step 3.
 	// go through the lists and search for consistency; that is, particles that show up 
@@ -337,41 +427,19 @@ Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber) thr
 //         for (int kam = 0; kam < ncams; ++kam) {
 //             cout << "\t\tCamera " << kam << " (used 2d coords): [" << cams[kam].Distort((PosTouse[i])[kam]).X() << ", " << cams[kam].Distort((PosTouse[i])[kam]).Y() << "]" << endl;
 //         }
-		double tmp = framenumber; 
-		outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = matchedPos[i].X();
-		outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = matchedPos[i].Y();
-		outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = matchedPos[i].Z();
-		outfile.write(reinterpret_cast<const char*>(&tmp), 8);
+		outfile.Set(0, framenumber);
+		outfile.Set(1, matchedPos[i].X());
+		outfile.Set(2, matchedPos[i].Y());
+		outfile.Set(3, matchedPos[i].Z());
 		//cout << "\tInfo: " << wpos.second.Info() << endl;
-		tmp = raydists[i];
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((PosTouse[i])[0]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((PosTouse[i])[0]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((PosTouse[i])[0]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[1].Distort((PosTouse[i])[1]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[1].Distort((PosTouse[i])[1]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[1].Distort((PosTouse[i])[1]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((PosTouse[i])[2]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((PosTouse[i])[2]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((PosTouse[i])[2]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((PosTouse[i])[3]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((PosTouse[i])[3]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((PosTouse[i])[3]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
+		outfile.Set(4, raydists[i]);
+		for (int kam = 0; kam < ncams; ++kam) {
+			Position d = cams[kam].Distort((PosTouse[i])[kam]);
+			outfile.Set(5 + 3 * kam, d.X());
+			outfile.Set(6 + 3 * kam, d.Y());
+			outfile.Set(7 + 3 * kam, d.Ori());
+		}
+		outfile.EndRow();
         
 		goodPos.push_back(matchedPos[i]);
 //         cout << "\tgoodPos 3D pos (in mm):\t" << goodPos[i].X() << " " << goodPos[i].Y() << " " << goodPos[i].Z() << "\n\tIntersect error (in mm):\t" << raydists[i] << endl;
@@ -797,41 +865,19 @@ Frame Calibration::Stereomatch(const deque<Frame>& iframes, int framenumber) thr
 //         for (int kam = 0; kam < ncams; ++kam) {
 //             cout << "\t\tCamera " << kam << " (used 2d coords): [" << cams[kam].Distort((goodPosTouse3[kam])[i]).X() << ", " << cams[kam].Distort((goodPosTouse3[kam])[i]).Y() << "]" << endl;
 //         }
-        double tmp = framenumber; 
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = goodPos3[i].X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = goodPos3[i].Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = goodPos3[i].Z();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
+        outfile.Set(0, framenumber);
+        outfile.Set(1, goodPos3[i].X());
+        outfile.Set(2, goodPos3[i].Y());
+        outfile.Set(3, goodPos3[i].Z());
         //cout << "\tInfo: " << wpos.second.Info() << endl;
-        tmp = raydists3[i];
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((goodPosTouse3[0])[i]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((goodPosTouse3[0])[i]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[0].Distort((goodPosTouse3[0])[i]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);  
-        tmp = cams[1].Distort((goodPosTouse3[1])[i]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[1].Distort((goodPosTouse3[1])[i]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[1].Distort((goodPosTouse3[1])[i]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((goodPosTouse3[2])[i]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((goodPosTouse3[2])[i]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[2].Distort((goodPosTouse3[2])[i]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((goodPosTouse3[3])[i]).X();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((goodPosTouse3[3])[i]).Y();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
-        tmp = cams[3].Distort((goodPosTouse3[3])[i]).Ori();
-        outfile.write(reinterpret_cast<const char*>(&tmp), 8);
+        outfile.Set(4, raydists3[i]);
+        for (int kam = 0; kam < ncams; ++kam) {
+            Position d = cams[kam].Distort((goodPosTouse3[kam])[i]);
+            outfile.Set(5 + 3 * kam, d.X());
+            outfile.Set(6 + 3 * kam, d.Y());
+            outfile.Set(7 + 3 * kam, d.Ori());
+        }
+        outfile.EndRow();
         goodPos.push_back(goodPos3[i]);
     }
     
@@ -868,10 +914,10 @@ pair<double,Position> Calibration::WorldPosition(deque<Position> ipos) throw(run
 	// embarrassingly, see 
 	// http://en.wikipedia.org/wiki/Line-line_intersection
 
-	Matrix M;
-	Position P(0, 0, 0);
+	Mat3 M;
+	Vec3 P(0, 0, 0);
 	
-	Position sight[ncams-ncams_missing];
+	Vec3 sight[ncams-ncams_missing];
     
 	int ic = 0;
 	for (int i = 0; i < ncams; ++i) {
@@ -880,23 +926,23 @@ pair<double,Position> Calibration::WorldPosition(deque<Position> ipos) throw(run
         }
 		// construct a line of sight for this point:
 		// vector from camera center to this point (in world coordinates)
-		sight[ic] = cams[i].ImageToWorld(ipos[i]) - cams[i].Center();
+		sight[ic] = cams[i].ImageToWorld(Vec3(ipos[i])) - cams[i].Center();
 		// normalize
 		sight[ic] /= sight[ic].Magnitude();
 		
 		// add to the least-squares matrices
 		
 		// inelegant, but it works
-		Matrix tmp;
-		tmp.Set(0, 0, 1 - sight[ic].X() * sight[ic].X());
-		tmp.Set(0, 1, -sight[ic].X() * sight[ic].Y());
-		tmp.Set(0, 2, -sight[ic].X() * sight[ic].Z());
-		tmp.Set(1, 0, -sight[ic].Y() * sight[ic].X());
-		tmp.Set(1, 1, 1 - sight[ic].Y() * sight[ic].Y());
-		tmp.Set(1, 2, -sight[ic].Y() * sight[ic].Z());
-		tmp.Set(2, 0, -sight[ic].Z() * sight[ic].X());
-		tmp.Set(2, 1, -sight[ic].Z() * sight[ic].Y());
-		tmp.Set(2, 2, 1 - sight[ic].Z() * sight[ic].Z());
+		Mat3 tmp;
+		tmp.Set(0, 0, 1 - sight[ic].x * sight[ic].x);
+		tmp.Set(0, 1, -sight[ic].x * sight[ic].y);
+		tmp.Set(0, 2, -sight[ic].x * sight[ic].z);
+		tmp.Set(1, 0, -sight[ic].y * sight[ic].x);
+		tmp.Set(1, 1, 1 - sight[ic].y * sight[ic].y);
+		tmp.Set(1, 2, -sight[ic].y * sight[ic].z);
+		tmp.Set(2, 0, -sight[ic].z * sight[ic].x);
+		tmp.Set(2, 1, -sight[ic].z * sight[ic].y);
+		tmp.Set(2, 2, 1 - sight[ic].z * sight[ic].z);
 		
 		P += tmp * cams[i].Center();
 		M += tmp;
@@ -904,8 +950,7 @@ pair<double,Position> Calibration::WorldPosition(deque<Position> ipos) throw(run
 	}
 	
 	// invert the matrix and construct the 3D position
-	Position tmpi(M.Invert() * P);
-	Position worldpos(M.Invert() * P);
+	Vec3 worldpos(M.Invert() * P);
 	
 	// calculate the rms distance from worldpos to each ray
 	double dist = 0;
@@ -914,12 +959,12 @@ pair<double,Position> Calibration::WorldPosition(deque<Position> ipos) throw(run
         if (i == mcam) {
             continue;
         }
-		Position h = (worldpos - Dot(worldpos, sight[ic]) * sight[ic] - (cams[i].Center() - Dot(cams[i].Center(), sight[ic]) * sight[ic]));
+		Vec3 h = (worldpos - Dot(worldpos, sight[ic]) * sight[ic] - (cams[i].Center() - Dot(cams[i].Center(), sight[ic]) * sight[ic]));
 		dist += h.Magnitude2();
         ic += 1;
 	}
 	dist /= static_cast<double>(ncams-ncams_missing);
 
-	Position worldposi(tmpi.X(),tmpi.Y(),tmpi.Z(), cams[0].Distort(ipos[0]).X(), cams[0].Distort(ipos[0]).Y(), ipos[0].Ori(),cams[1].Distort(ipos[1]).X(), cams[1].Distort(ipos[1]).Y(), ipos[1].Ori(),cams[2].Distort(ipos[2]).X(), cams[2].Distort(ipos[2]).Y(),  ipos[2].Ori(), cams[3].Distort(ipos[3]).X(), cams[3].Distort(ipos[3]).Y(), ipos[3].Ori(), dist);
+	Position worldposi(worldpos.x, worldpos.y, worldpos.z, cams[0].Distort(ipos[0]).X(), cams[0].Distort(ipos[0]).Y(), ipos[0].Ori(),cams[1].Distort(ipos[1]).X(), cams[1].Distort(ipos[1]).Y(), ipos[1].Ori(),cams[2].Distort(ipos[2]).X(), cams[2].Distort(ipos[2]).Y(),  ipos[2].Ori(), cams[3].Distort(ipos[3]).X(), cams[3].Distort(ipos[3]).Y(), ipos[3].Ori(), dist);
 	return make_pair(dist,worldposi);
 }
@@ -14,13 +14,15 @@
  *
  */
 
+#include <sstream>
+
 #include <Camera.h>
 #include <string.h>
 #include <limits.h>
 
 using namespace std;
 
-Camera::Camera(istream& is)
+Camera::Camera(istream& is) throw(runtime_error)
 {
 	is >> Npixw;
 	is >> Npixh;
@@ -33,17 +35,64 @@ Camera::Camera(istream& is)
 	for (int i = 0; i < 9; ++i) {
 		is >> buffer[i];
 	}
-	R = Matrix(buffer);
+	R = Mat3(buffer);
 	for (int i = 0; i < 3; ++i) {
 		is >> buffer[i];
 	}
-	T = Position(buffer[0], buffer[1], buffer[2]);
+	T = Vec3(buffer[0], buffer[1], buffer[2]);
 	for (int i = 0; i < 9; ++i) {
 		is >> buffer[i];
 	}
-	Rinv = Matrix(buffer);
+	Rinv = Mat3(buffer);
 	for (int i = 0; i < 3; ++i) {
 		is >> buffer[i];
 	}
-	Tinv = Position(buffer[0], buffer[1], buffer[2]);
+	Tinv = Vec3(buffer[0], buffer[1], buffer[2]);
+
+	proj.halfw = Npixw / 2;
+	proj.halfh = Npixh / 2;
+	proj.wpix = wpix;
+	proj.hpix = hpix;
+	proj.invwpix = 1.0 / wpix;
+	proj.invhpix = 1.0 / hpix;
+	proj.f_eff = f_eff;
+	for (int i = 0; i < 9; ++i) {
+		proj.R[i] = R.m[i];
+		proj.Rinv[i] = Rinv.m[i];
+	}
+	proj.T[0] = T.x;
+	proj.T[1] = T.y;
+	proj.T[2] = T.z;
+
+	// any number of "roi col0 row0 col1 row1" and "mask file.pgm" entries
+	// (see RegionOfInterest.h); anything else belongs to what follows
+	roi = RegionOfInterest(Npixh, Npixw);
+	for (;;) {
+		streampos at = is.tellg();
+		string key;
+		if (!(is >> key)) {
+			is.clear();
+			is.seekg(at);
+			break;
+		}
+		if (key == "roi") {
+			// exactly four numbers, on the same line
+			string rest;
+			getline(is, rest);
+			istringstream entry(rest);
+			int col0, row0, col1, row1;
+			if (!(entry >> col0 >> row0 >> col1 >> row1) || !(entry >> ws).eof()) {
+				throw runtime_error("Bad region of interest entry \"roi" + rest
+				                    + "\" in the camera calibration (use roi col0 row0 col1 row1)");
+			}
+			roi.AddRectangle(col0, row0, col1, row1);
+		} else if (key == "mask") {
+			string name;
+			is >> name;
+			roi.AddMask(name);
+		} else {
+			is.seekg(at);
+			break;
+		}
+	}
 }
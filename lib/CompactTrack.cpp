@@ -0,0 +1,437 @@
+/*
+ *  CompactTrack.cpp
+ *
+ *  Implementation of the compact track encoding.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <CompactTrack.h>
+
+using namespace std;
+
+// Varints: 7 bits per byte, low bits first, high bit set on all but the last
+// byte.  Signed values are zigzagged first, so that small negative numbers
+// stay short: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+
+static inline void PutVarint(vector<unsigned char>& out, unsigned long long v)
+{
+	while (v >= 0x80) {
+		out.push_back(static_cast<unsigned char>(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back(static_cast<unsigned char>(v));
+}
+
+static inline void PutSigned(vector<unsigned char>& out, long long v)
+{
+	PutVarint(out, (static_cast<unsigned long long>(v) << 1) ^ static_cast<unsigned long long>(v >> 63));
+}
+
+static inline void PutRaw(vector<unsigned char>& out, const void* p, size_t n)
+{
+	const unsigned char* c = static_cast<const unsigned char*>(p);
+	out.insert(out.end(), c, c + n);
+}
+
+static inline unsigned long long GetVarint(const unsigned char*& p, const unsigned char* end) throw(runtime_error)
+{
+	unsigned long long v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p >= end) {
+			break;
+		}
+		unsigned char b = *p++;
+		v |= static_cast<unsigned long long>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return v;
+		}
+	}
+	throw runtime_error("Corrupt varint in compact track file");
+}
+
+static inline long long GetSigned(const unsigned char*& p, const unsigned char* end) throw(runtime_error)
+{
+	unsigned long long v = GetVarint(p, end);
+	return static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1);
+}
+
+// read a varint straight from a file; false at the end of the file
+static bool ReadVarint(ifstream& in, unsigned long long& v)
+{
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = in.get();
+		if (b == EOF) {
+			return false;
+		}
+		v |= static_cast<unsigned long long>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// the default quantization step of a track GDF column
+static double DefaultStep(const string& name)
+{
+	if (name == "x" || name == "y" || name == "z") {
+		// world coordinates in mm
+		return 1e-6;
+	} else if (name == "info") {
+		// the intersection error is far below any sensible step
+		return 0;
+	}
+	// image coordinates and orientations
+	return 1e-4;
+}
+
+CompactTrackWriter::CompactTrackWriter(const string& name, double ifps, const string& overrides)
+throw(runtime_error, invalid_argument)
+: fd(-1), filename(name), fps(ifps), ntracks(0), npoints(0), lastid(0), laststart(0)
+{
+	names = Track::GDFColumns();
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		if (names[i] == "index") {
+			roles.push_back(CT_INDEX);
+		} else if (names[i] == "time") {
+			roles.push_back(CT_TIME);
+		} else if (names[i] == "fake") {
+			roles.push_back(CT_FAKE);
+		} else {
+			roles.push_back(CT_VALUE);
+		}
+		steps.push_back(roles.back() == CT_VALUE ? DefaultStep(names[i]) : 0);
+	}
+
+	// column=step overrides
+	size_t start = 0;
+	while (start < overrides.size()) {
+		size_t comma = overrides.find(',', start);
+		string item = overrides.substr(start, comma == string::npos ? string::npos : comma - start);
+		start = (comma == string::npos) ? overrides.size() : comma + 1;
+		size_t eq = item.find('=');
+		int col = -1;
+		for (unsigned int i = 0; eq != string::npos && i < names.size(); ++i) {
+			if (names[i] == item.substr(0, eq) && roles[i] == CT_VALUE) {
+				col = i;
+			}
+		}
+		double step = (eq == string::npos) ? -1 : atof(item.substr(eq + 1).c_str());
+		if (col < 0 || step < 0) {
+			throw invalid_argument("Bad compact track quantization step \"" + item + "\" (use column=step)");
+		}
+		steps[col] = step;
+	}
+
+	if (filename == "-") {
+		// our own descriptor for stdout, so that Close() can close it
+		fd = dup(STDOUT_FILENO);
+	} else {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (fd < 0) {
+		throw runtime_error("Could not open compact track file " + filename + ": " + strerror(errno));
+	}
+	vector<unsigned char> header;
+	int tmpi = MAGIC;
+	PutRaw(header, &tmpi, 4);
+	tmpi = VERSION;
+	PutRaw(header, &tmpi, 4);
+	PutRaw(header, &fps, 8);
+	tmpi = names.size();
+	PutRaw(header, &tmpi, 4);
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		PutRaw(header, &roles[i], 4);
+		PutRaw(header, &steps[i], 8);
+		tmpi = names[i].size();
+		PutRaw(header, &tmpi, 4);
+		PutRaw(header, names[i].data(), names[i].size());
+	}
+	Put(&header[0], header.size());
+}
+
+CompactTrackWriter::~CompactTrackWriter()
+{
+	try {
+		Close();
+	} catch (runtime_error&) {
+		// nothing sensible to do about it here
+	}
+}
+
+void CompactTrackWriter::Write(const Track& t, double index) throw(runtime_error)
+{
+	int len = t.Length();
+	if (len <= 0) {
+		return;
+	}
+	long long id = static_cast<long long>(index);
+	int start = t.GetTime(0);
+
+	// are the frames consecutive?
+	unsigned long long flags = 0;
+	for (int i = 1; i < len; ++i) {
+		if (t.GetTime(i) != start + i) {
+			flags |= 1;
+			break;
+		}
+	}
+
+	// all the values of the track, point by point
+	int ncols = names.size();
+	column.resize(static_cast<size_t>(len) * ncols);
+	for (int i = 0; i < len; ++i) {
+		t.GDFRow(i, index, fps, &column[static_cast<size_t>(i) * ncols]);
+	}
+	// columns that cannot be quantized in this track are stored raw
+	for (int c = 0; c < ncols; ++c) {
+		if (roles[c] != CT_VALUE || steps[c] == 0) {
+			continue;
+		}
+		for (int i = 0; i < len; ++i) {
+			double q = column[static_cast<size_t>(i) * ncols + c] / steps[c];
+			if (!(fabs(q) < 4e18)) {
+				flags |= 2ULL << c;
+				break;
+			}
+		}
+	}
+
+	record.clear();
+	PutSigned(record, id - lastid);
+	PutSigned(record, static_cast<long long>(start) - laststart);
+	PutVarint(record, flags);
+	if (flags & 1) {
+		for (int i = 1; i < len; ++i) {
+			PutSigned(record, static_cast<long long>(t.GetTime(i)) - t.GetTime(i - 1));
+		}
+	}
+	// fake bitmap
+	size_t bitmap = record.size();
+	record.resize(bitmap + (len + 7) / 8, 0);
+	for (int c = 0; c < ncols; ++c) {
+		if (roles[c] != CT_FAKE) {
+			continue;
+		}
+		for (int i = 0; i < len; ++i) {
+			if (column[static_cast<size_t>(i) * ncols + c] != 0) {
+				record[bitmap + i / 8] |= 1 << (i % 8);
+			}
+		}
+	}
+	// value columns
+	for (int c = 0; c < ncols; ++c) {
+		if (roles[c] != CT_VALUE) {
+			continue;
+		}
+		if (steps[c] == 0 || (flags & (2ULL << c))) {
+			for (int i = 0; i < len; ++i) {
+				PutRaw(record, &column[static_cast<size_t>(i) * ncols + c], 8);
+			}
+			continue;
+		}
+		long long prev = 0;
+		for (int i = 0; i < len; ++i) {
+			long long q = llround(column[static_cast<size_t>(i) * ncols + c] / steps[c]);
+			PutSigned(record, q - prev);
+			prev = q;
+		}
+	}
+
+	vector<unsigned char> prefix;
+	PutVarint(prefix, len);
+	PutVarint(prefix, record.size());
+	Put(&prefix[0], prefix.size());
+	Put(&record[0], record.size());
+
+	lastid = id;
+	laststart = start;
+	++ntracks;
+	npoints += len;
+}
+
+void CompactTrackWriter::Close() throw(runtime_error)
+{
+	if (fd < 0) {
+		return;
+	}
+	vector<unsigned char> trailer;
+	PutVarint(trailer, 0);
+	PutRaw(trailer, &ntracks, 8);
+	PutRaw(trailer, &npoints, 8);
+	int tmpi = MAGIC;
+	PutRaw(trailer, &tmpi, 4);
+	Put(&trailer[0], trailer.size());
+	WriteOut();
+	int result = close(fd);
+	fd = -1;
+	if (result != 0) {
+		throw runtime_error("Could not close compact track file " + filename + ": " + strerror(errno));
+	}
+}
+
+void CompactTrackWriter::Put(const void* p, size_t n) throw(runtime_error)
+{
+	const char* c = static_cast<const char*>(p);
+	pending.insert(pending.end(), c, c + n);
+	if (pending.size() >= BUFFERSIZE) {
+		WriteOut();
+	}
+}
+
+void CompactTrackWriter::WriteOut() throw(runtime_error)
+{
+	const char* data = pending.empty() ? NULL : &pending[0];
+	size_t len = pending.size();
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			throw runtime_error("Could not write to compact track file " + filename + ": " + strerror(errno));
+		}
+		data += n;
+		len -= n;
+	}
+	pending.clear();
+}
+
+CompactTrackReader::CompactTrackReader(const string& name) throw(runtime_error)
+: filename(name), fps(1), ntracks(0), npoints(0), lastid(0), laststart(0), done(false)
+{
+	infile.open(filename.c_str(), ios::in | ios::binary);
+	if (!infile.is_open()) {
+		throw runtime_error("Could not open compact track file " + filename);
+	}
+	int magic, version, ncols;
+	infile.read(reinterpret_cast<char*>(&magic), 4);
+	infile.read(reinterpret_cast<char*>(&version), 4);
+	infile.read(reinterpret_cast<char*>(&fps), 8);
+	infile.read(reinterpret_cast<char*>(&ncols), 4);
+	if (!infile.good() || magic != CompactTrackWriter::MAGIC) {
+		throw runtime_error("Not a compact track file: " + filename);
+	}
+	if (version != CompactTrackWriter::VERSION || ncols <= 0 || ncols > 62) {
+		throw runtime_error("Unsupported compact track file: " + filename);
+	}
+	for (int i = 0; i < ncols; ++i) {
+		int role, len;
+		double step;
+		infile.read(reinterpret_cast<char*>(&role), 4);
+		infile.read(reinterpret_cast<char*>(&step), 8);
+		infile.read(reinterpret_cast<char*>(&len), 4);
+		if (!infile.good() || len < 0 || len > 1024) {
+			throw runtime_error("Corrupt header in compact track file " + filename);
+		}
+		string n(len, ' ');
+		if (len > 0) {
+			infile.read(&n[0], len);
+		}
+		names.push_back(n);
+		roles.push_back(role);
+		steps.push_back(step);
+	}
+}
+
+bool CompactTrackReader::Next(CompactTrack& t) throw(runtime_error)
+{
+	if (done) {
+		return false;
+	}
+	unsigned long long len, nbytes;
+	if (!ReadVarint(infile, len)) {
+		throw runtime_error("Compact track file ends without a trailer: " + filename);
+	}
+	if (len == 0) {
+		// the trailer
+		infile.read(reinterpret_cast<char*>(&ntracks), 8);
+		infile.read(reinterpret_cast<char*>(&npoints), 8);
+		done = true;
+		return false;
+	}
+	if (!ReadVarint(infile, nbytes) || len > (1U << 30) || nbytes > (1ULL << 34)) {
+		throw runtime_error("Corrupt track record in compact track file " + filename);
+	}
+	record.resize(nbytes);
+	infile.read(reinterpret_cast<char*>(&record[0]), nbytes);
+	if (infile.gcount() != static_cast<streamsize>(nbytes)) {
+		throw runtime_error("Compact track file ends in the middle of a track: " + filename);
+	}
+	const unsigned char* p = &record[0];
+	const unsigned char* end = p + nbytes;
+
+	int n = len;
+	t.id = lastid + GetSigned(p, end);
+	int start = laststart + GetSigned(p, end);
+	unsigned long long flags = GetVarint(p, end);
+	t.frames.resize(n);
+	t.frames[0] = start;
+	for (int i = 1; i < n; ++i) {
+		t.frames[i] = (flags & 1) ? t.frames[i - 1] + GetSigned(p, end) : start + i;
+	}
+	if (static_cast<size_t>(end - p) < static_cast<size_t>(n + 7) / 8) {
+		throw runtime_error("Corrupt track record in compact track file " + filename);
+	}
+	t.fake.resize(n);
+	for (int i = 0; i < n; ++i) {
+		t.fake[i] = (p[i / 8] >> (i % 8)) & 1;
+	}
+	p += (n + 7) / 8;
+
+	t.values.resize(names.size());
+	for (unsigned int c = 0; c < names.size(); ++c) {
+		if (roles[c] != CT_VALUE) {
+			t.values[c].clear();
+			continue;
+		}
+		t.values[c].resize(n);
+		if (steps[c] == 0 || (flags & (2ULL << c))) {
+			// n may be up to 2^30, so count the bytes in size_t
+			if (static_cast<size_t>(end - p) / 8 < static_cast<size_t>(n)) {
+				throw runtime_error("Corrupt track record in compact track file " + filename);
+			}
+			size_t bytes = 8 * static_cast<size_t>(n);
+			memcpy(&t.values[c][0], p, bytes);
+			p += bytes;
+			continue;
+		}
+		long long q = 0;
+		for (int i = 0; i < n; ++i) {
+			q += GetSigned(p, end);
+			t.values[c][i] = q * steps[c];
+		}
+	}
+
+	lastid = t.id;
+	laststart = start;
+	return true;
+}
+
+void CompactTrackReader::Row(const CompactTrack& t, int i, double* row) const
+{
+	for (unsigned int c = 0; c < names.size(); ++c) {
+		switch (roles[c]) {
+			case CT_INDEX:
+				row[c] = t.id;
+				break;
+			case CT_TIME:
+				row[c] = static_cast<double>(t.frames[i]) / fps;
+				break;
+			case CT_FAKE:
+				row[c] = t.fake[i];
+				break;
+			default:
+				row[c] = t.values[c][i];
+				break;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ *  DetectionStore.cpp
+ *
+ *  Implementation of the per-camera store of found particles.
+ *
+ */
+
+#include <deque>
+
+#include <DetectionStore.h>
+#include <Position.h>
+
+using namespace std;
+
+void Detections::Clear()
+{
+	x.clear();
+	y.clear();
+	peak.clear();
+	area.clear();
+}
+
+void Detections::Swap(Detections& d)
+{
+	x.swap(d.x);
+	y.swap(d.y);
+	peak.swap(d.peak);
+	area.swap(d.area);
+}
+
+DetectionStore::DetectionStore()
+: start(1, 0)
+{}
+
+void DetectionStore::Append(const Detections& d, const vector<double>* o)
+{
+	x.insert(x.end(), d.x.begin(), d.x.end());
+	y.insert(y.end(), d.y.begin(), d.y.end());
+	peak.insert(peak.end(), d.peak.begin(), d.peak.end());
+	area.insert(area.end(), d.area.begin(), d.area.end());
+	if (o != NULL) {
+		ori.insert(ori.end(), o->begin(), o->end());
+	}
+	// found particles have no orientation
+	ori.resize(x.size(), 0);
+	start.push_back(x.size());
+}
+
+void DetectionStore::AppendEmpty()
+{
+	start.push_back(x.size());
+}
+
+Frame DetectionStore::CreateFrame(int frame) const
+{
+	deque<Position> pos;
+	for (int i = start[frame]; i < start[frame + 1]; ++i) {
+		pos.push_back(Position(x[i], y[i], 0, ori[i]));
+	}
+	return Frame(pos);
+}
+
+void DetectionStore::Get(int frame, Detections& out) const
+{
+	out.x.assign(x.begin() + start[frame], x.begin() + start[frame + 1]);
+	out.y.assign(y.begin() + start[frame], y.begin() + start[frame + 1]);
+	out.peak.assign(peak.begin() + start[frame], peak.begin() + start[frame + 1]);
+	out.area.assign(area.begin() + start[frame], area.begin() + start[frame + 1]);
+}
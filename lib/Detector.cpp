@@ -0,0 +1,488 @@
+/*
+ *  Detector.cpp
+ *
+ *  Implementation of the particle finder of a camera stream: the local
+ *  maxima kernels, the bands and batches they are run over, and the cluster
+ *  squash.
+ *
+ */
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+
+#include <Detector.h>
+#include <PeakScan.h>
+#include <PixelTraits.h>
+#include <BlobFinder.h>
+#include <SubPixel.h>
+
+using namespace std;
+
+// the size of the particle with its maximum at row i and column j: the
+// number of pixels of the 5x5 block around it (cut short at the edges of the
+// image) at or above half the maximum, from 1 for a single bright pixel to
+// 25.  Unlike a count of pixels above threshold, it does not change with the
+// gain of the camera.
+template <class T>
+static inline int HalfMaximumArea(const Image<T>& pixels, int i, int j)
+{
+	int top = max(i - 2, 0);
+	int bottom = min(i + 2, pixels.Rows() - 1);
+	int left = max(j - 2, 0);
+	int right = min(j + 2, pixels.Cols() - 1);
+	// twice a pixel against the maximum, so as not to round half of it
+	int peak = pixels.Row(i)[j];
+	int area = 0;
+	for (int r = top; r <= bottom; ++r) {
+		const T* row = pixels.Row(r);
+		for (int c = left; c <= right; ++c) {
+			area += (2 * row[c] >= peak);
+		}
+	}
+	return area;
+}
+
+// find the particles centred in rows first to end - 1 and columns firstcol
+// to endcol - 1, appending them to out.  E places each one (see
+// SubPixel.h).
+template <class T, class E>
+static void FindInRows(const Image<T>& pixels, int threshold, int first, int end, int firstcol, int endcol,
+                       vector<PeakCandidate>& candidates, Detections& out)
+{
+	// the local maxima above threshold, away from the first and last row and
+	// column, found a whole row at a time
+	FindPeakCandidates(pixels, threshold, candidates, first, end, firstcol, endcol);
+
+	for (unsigned int k = 0; k < candidates.size(); ++k) {
+		int i = candidates[k].row;
+		int j = candidates[k].col;
+		double xc;
+		double yc;
+		if (E::Fit(pixels, i, j, xc, yc)) {
+			out.Add(xc, yc, pixels.Row(i)[j], HalfMaximumArea(pixels, i, j));
+		}
+	}
+}
+
+// the particle finding kernels for one pixel type
+template <class T>
+struct RowFinder {
+	typedef void (*Kernel)(const Image<T>&, int, int, int, int, int, vector<PeakCandidate>&, Detections&);
+};
+
+// the kernels for one pixel type and source of logarithms, one per
+// estimator, in the order of ParticleFinder::Estimator
+template <class T, class L>
+struct KernelTable {
+	static const typename RowFinder<T>::Kernel kernels[ParticleFinder::NESTIMATORS];
+};
+
+template <class T, class L>
+const typename RowFinder<T>::Kernel KernelTable<T, L>::kernels[ParticleFinder::NESTIMATORS] = {
+	FindInRows< T, Gaussian3<T, L> >,
+	FindInRows< T, Centroid<T> >,
+	FindInRows< T, Gaussian5x5<T, L> >
+};
+
+// the kernel for a pixel type, camera depth and estimator: logarithms from a
+// table when the camera uses the whole range of the type, computed otherwise
+static RowFinder<unsigned char>::Kernel Kernel(const Image8&, int depth, ParticleFinder::Estimator estimator)
+{
+	if (depth == PixelTraits<unsigned char>::MAXVALUE) {
+		Log8::Prepare();
+		return KernelTable<unsigned char, Log8>::kernels[estimator];
+	}
+	return KernelTable< unsigned char, LogAny<unsigned char> >::kernels[estimator];
+}
+
+static RowFinder<unsigned short>::Kernel Kernel(const Image16&, int depth, ParticleFinder::Estimator estimator)
+{
+	if (depth == PixelTraits<unsigned short>::MAXVALUE) {
+		Log16::Prepare();
+		return KernelTable<unsigned short, Log16>::kernels[estimator];
+	}
+	return KernelTable< unsigned short, LogAny<unsigned short> >::kernels[estimator];
+}
+
+// the particles of a frame, sorted into square cells of a uniform grid so
+// that the ones near a point can be found without looking at all of them.
+// The cells are kept from one frame to the next.
+class ParticleGrid {
+public:
+	void Build(const vector<double>& ix, const vector<double>& iy, double size);
+
+	// the particles after the one numbered after that are within rad of
+	// (cx, cy), in order
+	void Near(double cx, double cy, double rad, int after, vector<int>& out) const;
+
+private:
+	const vector<double>* x;
+	const vector<double>* y;
+	double size;
+	// (cell, particle), sorted
+	vector< pair<long long, int> > cells;
+
+	long long Cell(int cx, int cy) const;
+};
+
+void ParticleGrid::Build(const vector<double>& ix, const vector<double>& iy, double s)
+{
+	x = &ix;
+	y = &iy;
+	size = s;
+	cells.clear();
+	for (unsigned int i = 0; i < ix.size(); ++i) {
+		cells.push_back(make_pair(Cell(static_cast<int>(floor(ix[i] / size)), static_cast<int>(floor(iy[i] / size))), i));
+	}
+	sort(cells.begin(), cells.end());
+}
+
+inline long long ParticleGrid::Cell(int cx, int cy) const
+{
+	return static_cast<long long>(cy) * 4294967296LL + static_cast<unsigned int>(cx);
+}
+
+void ParticleGrid::Near(double cx, double cy, double rad, int after, vector<int>& out) const
+{
+	out.clear();
+	// the cells within reach, with a little to spare for rounding
+	double reach = rad * 1.000001;
+	int c0 = static_cast<int>(floor((cx - reach) / size));
+	int c1 = static_cast<int>(floor((cx + reach) / size));
+	int r0 = static_cast<int>(floor((cy - reach) / size));
+	int r1 = static_cast<int>(floor((cy + reach) / size));
+	for (int r = r0; r <= r1; ++r) {
+		for (int c = c0; c <= c1; ++c) {
+			// the particles after "after" in this cell
+			vector< pair<long long, int> >::const_iterator p =
+				upper_bound(cells.begin(), cells.end(), make_pair(Cell(c, r), after));
+			for (; p != cells.end() && p->first == Cell(c, r); ++p) {
+				int i = p->second;
+				if (pow(cx - (*x)[i], 2) + pow(cy - (*y)[i], 2) <= rad * rad) {
+					out.push_back(i);
+				}
+			}
+		}
+	}
+	// the sums over a cluster go in the particles' order
+	sort(out.begin(), out.end());
+}
+
+struct Detector::Workspace {
+	// the peak candidates of a band, and its particles
+	vector<PeakCandidate> candidates;
+	Detections band;
+	vector<Blob> blobs;
+	// the squash
+	ParticleGrid grid;
+	vector<char> bad;
+	vector<int> near;
+	Detections squashed;
+};
+
+Detector::Detector(int d, int n, ParticleFinder::Engine e, ParticleFinder::Estimator est,
+                   const RegionOfInterest* r, double s)
+: depth(d), nthreads(max(n, 1)), engine(e), estimator(est), roi(r), squash(s), workspaces(nthreads)
+{
+	for (int k = 0; k < nthreads; ++k) {
+		workspaces[k] = new Workspace;
+	}
+}
+
+Detector::~Detector()
+{
+	for (unsigned int k = 0; k < workspaces.size(); ++k) {
+		delete workspaces[k];
+	}
+}
+
+// the window of an image to look at: the pixels outside the region of
+// interest were dropped when the frame was decoded.  False if it is empty.
+template <class T>
+static bool Window(const Image<T>& pixels, const RegionOfInterest* roi,
+                   int& firstrow, int& endrow, int& firstcol, int& endcol)
+{
+	firstrow = 0;
+	endrow = pixels.Rows();
+	firstcol = 0;
+	endcol = pixels.Cols();
+	if (roi != NULL && !roi->Whole()) {
+		firstrow = roi->FirstRow();
+		endrow = min(roi->EndRow(), endrow);
+		firstcol = roi->FirstCol();
+		endcol = min(roi->EndCol(), endcol);
+	}
+	return firstrow < endrow && firstcol < endcol;
+}
+
+// one horizontal band of an image, for one thread.  The fit at a pixel reads
+// the rows above and below it, so a band reads one row past each of its ends.
+template <class T>
+struct Band {
+	typename RowFinder<T>::Kernel find;
+	const Image<T>* pixels;
+	int threshold;
+	int first;
+	int end;
+	int firstcol;
+	int endcol;
+	Detector::Workspace* w;
+};
+
+template <class T>
+static void* FindInBand(void* arg)
+{
+	Band<T>* b = static_cast<Band<T>*>(arg);
+	b->w->band.Clear();
+	b->find(*b->pixels, b->threshold, b->first, b->end, b->firstcol, b->endcol, b->w->candidates, b->w->band);
+	return NULL;
+}
+
+template <class T>
+void Detector::FindWith(Workspace& w, const Image<T>& pixels, int threshold, int nbands, Detections& out)
+{
+	out.Clear();
+	int firstrow;
+	int endrow;
+	int firstcol;
+	int endcol;
+	if (!Window(pixels, roi, firstrow, endrow, firstcol, endcol)) {
+		return;
+	}
+
+	if (engine == ParticleFinder::BLOBS) {
+		FindBlobs(pixels, threshold, nbands, w.blobs, firstrow, endrow, firstcol, endcol);
+		for (unsigned int i = 0; i < w.blobs.size(); ++i) {
+			out.Add(w.blobs[i].x, w.blobs[i].y, w.blobs[i].peak, w.blobs[i].area);
+		}
+		return;
+	}
+
+	// the fit needs a neighbour on every side
+	int first = max(firstrow, 1);
+	int end = min(endrow, pixels.Rows() - 1);
+	firstcol = max(firstcol, 1);
+	endcol = min(endcol, pixels.Cols() - 1);
+	int rows = end - first;
+	typename RowFinder<T>::Kernel find = Kernel(pixels, depth, estimator);
+	// don't bother with bands of only a few rows
+	nbands = min(nbands, rows / ParticleFinder::MINBANDROWS);
+	if (nbands <= 1) {
+		find(pixels, threshold, first, end, firstcol, endcol, w.candidates, out);
+	} else {
+		// band k uses the memory of thread k, the first being this one's
+		vector< Band<T> > bands(nbands);
+		for (int k = 0; k < nbands; ++k) {
+			bands[k].find = find;
+			bands[k].pixels = &pixels;
+			bands[k].threshold = threshold;
+			bands[k].first = first + rows * k / nbands;
+			bands[k].end = first + rows * (k + 1) / nbands;
+			bands[k].firstcol = firstcol;
+			bands[k].endcol = endcol;
+			bands[k].w = (k == 0) ? &w : workspaces[k];
+		}
+		vector<pthread_t> threads(nbands);
+		vector<bool> started(nbands, false);
+		for (int k = 1; k < nbands; ++k) {
+			started[k] = (pthread_create(&threads[k], NULL, FindInBand<T>, &bands[k]) == 0);
+			if (!started[k]) {
+				FindInBand<T>(&bands[k]);
+			}
+		}
+		FindInBand<T>(&bands[0]);
+		for (int k = 1; k < nbands; ++k) {
+			if (started[k]) {
+				pthread_join(threads[k], NULL);
+			}
+		}
+
+		// put the bands together from the top down, as a single pass would have found them
+		for (int k = 0; k < nbands; ++k) {
+			const Detections& b = bands[k].w->band;
+			out.x.insert(out.x.end(), b.x.begin(), b.x.end());
+			out.y.insert(out.y.end(), b.y.begin(), b.y.end());
+			out.peak.insert(out.peak.end(), b.peak.begin(), b.peak.end());
+			out.area.insert(out.area.end(), b.area.begin(), b.area.end());
+		}
+	}
+	SquashWith(w, out, squash);
+}
+
+template <class T>
+void Detector::Find(const Image<T>& pixels, int threshold, Detections& out)
+{
+	FindWith(*workspaces[0], pixels, threshold, nthreads, out);
+}
+
+// the frames of a batch that one thread finds the particles of: every
+// stride-th one, from the first
+template <class T>
+struct Share {
+	Detector* detector;
+	Detector::Workspace* w;
+	const Image<T>* const* frames;
+	const int* thresholds;
+	Detections* found;
+	int first;
+	int n;
+	int stride;
+};
+
+template <class T>
+void* Detector::FindShare(void* arg)
+{
+	Share<T>* s = static_cast<Share<T>*>(arg);
+	for (int i = s->first; i < s->n; i += s->stride) {
+		if (s->frames[i] != NULL) {
+			s->detector->FindWith(*s->w, *s->frames[i], s->thresholds[i], 1, s->found[i]);
+		}
+	}
+	return NULL;
+}
+
+template <class T>
+void Detector::Detect(const Image<T>* const* frames, const int* thresholds, int n, DetectionStore& store)
+{
+	if (static_cast<int>(found.size()) < n) {
+		found.resize(n);
+	}
+	int nshares = min(nthreads, n);
+	if (nshares <= 1) {
+		for (int i = 0; i < n; ++i) {
+			if (frames[i] != NULL) {
+				Find(*frames[i], thresholds[i], found[i]);
+			}
+		}
+	} else {
+		vector< Share<T> > shares(nshares);
+		for (int k = 0; k < nshares; ++k) {
+			shares[k].detector = this;
+			shares[k].w = workspaces[k];
+			shares[k].frames = frames;
+			shares[k].thresholds = thresholds;
+			shares[k].found = &found[0];
+			shares[k].first = k;
+			shares[k].n = n;
+			shares[k].stride = nshares;
+		}
+		// the first share is done on this thread
+		vector<pthread_t> threads(nshares);
+		vector<bool> started(nshares, false);
+		for (int k = 1; k < nshares; ++k) {
+			started[k] = (pthread_create(&threads[k], NULL, FindShare<T>, &shares[k]) == 0);
+			if (!started[k]) {
+				FindShare<T>(&shares[k]);
+			}
+		}
+		FindShare<T>(&shares[0]);
+		for (int k = 1; k < nshares; ++k) {
+			if (started[k]) {
+				pthread_join(threads[k], NULL);
+			}
+		}
+	}
+
+	for (int i = 0; i < n; ++i) {
+		if (frames[i] != NULL) {
+			store.Append(found[i]);
+		} else {
+			store.AppendEmpty();
+		}
+	}
+}
+
+void Detector::Squash(Detections& d, double rad)
+{
+	SquashWith(*workspaces[0], d, rad);
+}
+
+void Detector::SquashWith(Workspace& w, Detections& d, double rad)
+{
+	if (rad < 1) {
+		// don't do anything for small cluster radii, for efficiency
+		return;
+	}
+
+	const vector<double>& px = d.x;
+	const vector<double>& py = d.y;
+	int n = px.size();
+	w.grid.Build(px, py, rad);
+	w.bad.assign(n, 0);
+	Detections& squashed = w.squashed;
+	squashed.Clear();
+	vector<int>& near = w.near;
+
+	for (int i = 0; i < n; ++i) {
+		// have we looked at this entry before?
+		if (w.bad[i]) {
+			// yes: skip it.
+			continue;
+		}
+
+		// look at later positions, for neighbors
+		w.grid.Near(px[i], py[i], rad, i, near);
+		// did we find a cluster?
+		if (near.empty()) {
+			// nope.
+			continue;
+		}
+		double avgx = px[i];
+		double avgy = py[i];
+		for (unsigned int k = 0; k < near.size(); ++k) {
+			avgx += px[near[k]];
+			avgy += py[near[k]];
+		}
+		int N = near.size() + 1;
+
+		w.bad[i] = 1;
+		int oldN = N;
+
+		// now look again, for everything near *this average* location, and
+		// re-compute the average. continue until we converge.
+		while (true) {
+			double ax = avgx / static_cast<double>(N);
+			double ay = avgy / static_cast<double>(N);
+			w.grid.Near(ax, ay, rad, i, near);
+			avgx = px[i];
+			avgy = py[i];
+			for (unsigned int k = 0; k < near.size(); ++k) {
+				avgx += px[near[k]];
+				avgy += py[near[k]];
+			}
+			N = near.size() + 1;
+			if (oldN == N) {
+				// we converged! the cluster is as bright as its brightest
+				// member, and as big as all of them
+				int cpeak = d.peak[i];
+				int carea = d.area[i];
+				for (unsigned int k = 0; k < near.size(); ++k) {
+					w.bad[near[k]] = 1;
+					cpeak = max(cpeak, d.peak[near[k]]);
+					carea += d.area[near[k]];
+				}
+				squashed.Add(avgx / static_cast<double>(N), avgy / static_cast<double>(N), cpeak, carea);
+				break;
+			} else {
+				// try again
+				oldN = N;
+			}
+		}
+	}
+
+	// finally, find the good positions left in the original list
+	for (int i = 0; i < n; ++i) {
+		if (!w.bad[i]) {
+			squashed.Add(px[i], py[i], d.peak[i], d.area[i]);
+		}
+	}
+	d.Swap(squashed);
+}
+
+// the pixel types we have decoders for
+template void Detector::Find(const Image<unsigned char>&, int, Detections&);
+template void Detector::Find(const Image<unsigned short>&, int, Detections&);
+template void Detector::Detect(const Image<unsigned char>* const*, const int*, int, DetectionStore&);
+template void Detector::Detect(const Image<unsigned short>* const*, const int*, int, DetectionStore&);
@@ -18,16 +18,16 @@
 #include <vector>
 
 #include <GDF.h>
+#include <GDFWriter.h>
 #include <Position.h>
 #include <WesleyanCPV.h>
 
 using namespace std;
 
-GDF::GDF(std::string filename) throw(out_of_range)
-: outname(filename)
+GDF::GDF(std::string filename, IOBackend* io) throw(out_of_range)
+: outname(filename), infile(filename, io), block(NULL), nparticles(0)
 {
 // Read Header:
-    infile.open(outname.c_str(), ios::in | ios::binary);
 	if (infile.is_open()){
 		infile.read(reinterpret_cast<char*>(&magic), 4);
 		// number of dimensions
@@ -36,111 +36,153 @@ GDF::GDF(std::string filename) throw(out_of_range)
 		infile.read(reinterpret_cast<char*>(&cols), 4);
 		// number of rows
 		infile.read(reinterpret_cast<char*>(&rows), 4);
-		// 4 means floating point numbers (see Matlab read_gdf function for more info)
-		infile.read(reinterpret_cast<char*>(&tmpi), 4);
+		// 4 means floating point numbers, 5 double precision (see Matlab read_gdf function for more info)
+		// 0 means the columns have mixed types, listed after the header
+		infile.read(reinterpret_cast<char*>(&type), 4);
 		// number of total points
 		infile.read(reinterpret_cast<char*>(&tmpi), 4);
+		if (cols <= FRAMENUM) {
+			throw out_of_range("Too few columns in GDF file!");
+		}
+		types.assign(cols, type);
+		if (type == GDFWriter::MIXED) {
+			infile.read(reinterpret_cast<char*>(&types[0]), 4 * cols);
+		}
+		rowbytes = 0;
+		for (int i = 0; i < cols; ++i) {
+			if (types[i] != GDFWriter::FLOAT && types[i] != GDFWriter::DOUBLE) {
+				throw out_of_range("Unsupported GDF data type!");
+			}
+			offsets.push_back(rowbytes);
+			rowbytes += (types[i] == GDFWriter::FLOAT) ? 4 : 8;
+		}
+		dataoffset = infile.tellg();
+
+		// find where each frame starts, from the sidecar if it is still current
+		std::string idxname = GDFIndex::SidecarName(filename);
+		if (!index.Load(idxname, infile.Size(), infile.ModTime(), rowbytes)) {
+			index.Build(infile, Segments(), rowbytes, offsets[FRAMENUM], types[FRAMENUM]);
+			if (!index.Save(idxname, infile.Size(), infile.ModTime(), rowbytes)) {
+				cout << "\tCould not write frame index " << idxname << endl;
+			}
+		}
 	}
-    waiting_to_be_written = 0;
 }
 
-int GDF::seekGDF(int start) {
-    while(!waiting_to_be_written) {
-        filePos[first] = infile.tellg();
-        infile.seekg(40, ios::cur);
-        infile.read(reinterpret_cast<char*>(&fi), 8);
-        currentFrameNum = fi;
-        while(currentFrameNum == fi && !infile.eof()){
-            filePos[tmp] = infile.tellg();
-            infile.seekg(40, ios::cur);
-            infile.read(reinterpret_cast<char*>(&fi), 8);
-            if (infile.eof()) {
-                std::cout << "\tEnd of file reached during seeking" << endl;
-                exit(0);
-            }
-            nextFrameNum = fi;
+vector<GDFIndex::Segment> GDF::Segments() {
+    vector<GDFIndex::Segment> segments;
+    GDFIndex::Segment s;
+    if (rows >= 0) {
+        // one run of rows; trust the file size over the header, which may not
+        // have been fixed up
+        s.start = dataoffset;
+        s.rows = (infile.Size() - dataoffset) / rowbytes;
+        segments.push_back(s);
+        return segments;
+    }
+    // a streamed file: follow the chunks up to the end-of-data chunk, or as
+    // far as the file goes if the writer did not finish
+    off_t pos = dataoffset;
+    while (pos + 4 <= infile.Size()) {
+        int n;
+        infile.seekg(pos, ios::beg);
+        infile.read(reinterpret_cast<char*>(&n), 4);
+        if (n <= 0) {
+            break;
+        }
+        s.start = pos + 4;
+        s.rows = n;
+        if (s.start + s.rows * rowbytes > infile.Size()) {
+            s.rows = (infile.Size() - s.start) / rowbytes;
         }
-        if (prevFrameNum == currentFrameNum-1 || nextFrameNum == currentFrameNum+1) {
-            if (currentFrameNum >= start) {
-                cout << "\tFirst good frame number: " << currentFrameNum << endl;
-                startFrameNum = currentFrameNum;
-                infile.seekg(filePos[first], ios::beg);
-                waiting_to_be_written = 1;
-            }
-            prevFrameNum = currentFrameNum;
+        segments.push_back(s);
+        pos = s.start + static_cast<off_t>(n) * rowbytes;
+    }
+    return segments;
+}
+
+int GDF::seekGDF(int start) {
+    // the first frame at or after start that has a neighbouring frame in the file
+    for (int i = index.LowerBound(start); i < index.NumEntries(); ++i) {
+        currentFrameNum = index[i].frame;
+        // the entries after the last one for this frame
+        int j = i + 1;
+        while (j < index.NumEntries() && index[j].frame == currentFrameNum) {
+            ++j;
         }
-        else {
-            infile.seekg(filePos[tmp], ios::beg);
+        bool prev = (i > 0 && index[i - 1].frame == currentFrameNum - 1);
+        bool next = (j < index.NumEntries() && index[j].frame == currentFrameNum + 1);
+        i = j - 1;
+        if (prev || next) {
+            cout << "\tFirst good frame number: " << currentFrameNum << endl;
+            return(currentFrameNum);
         }
     }
-    waiting_to_be_written = 0;
-    return(startFrameNum);
+    std::cout << "\tEnd of file reached during seeking" << endl;
+    exit(0);
 }
 
 int GDF::readGDF2D(int frame) {
-	deque<double> newx;
-	deque<double> newy;
-	deque<double> newori;
-
-    filePos[current] = infile.tellg();
-    infile.seekg(32, ios::cur);
-    infile.read(reinterpret_cast<char*>(&fi), 8);
-    int particlecount = fi;
-    infile.read(reinterpret_cast<char*>(&fi), 8);
-    currentFrameNum = fi;
-    infile.seekg(filePos[current], ios::beg);
-    cout << "\tCurrent Frame Number: " << currentFrameNum << endl;
-    cout << "\t" << particlecount << " particle(s) found" << endl;
-    
-
-    if (currentFrameNum==frame) {
-        for(int i = 0; i < particlecount; i++){
-                    infile.read(reinterpret_cast<char*>(&xi), 8);
-                    newx.push_back(xi);
-                    infile.read(reinterpret_cast<char*>(&yi), 8);
-                    newy.push_back(yi);
-                    infile.seekg(8, ios::cur); //skip brightness bytes
-                    infile.read(reinterpret_cast<char*>(&orii), 8);
-                    newori.push_back(orii);
-                    infile.seekg(8, ios::cur); //skip number of particles bytes
-                    infile.read(reinterpret_cast<char*>(&fi), 8);
-                    currentFrameNum = fi;
-                    if (currentFrameNum!=frame) {
-                        cout << "\tIncorrect particlecount at frame" << currentFrameNum << endl;
-                        break;
-                    }
-                    x = newx;
-                    y = newy;
-                    ori = newori;	
-                }
-        missedFrame = 0;
-    }
-    else {
+    nparticles = 0;
+    int i = index.LowerBound(frame);
+    if (i >= index.NumEntries() || index[i].frame != frame) {
+        if (i < index.NumEntries()) {
+            cout << "\tCurrent Frame Number: " << index[i].frame << endl;
+            cout << "\t" << index[i].count << " particle(s) found" << endl;
+        }
         missedFrame = 1;
+        return(missedFrame);
     }
-    return(missedFrame);
-}
-
-void GDF::fixHeader(int nr, int cols){
-	
-	// now fix up the header with the proper sizes
-	outfile.seekp(8, ios::beg);
-	outfile.write(reinterpret_cast<const char*>(&cols), 4);
-	outfile.write(reinterpret_cast<const char*>(&nr), 4);
-	outfile.seekp(4, ios::cur);
-	int tmpi = cols * nr;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+    // the frame may be split over chunks of a streamed file
+    int j = i + 1;
+    int count = index[i].count;
+    while (j < index.NumEntries() && index[j].frame == frame) {
+        count += index[j].count;
+        ++j;
+    }
+    cout << "\tCurrent Frame Number: " << frame << endl;
+    cout << "\t" << count << " particle(s) found" << endl;
 
+    if (j == i + 1) {
+        // take the whole block of rows for this frame in one go
+        infile.seekg(index[i].offset, ios::beg);
+        block = infile.Fetch(static_cast<streamsize>(count) * rowbytes);
+        nparticles = infile.gcount() / rowbytes;
+    } else {
+        // gather the pieces
+        gathered.resize(static_cast<size_t>(count) * rowbytes);
+        for (int k = i; k < j; ++k) {
+            infile.seekg(index[k].offset, ios::beg);
+            infile.read(&gathered[static_cast<size_t>(nparticles) * rowbytes], static_cast<streamsize>(index[k].count) * rowbytes);
+            nparticles += infile.gcount() / rowbytes;
+        }
+        block = &gathered[0];
+    }
+    missedFrame = 0;
+    return(missedFrame);
 }
 
 Frame GDF::CreateFrame() {
   deque<Position> pos;
-  deque<double>::const_iterator xi_end = x.end();
-  deque<double>::const_iterator yi = y.begin();
-  deque<double>::const_iterator orii = ori.begin();
-  for (deque<double>::const_iterator xi = x.begin(); xi != xi_end; ++xi, ++yi, ++orii) {
-  	//cout << "Create Frame: " << *xi << " " << *yi <<" "<< 0 <<" "<< *orii << endl;
-    pos.push_back(Position(*xi, *yi, 0, *orii));
+  GDFColumn xc = Column(X);
+  GDFColumn yc = Column(Y);
+  GDFColumn oric = Column(ORI);
+  for (int i = 0; i < nparticles; ++i) {
+  	//cout << "Create Frame: " << xc[i] << " " << yc[i] <<" "<< 0 <<" "<< oric[i] << endl;
+    pos.push_back(Position(xc[i], yc[i], 0, oric[i]));
   }
 	return Frame(pos);
 }
+
+void GDF::CreateDetections(Detections& out, vector<double>& ori) {
+  out.Clear();
+  ori.clear();
+  GDFColumn xc = Column(X);
+  GDFColumn yc = Column(Y);
+  GDFColumn bc = Column(BRIGHTNESS);
+  GDFColumn oric = Column(ORI);
+  for (int i = 0; i < nparticles; ++i) {
+    out.Add(xc[i], yc[i], static_cast<int>(floor(bc[i] + 0.5)), 0);
+    ori.push_back(oric[i]);
+  }
+}
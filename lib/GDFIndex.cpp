@@ -0,0 +1,162 @@
+/*
+ *  GDFIndex.cpp
+ *
+ *  Implementation of the frame index for GDF files.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#include <GDFIndex.h>
+
+using namespace std;
+
+// sidecar layout: magic, version, file size, modification time, row size,
+// number of entries, entries
+static const int IDXMAGIC = 82992;
+static const int IDXVERSION = 3;
+
+// order entries by frame number, for the binary searches
+static bool FrameLess(const GDFIndex::Entry& e, int frame)
+{
+	return e.frame < frame;
+}
+
+static bool EntryLess(const GDFIndex::Entry& a, const GDFIndex::Entry& b)
+{
+	return a.frame < b.frame;
+}
+
+static bool SameFrame(const GDFIndex::Entry& a, const GDFIndex::Entry& b)
+{
+	return a.frame == b.frame;
+}
+
+void GDFIndex::Build(BlockReader& in, const vector<Segment>& segments, int rowbytes, int offset, int type)
+{
+	entries.clear();
+	// walk through the file in runs of rows that fill a read-ahead block
+	long long chunk = BlockReader::DEFAULT_BLOCKSIZE / rowbytes;
+	if (chunk < 1) {
+		chunk = 1;
+	}
+	bool sorted = true;
+	for (unsigned int s = 0; s < segments.size(); ++s) {
+		// a new segment always starts a new entry
+		bool fresh = true;
+		in.seekg(segments[s].start, ios::beg);
+		for (long long row = 0; row < segments[s].rows; row += chunk) {
+			long long n = (segments[s].rows - row < chunk) ? segments[s].rows - row : chunk;
+			const char* p = in.Fetch(n * rowbytes);
+			n = in.gcount() / rowbytes;
+			for (long long i = 0; i < n; ++i, p += rowbytes) {
+				int frame;
+				if (type == 4) {
+					float f;
+					memcpy(&f, p + offset, 4);
+					frame = static_cast<int>(f);
+				} else {
+					double d;
+					memcpy(&d, p + offset, 8);
+					frame = static_cast<int>(d);
+				}
+				if (!fresh && entries.back().frame == frame) {
+					++entries.back().count;
+					continue;
+				}
+				if (!entries.empty() && entries.back().frame > frame) {
+					sorted = false;
+				}
+				Entry e;
+				e.frame = frame;
+				e.offset = segments[s].start + (row + i) * rowbytes;
+				e.count = 1;
+				entries.push_back(e);
+				fresh = false;
+			}
+			if (in.eof()) {
+				break;
+			}
+		}
+	}
+	if (!sorted) {
+		// keep the first block of rows of each frame
+		cerr << "\tGDF rows are not sorted by frame; using the first block of each frame" << endl;
+		stable_sort(entries.begin(), entries.end(), EntryLess);
+		entries.erase(unique(entries.begin(), entries.end(), SameFrame), entries.end());
+	}
+}
+
+bool GDFIndex::Load(const string& name, off_t filesize, long long mtime, int rowbytes)
+{
+	ifstream infile(name.c_str(), ios::in | ios::binary);
+	if (!infile.is_open()) {
+		return false;
+	}
+	int magic, version, rb, n;
+	long long size, time;
+	infile.read(reinterpret_cast<char*>(&magic), 4);
+	infile.read(reinterpret_cast<char*>(&version), 4);
+	infile.read(reinterpret_cast<char*>(&size), 8);
+	infile.read(reinterpret_cast<char*>(&time), 8);
+	infile.read(reinterpret_cast<char*>(&rb), 4);
+	infile.read(reinterpret_cast<char*>(&n), 4);
+	if (!infile.good() || magic != IDXMAGIC || version != IDXVERSION || size != filesize || time != mtime
+	    || rb != rowbytes || rowbytes <= 0 || n < 0 || n > filesize / rowbytes) {
+		// not ours, or the data file has changed since (every frame listed has
+		// a row in the file)
+		return false;
+	}
+	vector<Entry> loaded(n);
+	for (int i = 0; i < n; ++i) {
+		infile.read(reinterpret_cast<char*>(&loaded[i].frame), 4);
+		infile.read(reinterpret_cast<char*>(&loaded[i].offset), 8);
+		infile.read(reinterpret_cast<char*>(&loaded[i].count), 4);
+	}
+	if (!infile.good()) {
+		return false;
+	}
+	entries.swap(loaded);
+	return true;
+}
+
+bool GDFIndex::Save(const string& name, off_t filesize, long long mtime, int rowbytes) const
+{
+	ofstream outfile(name.c_str(), ios::out | ios::binary);
+	if (!outfile.is_open()) {
+		return false;
+	}
+	int tmpi = IDXMAGIC;
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	tmpi = IDXVERSION;
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	long long size = filesize;
+	outfile.write(reinterpret_cast<const char*>(&size), 8);
+	outfile.write(reinterpret_cast<const char*>(&mtime), 8);
+	outfile.write(reinterpret_cast<const char*>(&rowbytes), 4);
+	tmpi = entries.size();
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	for (unsigned int i = 0; i < entries.size(); ++i) {
+		outfile.write(reinterpret_cast<const char*>(&entries[i].frame), 4);
+		outfile.write(reinterpret_cast<const char*>(&entries[i].offset), 8);
+		outfile.write(reinterpret_cast<const char*>(&entries[i].count), 4);
+	}
+	return outfile.good();
+}
+
+int GDFIndex::LowerBound(int frame) const
+{
+	return lower_bound(entries.begin(), entries.end(), frame, FrameLess) - entries.begin();
+}
+
+const GDFIndex::Entry* GDFIndex::Find(int frame) const
+{
+	int i = LowerBound(frame);
+	if (i < static_cast<int>(entries.size()) && entries[i].frame == frame) {
+		return &entries[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,299 @@
+/*
+ *  GDFWriter.cpp
+ *
+ *  Implementation of the buffered GDF writer.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <GDFWriter.h>
+
+using namespace std;
+
+GDFWriter::GDFWriter()
+: fd(-1), filetype(DOUBLE), rowbytes(0), nrows(0), used(0), start(0), streaming(false)
+{}
+
+GDFWriter::GDFWriter(const string& name, const vector<string>& columns, const string& precision, int framing,
+                     size_t buffersize) throw(runtime_error, invalid_argument)
+: fd(-1), filetype(DOUBLE), rowbytes(0), nrows(0), used(0), start(0), streaming(false)
+{
+	Open(name, columns, precision, framing, buffersize);
+}
+
+GDFWriter::~GDFWriter()
+{
+	try {
+		Close();
+	} catch (runtime_error&) {
+		// nothing sensible to do about it here
+	}
+}
+
+void GDFWriter::Open(const string& name, const vector<string>& columns, const string& precision, int framing,
+                     size_t buffersize) throw(runtime_error, invalid_argument)
+{
+	Close();
+	if (columns.empty()) {
+		throw runtime_error("A GDF file needs at least one column");
+	}
+	filename = name;
+	names = columns;
+	nrows = 0;
+	row.assign(names.size(), 0);
+	SetTypes(precision);
+
+	if (filename == "-") {
+		// our own descriptor for stdout, so that Close() can close it
+		fd = dup(STDOUT_FILENO);
+	} else {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (fd < 0) {
+		throw runtime_error("Could not open GDF output file " + filename + ": " + strerror(errno));
+	}
+	if (framing == AUTO) {
+		streaming = (filename == "-" || lseek(fd, 0, SEEK_CUR) < 0);
+	} else {
+		streaming = (framing == STREAM);
+	}
+
+	// always room for at least one row
+	start = streaming ? 4 : 0;
+	buffer.resize(start + (buffersize < rowbytes ? rowbytes : buffersize));
+	used = start;
+
+	if (streaming) {
+		// sizes unknown until the trailer
+		vector<int> header = Header(-1, -1);
+		WriteOut(reinterpret_cast<const char*>(&header[0]), header.size() * sizeof(int));
+	} else {
+		// sizes are placeholders until Close()
+		WriteHeader();
+	}
+}
+
+void GDFWriter::Close() throw(runtime_error)
+{
+	if (fd < 0) {
+		return;
+	}
+	Flush();
+	if (streaming) {
+		// end-of-data chunk, then the real sizes
+		int trailer[3];
+		trailer[0] = 0;
+		trailer[1] = nrows;
+		trailer[2] = names.size() * nrows;
+		WriteOut(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+	} else {
+		WriteHeader();
+	}
+	int result = close(fd);
+	fd = -1;
+	if (result != 0) {
+		throw runtime_error("Could not close GDF output file " + filename + ": " + strerror(errno));
+	}
+}
+
+GDFWriter::Framing GDFWriter::ParseFraming(const string& name) throw(invalid_argument)
+{
+	if (name == "auto") {
+		return AUTO;
+	} else if (name == "fixed") {
+		return FIXED;
+	} else if (name == "stream") {
+		return STREAM;
+	}
+	throw invalid_argument("Unknown GDF output framing \"" + name + "\" (use auto, fixed or stream)");
+}
+
+// parse a type name
+static int TypeCode(const string& name) throw(invalid_argument)
+{
+	if (name == "double") {
+		return GDFWriter::DOUBLE;
+	} else if (name == "float") {
+		return GDFWriter::FLOAT;
+	}
+	throw invalid_argument("Unknown GDF output precision \"" + name + "\" (use float or double)");
+}
+
+void GDFWriter::SetTypes(const string& precision) throw(invalid_argument)
+{
+	// the type for the whole file, then (for mixed files only) column=type
+	// overrides; whole numbers stay exact in mixed files
+	bool mixed = (precision.compare(0, 6, "mixed:") == 0);
+	string spec = mixed ? precision.substr(6) : precision;
+	size_t colon = spec.find(':');
+	if (!mixed && colon != string::npos) {
+		throw invalid_argument("GDF output precision \"" + precision
+		                       + "\" has per-column types; ask for a mixed file with mixed:" + precision);
+	}
+	types.assign(names.size(), TypeCode(spec.substr(0, colon)));
+	for (unsigned int i = 0; mixed && i < names.size(); ++i) {
+		if (IntegerColumn(names[i])) {
+			types[i] = DOUBLE;
+		}
+	}
+	while (colon != string::npos) {
+		size_t start = colon + 1;
+		colon = spec.find(',', start);
+		string item = spec.substr(start, colon == string::npos ? string::npos : colon - start);
+		size_t eq = item.find('=');
+		if (eq == string::npos) {
+			throw invalid_argument("GDF output precision override \"" + item + "\" should look like column=type");
+		}
+		int t = TypeCode(item.substr(eq + 1));
+		int col = Column(item.substr(0, eq));
+		if (col >= 0) {
+			types[col] = t;
+		}
+	}
+
+	filetype = types[0];
+	rowbytes = 0;
+	exact.clear();
+	for (unsigned int i = 0; i < types.size(); ++i) {
+		if (types[i] != filetype) {
+			filetype = MIXED;
+		}
+		rowbytes += (types[i] == FLOAT) ? 4 : 8;
+		if (types[i] == FLOAT && IntegerColumn(names[i])) {
+			exact.push_back(i);
+		}
+	}
+	if (filetype == MIXED) {
+		cerr << "\tNote: " << filename << " has mixed column types (GDF type code 0), "
+		     << "which read_gdf and IDL cannot read" << endl;
+	}
+}
+
+bool GDFWriter::IntegerColumn(const string& name)
+{
+	return name == "frame" || name == "index";
+}
+
+int GDFWriter::Column(const string& name) const
+{
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		if (names[i] == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void GDFWriter::AppendRow(const double* values) throw(runtime_error)
+{
+	if (used + rowbytes > buffer.size()) {
+		Flush();
+	}
+	for (unsigned int i = 0; i < exact.size(); ++i) {
+		double v = values[exact[i]];
+		if (static_cast<float>(v) != v) {
+			stringstream msg;
+			msg << "The " << names[exact[i]] << " value " << v << " cannot be written exactly to the float GDF file "
+			    << filename << " (use double, or mixed:float)";
+			throw runtime_error(msg.str());
+		}
+	}
+	char* p = &buffer[used];
+	if (filetype == DOUBLE) {
+		memcpy(p, values, rowbytes);
+	} else {
+		for (unsigned int i = 0; i < types.size(); ++i) {
+			if (types[i] == FLOAT) {
+				float f = values[i];
+				memcpy(p, &f, 4);
+				p += 4;
+			} else {
+				memcpy(p, &values[i], 8);
+				p += 8;
+			}
+		}
+	}
+	used += rowbytes;
+	++nrows;
+}
+
+void GDFWriter::EndRow() throw(runtime_error)
+{
+	AppendRow(&row[0]);
+	row.assign(names.size(), 0);
+}
+
+void GDFWriter::Flush() throw(runtime_error)
+{
+	if (fd < 0 || used == start) {
+		return;
+	}
+	if (streaming) {
+		// the chunk's row count goes in front of its rows
+		int n = (used - start) / rowbytes;
+		memcpy(&buffer[0], &n, 4);
+	}
+	WriteOut(&buffer[0], used);
+	used = start;
+}
+
+vector<int> GDFWriter::Header(int rows, int total) const
+{
+	// magic, dimensions, columns, rows, data type, total values; then the
+	// column types if they differ
+	vector<int> header(6);
+	header[0] = MAGIC;
+	header[1] = 2;
+	header[2] = names.size();
+	header[3] = rows;
+	header[4] = filetype;
+	header[5] = total;
+	if (filetype == MIXED) {
+		header.insert(header.end(), types.begin(), types.end());
+	}
+	return header;
+}
+
+void GDFWriter::WriteHeader() throw(runtime_error)
+{
+	vector<int> header = Header(nrows, names.size() * nrows);
+	const char* p = reinterpret_cast<const char*>(&header[0]);
+	size_t left = header.size() * sizeof(int);
+	off_t offset = 0;
+	while (left > 0) {
+		ssize_t n = pwrite(fd, p, left, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			throw runtime_error("Could not write GDF header to " + filename + ": " + strerror(errno));
+		}
+		p += n;
+		offset += n;
+		left -= n;
+	}
+	if (lseek(fd, 0, SEEK_END) < 0) {
+		throw runtime_error("Could not seek in GDF output file " + filename + ": " + strerror(errno));
+	}
+}
+
+void GDFWriter::WriteOut(const char* data, size_t len) throw(runtime_error)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			throw runtime_error("Could not write to GDF output file " + filename + ": " + strerror(errno));
+		}
+		data += n;
+		len -= n;
+	}
+}
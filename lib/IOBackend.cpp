@@ -0,0 +1,361 @@
+/*
+ *  IOBackend.cpp
+ *
+ *  Implementation of the pread and io_uring read backends.
+ *
+ */
+
+#include <iostream>
+#include <map>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && !defined(NO_IO_URING)
+#define HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <IOBackend.h>
+
+using namespace std;
+
+// pread(2) backend: reads are done one at a time when they are waited for
+class PreadBackend : public IOBackend {
+public:
+	PreadBackend(int d) : IOBackend(d), nextticket(0) {};
+	~PreadBackend() {};
+
+	int Queue(int fd, char* buf, size_t len, off_t offset) throw(runtime_error);
+	void Submit() throw(runtime_error) {};
+	ssize_t Wait(int ticket) throw(runtime_error);
+	string Name() const { return "pread"; };
+
+private:
+	struct Request {
+		int fd;
+		char* buf;
+		size_t len;
+		off_t offset;
+	};
+	std::map<int, Request> queued;
+	int nextticket;
+};
+
+int PreadBackend::Queue(int fd, char* buf, size_t len, off_t offset) throw(runtime_error)
+{
+	Request r;
+	r.fd = fd;
+	r.buf = buf;
+	r.len = len;
+	r.offset = offset;
+	queued[nextticket] = r;
+	return nextticket++;
+}
+
+ssize_t PreadBackend::Wait(int ticket) throw(runtime_error)
+{
+	std::map<int, Request>::iterator it = queued.find(ticket);
+	if (it == queued.end()) {
+		throw runtime_error("Unknown ticket in PreadBackend::Wait");
+	}
+	Request r = it->second;
+	queued.erase(it);
+
+	// keep reading until we have everything or hit the end of the file
+	size_t got = 0;
+	while (got < r.len) {
+		ssize_t n = pread(r.fd, r.buf + got, r.len - got, r.offset + got);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw runtime_error(string("pread failed: ") + strerror(errno));
+		}
+		if (n == 0) {
+			break;
+		}
+		got += n;
+	}
+	return got;
+}
+
+#ifdef HAVE_IO_URING
+
+// io_uring backend: one ring shared by every reader that uses this object
+class UringBackend : public IOBackend {
+public:
+	UringBackend(int d) throw(runtime_error);
+	~UringBackend();
+
+	int Queue(int fd, char* buf, size_t len, off_t offset) throw(runtime_error);
+	void Submit() throw(runtime_error);
+	ssize_t Wait(int ticket) throw(runtime_error);
+	string Name() const { return "uring"; };
+
+private:
+	int ringfd;
+
+	// submission queue
+	unsigned* sqhead;
+	unsigned* sqtail;
+	unsigned* sqmask;
+	unsigned* sqarray;
+	struct io_uring_sqe* sqes;
+	// completion queue
+	unsigned* cqhead;
+	unsigned* cqtail;
+	unsigned* cqmask;
+	struct io_uring_cqe* cqes;
+
+	void* sqring;
+	size_t sqringsize;
+	void* cqring;
+	size_t cqringsize;
+	size_t sqessize;
+
+	// number of reads queued but not yet submitted, and submitted but not reaped
+	unsigned toSubmit;
+	unsigned inflight;
+	int nextticket;
+
+	// a read that has been queued and not yet waited for; the iovec must stay
+	// put until the kernel is done with it
+	struct Request {
+		int fd;
+		char* buf;
+		size_t len;
+		off_t offset;
+		size_t got;
+		struct iovec iov;
+	};
+	std::map<int, Request> requests;
+	// results of reads that have completed but have not been waited for
+	std::map<int, ssize_t> done;
+
+	// move finished reads from the completion queue into done; returns the count
+	int Reap();
+	void Enter(unsigned submit, unsigned mincomplete) throw(runtime_error);
+	// queue what is still to be read for a request
+	void Push(int ticket, Request& r) throw(runtime_error);
+};
+
+UringBackend::UringBackend(int d) throw(runtime_error)
+: IOBackend(d), sqring(MAP_FAILED), cqring(MAP_FAILED), toSubmit(0), inflight(0), nextticket(0)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ringfd = syscall(__NR_io_uring_setup, depth, &p);
+	if (ringfd < 0) {
+		throw runtime_error(string("io_uring_setup failed: ") + strerror(errno));
+	}
+
+	sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cqringsize > sqringsize) {
+			sqringsize = cqringsize;
+		}
+		cqringsize = sqringsize;
+	}
+	sqring = mmap(0, sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+	if (sqring == MAP_FAILED) {
+		close(ringfd);
+		throw runtime_error("Cannot map io_uring submission queue");
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cqring = sqring;
+	} else {
+		cqring = mmap(0, cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+		if (cqring == MAP_FAILED) {
+			munmap(sqring, sqringsize);
+			close(ringfd);
+			throw runtime_error("Cannot map io_uring completion queue");
+		}
+	}
+	sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = static_cast<struct io_uring_sqe*>(mmap(0, sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES));
+	if (sqes == MAP_FAILED) {
+		if (cqring != sqring) {
+			munmap(cqring, cqringsize);
+		}
+		munmap(sqring, sqringsize);
+		close(ringfd);
+		throw runtime_error("Cannot map io_uring submission entries");
+	}
+
+	char* sq = static_cast<char*>(sqring);
+	sqhead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+	sqtail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+	sqmask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+	sqarray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+	char* cq = static_cast<char*>(cqring);
+	cqhead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+	cqtail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+	cqmask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+	// the kernel may round the ring up; never keep more in flight than we asked for
+	if (static_cast<unsigned>(depth) > p.sq_entries) {
+		depth = p.sq_entries;
+	}
+}
+
+UringBackend::~UringBackend()
+{
+	// let outstanding reads land before their buffers go away
+	while (inflight > 0 || toSubmit > 0) {
+		try {
+			Enter(toSubmit, 1);
+		} catch (runtime_error&) {
+			break;
+		}
+		Reap();
+	}
+	munmap(sqes, sqessize);
+	if (cqring != sqring) {
+		munmap(cqring, cqringsize);
+	}
+	munmap(sqring, sqringsize);
+	close(ringfd);
+}
+
+void UringBackend::Enter(unsigned submit, unsigned mincomplete) throw(runtime_error)
+{
+	unsigned flags = mincomplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	while (true) {
+		int ret = syscall(__NR_io_uring_enter, ringfd, submit, mincomplete, flags, NULL, 0);
+		if (ret >= 0) {
+			toSubmit -= static_cast<unsigned>(ret) < submit ? ret : submit;
+			inflight += static_cast<unsigned>(ret) < submit ? ret : submit;
+			return;
+		}
+		if (errno != EINTR) {
+			throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+		}
+	}
+}
+
+int UringBackend::Reap()
+{
+	int count = 0;
+	unsigned head = *cqhead;
+	while (head != __atomic_load_n(cqtail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe* cqe = &cqes[head & *cqmask];
+		int ticket = static_cast<int>(cqe->user_data);
+		done[ticket] = cqe->res;
+		++head;
+		++count;
+		--inflight;
+	}
+	__atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+int UringBackend::Queue(int fd, char* buf, size_t len, off_t offset) throw(runtime_error)
+{
+	int ticket = nextticket++;
+	Request& r = requests[ticket];
+	r.fd = fd;
+	r.buf = buf;
+	r.len = len;
+	r.offset = offset;
+	r.got = 0;
+	Push(ticket, r);
+	return ticket;
+}
+
+void UringBackend::Push(int ticket, Request& r) throw(runtime_error)
+{
+	// make room: never have more than depth reads queued or in flight
+	while (toSubmit + inflight >= static_cast<unsigned>(depth)) {
+		if (Reap() == 0) {
+			Enter(toSubmit, 1);
+		}
+	}
+
+	r.iov.iov_base = r.buf + r.got;
+	r.iov.iov_len = r.len - r.got;
+
+	unsigned tail = *sqtail;
+	unsigned index = tail & *sqmask;
+	struct io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = r.fd;
+	sqe->addr = reinterpret_cast<unsigned long>(&r.iov);
+	sqe->len = 1;
+	sqe->off = r.offset + r.got;
+	sqe->user_data = ticket;
+	sqarray[index] = index;
+	__atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+	++toSubmit;
+}
+
+void UringBackend::Submit() throw(runtime_error)
+{
+	if (toSubmit > 0) {
+		Enter(toSubmit, 0);
+	}
+}
+
+ssize_t UringBackend::Wait(int ticket) throw(runtime_error)
+{
+	std::map<int, Request>::iterator req = requests.find(ticket);
+	if (req == requests.end()) {
+		throw runtime_error("Unknown ticket in UringBackend::Wait");
+	}
+	Request& r = req->second;
+
+	// keep reading until we have everything or hit the end of the file
+	while (true) {
+		Submit();
+		std::map<int, ssize_t>::iterator it;
+		while ((it = done.find(ticket)) == done.end()) {
+			if (Reap() == 0) {
+				Enter(toSubmit, 1);
+			}
+		}
+		ssize_t res = it->second;
+		done.erase(it);
+		if (res == -EINTR || res == -EAGAIN) {
+			Push(ticket, r);
+			continue;
+		}
+		if (res < 0) {
+			requests.erase(req);
+			throw runtime_error(string("io_uring read failed: ") + strerror(-res));
+		}
+		r.got += res;
+		if (res == 0 || r.got >= r.len) {
+			break;
+		}
+		Push(ticket, r);
+	}
+	ssize_t got = r.got;
+	requests.erase(req);
+	return got;
+}
+
+#endif // HAVE_IO_URING
+
+IOBackend* IOBackend::Create(const string& name, int depth)
+{
+	if (name == "uring") {
+#ifdef HAVE_IO_URING
+		try {
+			return new UringBackend(depth);
+		} catch (runtime_error& e) {
+			cerr << e.what() << "; falling back to pread" << endl;
+		}
+#else
+		cerr << "io_uring support not compiled in; falling back to pread" << endl;
+#endif
+	} else if (name != "pread") {
+		cerr << "Unknown I/O backend " << name << "; using pread" << endl;
+	}
+	return new PreadBackend(depth);
+}
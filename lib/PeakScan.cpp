@@ -0,0 +1,258 @@
+/*
+ *  PeakScan.cpp
+ *
+ *  Implementation of the candidate pass of the particle finder.
+ *
+ *  Each row kernel looks at the pixels from column 1 to cols - 2 of one row,
+ *  given the rows above and below it.  The vector kernels load the row at
+ *  j - 1, j and j + 1 and the rows above and below at j, take the largest
+ *  neighbour, and keep the pixels that equal the larger of themselves and that
+ *  neighbour, and of themselves and the threshold.  Pixels are unsigned, and
+ *  SSE2 has no unsigned 16-bit maximum, so 16-bit pixels are shifted by 0x8000
+ *  and compared as signed there.  The columns left over at the end of a row
+ *  go through the plain loop.
+ *
+ */
+
+#include <PeakScan.h>
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+template <class T>
+static void ScanRow(const T* up, const T* row, const T* down, int from, int to, int threshold,
+                    int r, vector<PeakCandidate>& out)
+{
+	for (int j = from; j < to; ++j) {
+		T val = row[j];
+		if ((val >= threshold) &&
+		    !((row[j - 1] > val) || (row[j + 1] > val) || (up[j] > val) || (down[j] > val))) {
+			PeakCandidate p;
+			p.row = r;
+			p.col = j;
+			out.push_back(p);
+		}
+	}
+}
+
+// add the candidates for the set bits of a mask, bytes bytes per pixel
+static inline void AddMask(unsigned int mask, int bytes, int r, int j, vector<PeakCandidate>& out)
+{
+	while (mask) {
+		int b = __builtin_ctz(mask);
+		PeakCandidate p;
+		p.row = r;
+		p.col = j + b / bytes;
+		out.push_back(p);
+		mask &= ~(((1u << bytes) - 1) << b);
+	}
+}
+
+typedef void (*RowScan8)(const unsigned char*, const unsigned char*, const unsigned char*,
+                         int, int, int, vector<PeakCandidate>&);
+typedef void (*RowScan16)(const unsigned short*, const unsigned short*, const unsigned short*,
+                          int, int, int, vector<PeakCandidate>&);
+
+static void ScanRow8Scalar(const unsigned char* up, const unsigned char* row, const unsigned char* down,
+                           int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	ScanRow(up, row, down, 1, cols - 1, threshold, r, out);
+}
+
+static void ScanRow16Scalar(const unsigned short* up, const unsigned short* row, const unsigned short* down,
+                            int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	ScanRow(up, row, down, 1, cols - 1, threshold, r, out);
+}
+
+#ifdef HAVE_SIMD
+
+#ifdef __SSE2__
+static void ScanRow8SSE2(const unsigned char* up, const unsigned char* row, const unsigned char* down,
+                         int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	const __m128i thr = _mm_set1_epi8(static_cast<char>(threshold));
+	int j = 1;
+	// every load stays inside the row
+	for (; j + 17 <= cols; j += 16) {
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j));
+		__m128i bright = _mm_cmpeq_epi8(_mm_max_epu8(c, thr), c);
+		if (_mm_movemask_epi8(bright) == 0) {
+			continue;
+		}
+		__m128i n = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j - 1)),
+		                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j + 1)));
+		n = _mm_max_epu8(n, _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + j)));
+		n = _mm_max_epu8(n, _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + j)));
+		__m128i peak = _mm_and_si128(bright, _mm_cmpeq_epi8(_mm_max_epu8(n, c), c));
+		AddMask(_mm_movemask_epi8(peak), 1, r, j, out);
+	}
+	ScanRow(up, row, down, j, cols - 1, threshold, r, out);
+}
+
+static void ScanRow16SSE2(const unsigned short* up, const unsigned short* row, const unsigned short* down,
+                          int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+	const __m128i thr = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(threshold)), bias);
+	int j = 1;
+	for (; j + 9 <= cols; j += 8) {
+		__m128i c = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j)), bias);
+		__m128i bright = _mm_cmpeq_epi16(_mm_max_epi16(c, thr), c);
+		if (_mm_movemask_epi8(bright) == 0) {
+			continue;
+		}
+		__m128i n = _mm_max_epi16(_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j - 1)), bias),
+		                          _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j + 1)), bias));
+		n = _mm_max_epi16(n, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(up + j)), bias));
+		n = _mm_max_epi16(n, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(down + j)), bias));
+		__m128i peak = _mm_and_si128(bright, _mm_cmpeq_epi16(_mm_max_epi16(n, c), c));
+		AddMask(_mm_movemask_epi8(peak), 2, r, j, out);
+	}
+	ScanRow(up, row, down, j, cols - 1, threshold, r, out);
+}
+#endif // __SSE2__
+
+__attribute__((target("avx2")))
+static void ScanRow8AVX2(const unsigned char* up, const unsigned char* row, const unsigned char* down,
+                         int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	const __m256i thr = _mm256_set1_epi8(static_cast<char>(threshold));
+	int j = 1;
+	for (; j + 33 <= cols; j += 32) {
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+		__m256i bright = _mm256_cmpeq_epi8(_mm256_max_epu8(c, thr), c);
+		if (_mm256_movemask_epi8(bright) == 0) {
+			continue;
+		}
+		__m256i n = _mm256_max_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j - 1)),
+		                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j + 1)));
+		n = _mm256_max_epu8(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + j)));
+		n = _mm256_max_epu8(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + j)));
+		__m256i peak = _mm256_and_si256(bright, _mm256_cmpeq_epi8(_mm256_max_epu8(n, c), c));
+		AddMask(_mm256_movemask_epi8(peak), 1, r, j, out);
+	}
+	ScanRow(up, row, down, j, cols - 1, threshold, r, out);
+}
+
+__attribute__((target("avx2")))
+static void ScanRow16AVX2(const unsigned short* up, const unsigned short* row, const unsigned short* down,
+                          int cols, int threshold, int r, vector<PeakCandidate>& out)
+{
+	const __m256i thr = _mm256_set1_epi16(static_cast<short>(threshold));
+	int j = 1;
+	for (; j + 17 <= cols; j += 16) {
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+		__m256i bright = _mm256_cmpeq_epi16(_mm256_max_epu16(c, thr), c);
+		if (_mm256_movemask_epi8(bright) == 0) {
+			continue;
+		}
+		__m256i n = _mm256_max_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j - 1)),
+		                             _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j + 1)));
+		n = _mm256_max_epu16(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + j)));
+		n = _mm256_max_epu16(n, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + j)));
+		__m256i peak = _mm256_and_si256(bright, _mm256_cmpeq_epi16(_mm256_max_epu16(n, c), c));
+		AddMask(_mm256_movemask_epi8(peak), 2, r, j, out);
+	}
+	ScanRow(up, row, down, j, cols - 1, threshold, r, out);
+}
+
+#endif // HAVE_SIMD
+
+// the kernels for this machine, picked the first time they are needed
+struct PeakScanKernels {
+	RowScan8 row8;
+	RowScan16 row16;
+	const char* name;
+
+	PeakScanKernels() : row8(ScanRow8Scalar), row16(ScanRow16Scalar), name("scalar")
+	{
+#ifdef HAVE_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			row8 = ScanRow8AVX2;
+			row16 = ScanRow16AVX2;
+			name = "avx2";
+			return;
+		}
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("sse2")) {
+			row8 = ScanRow8SSE2;
+			row16 = ScanRow16SSE2;
+			name = "sse2";
+		}
+#endif
+#endif
+	}
+};
+
+static const PeakScanKernels& Kernels()
+{
+	static PeakScanKernels k;
+	return k;
+}
+
+template <class T, class Scan>
+static void FindCandidates(const Image<T>& pixels, int threshold, Scan scan, vector<PeakCandidate>& out,
+                           int first, int end, int firstcol, int endcol)
+{
+	out.clear();
+	// nothing can reach a threshold above the largest pixel value, and every
+	// pixel reaches one at or below zero
+	if (threshold > static_cast<T>(-1)) {
+		return;
+	}
+	if (threshold < 0) {
+		threshold = 0;
+	}
+	// the first and last rows have no neighbours above or below
+	if (first < 1) {
+		first = 1;
+	}
+	if (end < 0 || end > pixels.Rows() - 1) {
+		end = pixels.Rows() - 1;
+	}
+	// and the first and last columns none to the left or right
+	if (firstcol < 1) {
+		firstcol = 1;
+	}
+	if (endcol < 0 || endcol > pixels.Cols() - 1) {
+		endcol = pixels.Cols() - 1;
+	}
+	if (firstcol >= endcol) {
+		return;
+	}
+	// a window of columns is scanned as a narrower row, whose first and last
+	// columns are the neighbours of the window
+	int offset = firstcol - 1;
+	int width = endcol - offset + 1;
+	for (int i = first; i < end; ++i) {
+		size_t before = out.size();
+		scan(pixels.Row(i - 1) + offset, pixels.Row(i) + offset, pixels.Row(i + 1) + offset, width,
+		     threshold, i, out);
+		for (size_t k = before; k < out.size(); ++k) {
+			out[k].col += offset;
+		}
+	}
+}
+
+void FindPeakCandidates(const Image8& pixels, int threshold, vector<PeakCandidate>& out, int first, int end,
+                        int firstcol, int endcol)
+{
+	FindCandidates(pixels, threshold, Kernels().row8, out, first, end, firstcol, endcol);
+}
+
+void FindPeakCandidates(const Image16& pixels, int threshold, vector<PeakCandidate>& out, int first, int end,
+                        int firstcol, int endcol)
+{
+	FindCandidates(pixels, threshold, Kernels().row16, out, first, end, firstcol, endcol);
+}
+
+const char* PeakScanName()
+{
+	return Kernels().name;
+}
@@ -0,0 +1,53 @@
+/*
+ *  PixelTraits.cpp
+ *
+ *  The logarithm tables of the pixel traits.
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <PixelTraits.h>
+
+double Log8::table[256];
+float Log8::ftable[256];
+float Log16::ftable[65536];
+
+// log(v), rounded to 15 significant digits
+static double RoundedLog(int v)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.15g", log(static_cast<double>(v)));
+	return strtod(buffer, NULL);
+}
+
+// either table may be NULL
+static bool Fill(double* table, float* ftable, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		// a zero pixel counts as 0.0001
+		double v = (i == 0) ? log(0.0001) : RoundedLog(i);
+		if (table != NULL) {
+			table[i] = v;
+		}
+		if (ftable != NULL) {
+			ftable[i] = static_cast<float>(v);
+		}
+	}
+	return true;
+}
+
+void Log8::Prepare()
+{
+	// made once, even with several threads asking
+	static bool ready = Fill(table, ftable, 256);
+	(void) ready;
+}
+
+void Log16::Prepare()
+{
+	static bool ready = Fill(NULL, ftable, 65536);
+	(void) ready;
+}
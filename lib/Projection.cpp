@@ -0,0 +1,355 @@
+/*
+ *  Projection.cpp
+ *
+ *  Implementation of the batch camera model.  Each kernel handles points
+ *  from a given one to n - 1: the vector kernels take two (SSE2) or four
+ *  (AVX) points at a time and leave the points over at the end to the plain
+ *  loops.  Negation is done on the sign bit, as the compiler does it, so
+ *  that a zero keeps the sign the plain loops give it.
+ *
+ */
+
+#include <Projection.h>
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+static void UnDistortScalar(const ProjectionConstants& c, int from, int n, const double* x, const double* y,
+                            double* ox, double* oy)
+{
+	for (int i = from; i < n; ++i) {
+		double cx = x[i] - c.halfw;
+		double cy = -y[i] + c.halfh;
+		ox[i] = cx * c.wpix;
+		oy[i] = cy * c.hpix;
+	}
+}
+
+static void DistortScalar(const ProjectionConstants& c, int from, int n, const double* x, const double* y,
+                          double* ox, double* oy)
+{
+	for (int i = from; i < n; ++i) {
+		double px = x[i] * c.invwpix;
+		double py = y[i] * c.invhpix;
+		ox[i] = px + c.halfw;
+		oy[i] = -1.0 * (py - c.halfh);
+	}
+}
+
+static void ImageToWorldScalar(const ProjectionConstants& c, int from, int n, const double* x, const double* y,
+                               double* ox, double* oy, double* oz)
+{
+	const double* Ri = c.Rinv;
+	for (int i = from; i < n; ++i) {
+		double dx = x[i] * c.T[2] / c.f_eff - c.T[0];
+		double dy = y[i] * c.T[2] / c.f_eff - c.T[1];
+		double dz = c.T[2] - c.T[2];
+		ox[i] = Ri[0] * dx + Ri[1] * dy + Ri[2] * dz;
+		oy[i] = Ri[3] * dx + Ri[4] * dy + Ri[5] * dz;
+		oz[i] = Ri[6] * dx + Ri[7] * dy + Ri[8] * dz;
+	}
+}
+
+static void WorldToImageScalar(const ProjectionConstants& c, int from, int n, const double* x, const double* y,
+                               const double* z, double* ox, double* oy, double* oz)
+{
+	const double* R = c.R;
+	for (int i = from; i < n; ++i) {
+		double px = R[0] * x[i] + R[1] * y[i] + R[2] * z[i] + c.T[0];
+		double py = R[3] * x[i] + R[4] * y[i] + R[5] * z[i] + c.T[1];
+		double pz = R[6] * x[i] + R[7] * y[i] + R[8] * z[i] + c.T[2];
+		double s = c.f_eff / pz;
+		ox[i] = px * s;
+		oy[i] = py * s;
+		oz[i] = pz * s;
+	}
+}
+
+typedef void (*PlaneKernel)(const ProjectionConstants&, int, const double*, const double*, double*, double*);
+typedef void (*LiftKernel)(const ProjectionConstants&, int, const double*, const double*,
+                           double*, double*, double*);
+typedef void (*SpaceKernel)(const ProjectionConstants&, int, const double*, const double*, const double*,
+                            double*, double*, double*);
+
+static void UnDistort1(const ProjectionConstants& c, int n, const double* x, const double* y,
+                       double* ox, double* oy)
+{
+	UnDistortScalar(c, 0, n, x, y, ox, oy);
+}
+
+static void Distort1(const ProjectionConstants& c, int n, const double* x, const double* y,
+                     double* ox, double* oy)
+{
+	DistortScalar(c, 0, n, x, y, ox, oy);
+}
+
+static void ImageToWorld1(const ProjectionConstants& c, int n, const double* x, const double* y,
+                          double* ox, double* oy, double* oz)
+{
+	ImageToWorldScalar(c, 0, n, x, y, ox, oy, oz);
+}
+
+static void WorldToImage1(const ProjectionConstants& c, int n, const double* x, const double* y, const double* z,
+                          double* ox, double* oy, double* oz)
+{
+	WorldToImageScalar(c, 0, n, x, y, z, ox, oy, oz);
+}
+
+#ifdef HAVE_SIMD
+
+#ifdef __SSE2__
+static void UnDistortSSE2(const ProjectionConstants& c, int n, const double* x, const double* y,
+                          double* ox, double* oy)
+{
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d halfw = _mm_set1_pd(c.halfw);
+	const __m128d halfh = _mm_set1_pd(c.halfh);
+	const __m128d wpix = _mm_set1_pd(c.wpix);
+	const __m128d hpix = _mm_set1_pd(c.hpix);
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d cx = _mm_sub_pd(_mm_loadu_pd(x + i), halfw);
+		__m128d cy = _mm_add_pd(_mm_xor_pd(_mm_loadu_pd(y + i), sign), halfh);
+		_mm_storeu_pd(ox + i, _mm_mul_pd(cx, wpix));
+		_mm_storeu_pd(oy + i, _mm_mul_pd(cy, hpix));
+	}
+	UnDistortScalar(c, i, n, x, y, ox, oy);
+}
+
+static void DistortSSE2(const ProjectionConstants& c, int n, const double* x, const double* y,
+                        double* ox, double* oy)
+{
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d halfw = _mm_set1_pd(c.halfw);
+	const __m128d halfh = _mm_set1_pd(c.halfh);
+	const __m128d invwpix = _mm_set1_pd(c.invwpix);
+	const __m128d invhpix = _mm_set1_pd(c.invhpix);
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d px = _mm_mul_pd(_mm_loadu_pd(x + i), invwpix);
+		__m128d py = _mm_mul_pd(_mm_loadu_pd(y + i), invhpix);
+		_mm_storeu_pd(ox + i, _mm_add_pd(px, halfw));
+		_mm_storeu_pd(oy + i, _mm_xor_pd(_mm_sub_pd(py, halfh), sign));
+	}
+	DistortScalar(c, i, n, x, y, ox, oy);
+}
+
+static void ImageToWorldSSE2(const ProjectionConstants& c, int n, const double* x, const double* y,
+                             double* ox, double* oy, double* oz)
+{
+	const __m128d tz = _mm_set1_pd(c.T[2]);
+	const __m128d f = _mm_set1_pd(c.f_eff);
+	const __m128d tx = _mm_set1_pd(c.T[0]);
+	const __m128d ty = _mm_set1_pd(c.T[1]);
+	// the same for every point
+	const __m128d dz = _mm_set1_pd(c.T[2] - c.T[2]);
+	__m128d Ri[9];
+	for (int k = 0; k < 9; ++k) {
+		Ri[k] = _mm_set1_pd(c.Rinv[k]);
+	}
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d dx = _mm_sub_pd(_mm_div_pd(_mm_mul_pd(_mm_loadu_pd(x + i), tz), f), tx);
+		__m128d dy = _mm_sub_pd(_mm_div_pd(_mm_mul_pd(_mm_loadu_pd(y + i), tz), f), ty);
+		double* out[3] = { ox, oy, oz };
+		for (int k = 0; k < 3; ++k) {
+			__m128d r = _mm_add_pd(_mm_add_pd(_mm_mul_pd(Ri[3 * k], dx), _mm_mul_pd(Ri[3 * k + 1], dy)),
+			                       _mm_mul_pd(Ri[3 * k + 2], dz));
+			_mm_storeu_pd(out[k] + i, r);
+		}
+	}
+	ImageToWorldScalar(c, i, n, x, y, ox, oy, oz);
+}
+
+static void WorldToImageSSE2(const ProjectionConstants& c, int n, const double* x, const double* y,
+                             const double* z, double* ox, double* oy, double* oz)
+{
+	const __m128d f = _mm_set1_pd(c.f_eff);
+	__m128d R[9];
+	for (int k = 0; k < 9; ++k) {
+		R[k] = _mm_set1_pd(c.R[k]);
+	}
+	__m128d T[3];
+	for (int k = 0; k < 3; ++k) {
+		T[k] = _mm_set1_pd(c.T[k]);
+	}
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d px = _mm_loadu_pd(x + i);
+		__m128d py = _mm_loadu_pd(y + i);
+		__m128d pz = _mm_loadu_pd(z + i);
+		__m128d p[3];
+		for (int k = 0; k < 3; ++k) {
+			p[k] = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(R[3 * k], px), _mm_mul_pd(R[3 * k + 1], py)),
+			                             _mm_mul_pd(R[3 * k + 2], pz)), T[k]);
+		}
+		__m128d s = _mm_div_pd(f, p[2]);
+		_mm_storeu_pd(ox + i, _mm_mul_pd(p[0], s));
+		_mm_storeu_pd(oy + i, _mm_mul_pd(p[1], s));
+		_mm_storeu_pd(oz + i, _mm_mul_pd(p[2], s));
+	}
+	WorldToImageScalar(c, i, n, x, y, z, ox, oy, oz);
+}
+#endif // __SSE2__
+
+__attribute__((target("avx")))
+static void UnDistortAVX(const ProjectionConstants& c, int n, const double* x, const double* y,
+                         double* ox, double* oy)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d halfw = _mm256_set1_pd(c.halfw);
+	const __m256d halfh = _mm256_set1_pd(c.halfh);
+	const __m256d wpix = _mm256_set1_pd(c.wpix);
+	const __m256d hpix = _mm256_set1_pd(c.hpix);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d cx = _mm256_sub_pd(_mm256_loadu_pd(x + i), halfw);
+		__m256d cy = _mm256_add_pd(_mm256_xor_pd(_mm256_loadu_pd(y + i), sign), halfh);
+		_mm256_storeu_pd(ox + i, _mm256_mul_pd(cx, wpix));
+		_mm256_storeu_pd(oy + i, _mm256_mul_pd(cy, hpix));
+	}
+	UnDistortScalar(c, i, n, x, y, ox, oy);
+}
+
+__attribute__((target("avx")))
+static void DistortAVX(const ProjectionConstants& c, int n, const double* x, const double* y,
+                       double* ox, double* oy)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d halfw = _mm256_set1_pd(c.halfw);
+	const __m256d halfh = _mm256_set1_pd(c.halfh);
+	const __m256d invwpix = _mm256_set1_pd(c.invwpix);
+	const __m256d invhpix = _mm256_set1_pd(c.invhpix);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d px = _mm256_mul_pd(_mm256_loadu_pd(x + i), invwpix);
+		__m256d py = _mm256_mul_pd(_mm256_loadu_pd(y + i), invhpix);
+		_mm256_storeu_pd(ox + i, _mm256_add_pd(px, halfw));
+		_mm256_storeu_pd(oy + i, _mm256_xor_pd(_mm256_sub_pd(py, halfh), sign));
+	}
+	DistortScalar(c, i, n, x, y, ox, oy);
+}
+
+__attribute__((target("avx")))
+static void ImageToWorldAVX(const ProjectionConstants& c, int n, const double* x, const double* y,
+                            double* ox, double* oy, double* oz)
+{
+	const __m256d tz = _mm256_set1_pd(c.T[2]);
+	const __m256d f = _mm256_set1_pd(c.f_eff);
+	const __m256d tx = _mm256_set1_pd(c.T[0]);
+	const __m256d ty = _mm256_set1_pd(c.T[1]);
+	// the same for every point
+	const __m256d dz = _mm256_set1_pd(c.T[2] - c.T[2]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d dx = _mm256_sub_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), tz), f), tx);
+		__m256d dy = _mm256_sub_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_loadu_pd(y + i), tz), f), ty);
+		double* out[3] = { ox, oy, oz };
+		for (int k = 0; k < 3; ++k) {
+			__m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(c.Rinv[3 * k]), dx),
+			                                        _mm256_mul_pd(_mm256_set1_pd(c.Rinv[3 * k + 1]), dy)),
+			                          _mm256_mul_pd(_mm256_set1_pd(c.Rinv[3 * k + 2]), dz));
+			_mm256_storeu_pd(out[k] + i, r);
+		}
+	}
+	ImageToWorldScalar(c, i, n, x, y, ox, oy, oz);
+}
+
+__attribute__((target("avx")))
+static void WorldToImageAVX(const ProjectionConstants& c, int n, const double* x, const double* y,
+                            const double* z, double* ox, double* oy, double* oz)
+{
+	const __m256d f = _mm256_set1_pd(c.f_eff);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d px = _mm256_loadu_pd(x + i);
+		__m256d py = _mm256_loadu_pd(y + i);
+		__m256d pz = _mm256_loadu_pd(z + i);
+		__m256d p[3];
+		for (int k = 0; k < 3; ++k) {
+			p[k] = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(c.R[3 * k]), px),
+			                                                 _mm256_mul_pd(_mm256_set1_pd(c.R[3 * k + 1]), py)),
+			                                   _mm256_mul_pd(_mm256_set1_pd(c.R[3 * k + 2]), pz)),
+			                     _mm256_set1_pd(c.T[k]));
+		}
+		__m256d s = _mm256_div_pd(f, p[2]);
+		_mm256_storeu_pd(ox + i, _mm256_mul_pd(p[0], s));
+		_mm256_storeu_pd(oy + i, _mm256_mul_pd(p[1], s));
+		_mm256_storeu_pd(oz + i, _mm256_mul_pd(p[2], s));
+	}
+	WorldToImageScalar(c, i, n, x, y, z, ox, oy, oz);
+}
+
+#endif // HAVE_SIMD
+
+// the kernels for this machine, picked the first time they are needed
+struct ProjectionKernels {
+	PlaneKernel undistort;
+	PlaneKernel distort;
+	LiftKernel imagetoworld;
+	SpaceKernel worldtoimage;
+	const char* name;
+
+	ProjectionKernels()
+	: undistort(UnDistort1), distort(Distort1), imagetoworld(ImageToWorld1), worldtoimage(WorldToImage1),
+	  name("scalar")
+	{
+#ifdef HAVE_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx")) {
+			undistort = UnDistortAVX;
+			distort = DistortAVX;
+			imagetoworld = ImageToWorldAVX;
+			worldtoimage = WorldToImageAVX;
+			name = "avx";
+			return;
+		}
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("sse2")) {
+			undistort = UnDistortSSE2;
+			distort = DistortSSE2;
+			imagetoworld = ImageToWorldSSE2;
+			worldtoimage = WorldToImageSSE2;
+			name = "sse2";
+		}
+#endif
+#endif
+	}
+};
+
+static const ProjectionKernels& Kernels()
+{
+	static ProjectionKernels k;
+	return k;
+}
+
+void UnDistortPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                     double* ox, double* oy)
+{
+	Kernels().undistort(c, n, x, y, ox, oy);
+}
+
+void DistortPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                   double* ox, double* oy)
+{
+	Kernels().distort(c, n, x, y, ox, oy);
+}
+
+void ImageToWorldPoints(const ProjectionConstants& c, int n, const double* x, const double* y,
+                        double* ox, double* oy, double* oz)
+{
+	Kernels().imagetoworld(c, n, x, y, ox, oy, oz);
+}
+
+void WorldToImagePoints(const ProjectionConstants& c, int n, const double* x, const double* y, const double* z,
+                        double* ox, double* oy, double* oz)
+{
+	Kernels().worldtoimage(c, n, x, y, z, ox, oy, oz);
+}
+
+const char* ProjectionName()
+{
+	return Kernels().name;
+}
@@ -0,0 +1,109 @@
+/*
+ *  RegionOfInterest.cpp
+ *
+ *  Implementation of the region of interest of a camera.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <RegionOfInterest.h>
+
+using namespace std;
+
+RegionOfInterest::RegionOfInterest(int r, int c)
+: rows(r), cols(c), whole(true), size(0), firstrow(0), endrow(r), firstcol(0), endcol(c)
+{}
+
+void RegionOfInterest::Start()
+{
+	if (!whole) {
+		return;
+	}
+	whole = false;
+	inside.assign(rows * cols, 0);
+	size = 0;
+	firstrow = rows;
+	endrow = 0;
+	firstcol = cols;
+	endcol = 0;
+}
+
+void RegionOfInterest::Include(int row, int col)
+{
+	unsigned char& in = inside[row * cols + col];
+	if (!in) {
+		in = 1;
+		++size;
+		firstrow = min(firstrow, row);
+		endrow = max(endrow, row + 1);
+		firstcol = min(firstcol, col);
+		endcol = max(endcol, col + 1);
+	}
+}
+
+void RegionOfInterest::AddRectangle(int col0, int row0, int col1, int row1)
+{
+	Start();
+	for (int i = max(row0, 0); i < min(row1, rows); ++i) {
+		for (int j = max(col0, 0); j < min(col1, cols); ++j) {
+			Include(i, j);
+		}
+	}
+}
+
+// the next number of a PGM header, skipping comments
+static int HeaderNumber(istream& in)
+{
+	in >> ws;
+	while (in.peek() == '#') {
+		string comment;
+		getline(in, comment);
+		in >> ws;
+	}
+	int n = -1;
+	in >> n;
+	return n;
+}
+
+void RegionOfInterest::AddMask(const string& filename) throw(runtime_error)
+{
+	ifstream in(filename.c_str(), ios::in | ios::binary);
+	if (!in.is_open()) {
+		throw runtime_error("Could not open region of interest mask " + filename);
+	}
+	string magic;
+	in >> magic;
+	int w = HeaderNumber(in);
+	int h = HeaderNumber(in);
+	int maxval = HeaderNumber(in);
+	if (magic != "P5" || w <= 0 || h <= 0 || maxval <= 0 || maxval > 65535) {
+		throw runtime_error("Region of interest mask " + filename + " is not a binary PGM image");
+	}
+	if (w != cols || h != rows) {
+		stringstream msg;
+		msg << "Region of interest mask " << filename << " is " << w << "x" << h
+		    << ", but the sensor is " << cols << "x" << rows;
+		throw runtime_error(msg.str());
+	}
+	// one whitespace character ends the header
+	in.get();
+	int bytes = (maxval < 256) ? 1 : 2;
+	vector<unsigned char> data(static_cast<size_t>(w) * h * bytes);
+	in.read(reinterpret_cast<char*>(&data[0]), data.size());
+	if (in.gcount() != static_cast<streamsize>(data.size())) {
+		throw runtime_error("Region of interest mask " + filename + " is cut short");
+	}
+
+	Start();
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			const unsigned char* p = &data[(static_cast<size_t>(i) * cols + j) * bytes];
+			if (p[0] || (bytes == 2 && p[1])) {
+				Include(i, j);
+			}
+		}
+	}
+}
@@ -0,0 +1,371 @@
+/*
+ *  Threshold.cpp
+ *
+ *  Implementation of the adaptive particle threshold.
+ *
+ *  Counting pixels into bins is a scatter, which SIMD cannot do without
+ *  conflict detection, so the histogram is spread over four interleaved
+ *  copies (a pixel goes to copy j % 4) that are added up at the end: repeated
+ *  values, which a dark frame is full of, then do not wait on each other's
+ *  increments.  The vector kernels count blocks of zero pixels, most of a
+ *  decoded CPV frame, at once, and shift whole blocks of 16-bit pixels to
+ *  their bins before counting them.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <Threshold.h>
+#include <PixelTraits.h>
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// the most bins a histogram is given
+static const int MAXBINS = 4096;
+// the number of interleaved copies of a histogram
+static const int COPIES = 4;
+
+// count pixels from to to - 1 of a row into the copies of a histogram
+template <class T>
+static inline void CountRun(const T* row, int from, int to, int shift, unsigned int* h, int nbins)
+{
+	int j = from;
+	for (; j + COPIES <= to; j += COPIES) {
+		++h[row[j] >> shift];
+		++h[nbins + (row[j + 1] >> shift)];
+		++h[2 * nbins + (row[j + 2] >> shift)];
+		++h[3 * nbins + (row[j + 3] >> shift)];
+	}
+	for (; j < to; ++j) {
+		++h[row[j] >> shift];
+	}
+}
+
+typedef void (*CountRow8)(const unsigned char*, int, int, unsigned int*, int, unsigned int&);
+typedef void (*CountRow16)(const unsigned short*, int, int, unsigned int*, int, unsigned int&);
+
+static void CountRow8Scalar(const unsigned char* row, int cols, int shift, unsigned int* h, int nbins,
+                            unsigned int& zeros)
+{
+	CountRun(row, 0, cols, shift, h, nbins);
+}
+
+static void CountRow16Scalar(const unsigned short* row, int cols, int shift, unsigned int* h, int nbins,
+                             unsigned int& zeros)
+{
+	CountRun(row, 0, cols, shift, h, nbins);
+}
+
+#ifdef HAVE_SIMD
+
+#ifdef __SSE2__
+static void CountRow8SSE2(const unsigned char* row, int cols, int shift, unsigned int* h, int nbins,
+                          unsigned int& zeros)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int j = 0;
+	for (; j + 16 <= cols; j += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff) {
+			zeros += 16;
+		} else {
+			CountRun(row, j, j + 16, 0, h, nbins);
+		}
+	}
+	CountRun(row, j, cols, 0, h, nbins);
+}
+
+static void CountRow16SSE2(const unsigned short* row, int cols, int shift, unsigned int* h, int nbins,
+                           unsigned int& zeros)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	unsigned short bins[8] __attribute__((aligned(16)));
+	int j = 0;
+	for (; j + 8 <= cols; j += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) == 0xffff) {
+			zeros += 8;
+		} else {
+			_mm_store_si128(reinterpret_cast<__m128i*>(bins), _mm_srl_epi16(v, count));
+			CountRun(bins, 0, 8, 0, h, nbins);
+		}
+	}
+	CountRun(row, j, cols, shift, h, nbins);
+}
+#endif // __SSE2__
+
+__attribute__((target("avx2")))
+static void CountRow8AVX2(const unsigned char* row, int cols, int shift, unsigned int* h, int nbins,
+                          unsigned int& zeros)
+{
+	int j = 0;
+	for (; j + 32 <= cols; j += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+		if (_mm256_testz_si256(v, v)) {
+			zeros += 32;
+		} else {
+			CountRun(row, j, j + 32, 0, h, nbins);
+		}
+	}
+	CountRun(row, j, cols, 0, h, nbins);
+}
+
+__attribute__((target("avx2")))
+static void CountRow16AVX2(const unsigned short* row, int cols, int shift, unsigned int* h, int nbins,
+                           unsigned int& zeros)
+{
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	unsigned short bins[16] __attribute__((aligned(32)));
+	int j = 0;
+	for (; j + 16 <= cols; j += 16) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+		if (_mm256_testz_si256(v, v)) {
+			zeros += 16;
+		} else {
+			_mm256_store_si256(reinterpret_cast<__m256i*>(bins), _mm256_srl_epi16(v, count));
+			CountRun(bins, 0, 16, 0, h, nbins);
+		}
+	}
+	CountRun(row, j, cols, shift, h, nbins);
+}
+
+#endif // HAVE_SIMD
+
+// the kernels for this machine, picked the first time they are needed
+struct HistogramKernels {
+	CountRow8 row8;
+	CountRow16 row16;
+	const char* name;
+
+	HistogramKernels() : row8(CountRow8Scalar), row16(CountRow16Scalar), name("scalar")
+	{
+#ifdef HAVE_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			row8 = CountRow8AVX2;
+			row16 = CountRow16AVX2;
+			name = "avx2";
+			return;
+		}
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("sse2")) {
+			row8 = CountRow8SSE2;
+			row16 = CountRow16SSE2;
+			name = "sse2";
+		}
+#endif
+#endif
+	}
+};
+
+static const HistogramKernels& Kernels()
+{
+	static HistogramKernels k;
+	return k;
+}
+
+template <class T, class Count>
+static int Build(const Image<T>& pixels, int colors, int step, Count count, vector<unsigned int>& hist)
+{
+	// (a copy: min takes its arguments by reference)
+	const int top = PixelTraits<T>::MAXVALUE;
+	colors = max(1, min(colors, top));
+	step = max(step, 1);
+	int shift = 0;
+	while ((colors >> shift) >= MAXBINS) {
+		++shift;
+	}
+	int nbins = (colors >> shift) + 1;
+
+	// the copies go one after another in hist, and are added into the first
+	hist.assign(COPIES * nbins, 0);
+	unsigned int zeros = 0;
+	for (int i = 0; i < pixels.Rows(); i += step) {
+		count(pixels.Row(i), pixels.Cols(), shift, &hist[0], nbins, zeros);
+	}
+	unsigned int* h = &hist[0];
+	int b = 0;
+#if defined(HAVE_SIMD) && defined(__SSE2__)
+	for (; b + 4 <= nbins; b += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + b));
+		for (int k = 1; k < COPIES; ++k) {
+			s = _mm_add_epi32(s, _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + k * nbins + b)));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(h + b), s);
+	}
+#endif
+	for (; b < nbins; ++b) {
+		for (int k = 1; k < COPIES; ++k) {
+			h[b] += h[k * nbins + b];
+		}
+	}
+	hist.resize(nbins);
+	hist[0] += zeros;
+	return shift;
+}
+
+static int Build(const Image8& pixels, int colors, int step, vector<unsigned int>& hist)
+{
+	return Build(pixels, colors, step, Kernels().row8, hist);
+}
+
+static int Build(const Image16& pixels, int colors, int step, vector<unsigned int>& hist)
+{
+	return Build(pixels, colors, step, Kernels().row16, hist);
+}
+
+template <class T>
+int BuildHistogram(const Image<T>& pixels, int colors, int step, vector<unsigned int>& hist)
+{
+	return Build(pixels, colors, step, hist);
+}
+
+// the pixel types we have decoders for
+template int BuildHistogram(const Image<unsigned char>&, int, int, vector<unsigned int>&);
+template int BuildHistogram(const Image<unsigned short>&, int, int, vector<unsigned int>&);
+
+const char* HistogramName()
+{
+	return Kernels().name;
+}
+
+AdaptiveThreshold::AdaptiveThreshold(const string& spec, int fixed) throw(invalid_argument)
+: mode(FIXED), percentile(99.5), smooth(0.25), lo(1), hi(-1), step(1), primed(false), running(fixed),
+  current(fixed)
+{
+	size_t colon = spec.find(':');
+	string name = spec.substr(0, colon);
+	string options = (colon == string::npos) ? string() : spec.substr(colon + 1);
+	if (name == "fixed") {
+		mode = FIXED;
+	} else if (name == "percentile") {
+		mode = PERCENTILE;
+	} else if (name == "otsu") {
+		mode = OTSU;
+	} else {
+		throw invalid_argument("Unknown threshold \"" + name + "\" (use fixed, percentile or otsu)");
+	}
+	if (mode == FIXED && !options.empty()) {
+		throw invalid_argument("A fixed threshold takes no options");
+	}
+
+	size_t start = 0;
+	while (start < options.size()) {
+		size_t comma = options.find(',', start);
+		string item = options.substr(start, comma == string::npos ? string::npos : comma - start);
+		start = (comma == string::npos) ? options.size() : comma + 1;
+		size_t eq = item.find('=');
+		string key = item.substr(0, eq);
+		double value = (eq == string::npos) ? -1 : atof(item.substr(eq + 1).c_str());
+		bool good = (eq != string::npos);
+		if (key == "p" && mode == PERCENTILE) {
+			good = good && value > 0 && value <= 100;
+			percentile = value;
+		} else if (key == "smooth") {
+			good = good && value > 0 && value <= 1;
+			smooth = value;
+		} else if (key == "min") {
+			good = good && value >= 0;
+			lo = static_cast<int>(value);
+		} else if (key == "max") {
+			good = good && value >= 1;
+			hi = static_cast<int>(value);
+		} else if (key == "step") {
+			good = good && value >= 1;
+			step = static_cast<int>(value);
+		} else {
+			good = false;
+		}
+		if (!good) {
+			throw invalid_argument("Bad threshold option \"" + item + "\" (use "
+			                       + string(mode == PERCENTILE ? "p=percent, " : "")
+			                       + "smooth=w, min=N, max=N or step=N)");
+		}
+	}
+}
+
+int AdaptiveThreshold::FromHistogram(int shift) const
+{
+	double total = 0;
+	for (unsigned int b = 0; b < hist.size(); ++b) {
+		total += hist[b];
+	}
+	if (total == 0) {
+		return current;
+	}
+
+	// the threshold is the bottom of the first bright bin
+	int bright = hist.size();
+	if (mode == PERCENTILE) {
+		double target = total * percentile / 100.0;
+		double below = 0;
+		for (unsigned int b = 0; b < hist.size(); ++b) {
+			below += hist[b];
+			if (below >= target) {
+				bright = b + 1;
+				break;
+			}
+		}
+	} else {
+		double sum = 0;
+		for (unsigned int b = 0; b < hist.size(); ++b) {
+			sum += static_cast<double>(b) * hist[b];
+		}
+		// empty bins between the classes all split them equally well; take
+		// the middle of the gap rather than the top of the dark class
+		double dark = 0;
+		double darksum = 0;
+		double best = -1;
+		int first = 0;
+		int last = 0;
+		for (unsigned int b = 0; b + 1 < hist.size(); ++b) {
+			dark += hist[b];
+			darksum += static_cast<double>(b) * hist[b];
+			if (dark == 0) {
+				continue;
+			}
+			if (dark == total) {
+				break;
+			}
+			double diff = darksum / dark - (sum - darksum) / (total - dark);
+			double between = dark * (total - dark) * diff * diff;
+			if (between > best) {
+				best = between;
+				first = b;
+				last = b;
+			} else if (between == best && last + 1 == static_cast<int>(b)) {
+				last = b;
+			}
+		}
+		if (best >= 0) {
+			bright = (first + last) / 2 + 1;
+		}
+	}
+	return bright << shift;
+}
+
+template <class T>
+int AdaptiveThreshold::Update(const Image<T>& pixels, int colors)
+{
+	if (mode == FIXED) {
+		return current;
+	}
+	int shift = BuildHistogram(pixels, colors, step, hist);
+	int t = FromHistogram(shift);
+	running = primed ? running + smooth * (t - running) : t;
+	primed = true;
+	int top = (hi > 0) ? hi : colors;
+	current = max(lo, min(static_cast<int>(floor(running + 0.5)), top));
+	return current;
+}
+
+template int AdaptiveThreshold::Update(const Image<unsigned char>&, int);
+template int AdaptiveThreshold::Update(const Image<unsigned short>&, int);
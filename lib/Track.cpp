@@ -79,10 +79,18 @@ int Track::NumFake() const
   return count;
 }
 
-void Track::WriteGDF(ofstream& output, double index, double fps /* = 1 */) const
+void Track::WriteGDF(GDFWriter& output, double index, double fps /* = 1 */) const
 {
 int len = Length();
+	double row[GDFCOLUMNS];
 	for (int i = 0; i < len; ++i) {
+		GDFRow(i, index, fps, row);
+		output.AppendRow(row);
+	}
+}
+
+void Track::GDFRow(int i, double index, double fps, double* row) const
+{
 		// Format:
 		// Track Index
 		// X
@@ -92,47 +100,34 @@ int len = Length();
 		// Camera 1-4 X and Y and Orientation
 		// Info
 		// Fake bit
-		output.write(reinterpret_cast<const char*>(&index), 8);
-		double tmp = pos[i].X();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Y();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Z();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = static_cast<double>(time[i]) / fps;
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].X1();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Y1();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Ori1();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].X2();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Y2();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Ori2();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].X3();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Y3();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Ori3();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].X4();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Y4();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Ori4();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-		tmp = pos[i].Info();
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-			if (pos[i].IsFake()) {
-				tmp = 1;
-			} 
-			else {
-				tmp = 0;
-			}
-		output.write(reinterpret_cast<const char*>(&tmp), 8);
-	}
+		row[0] = index;
+		row[1] = pos[i].X();
+		row[2] = pos[i].Y();
+		row[3] = pos[i].Z();
+		row[4] = static_cast<double>(time[i]) / fps;
+		row[5] = pos[i].X1();
+		row[6] = pos[i].Y1();
+		row[7] = pos[i].Ori1();
+		row[8] = pos[i].X2();
+		row[9] = pos[i].Y2();
+		row[10] = pos[i].Ori2();
+		row[11] = pos[i].X3();
+		row[12] = pos[i].Y3();
+		row[13] = pos[i].Ori3();
+		row[14] = pos[i].X4();
+		row[15] = pos[i].Y4();
+		row[16] = pos[i].Ori4();
+		row[17] = pos[i].Info();
+		row[18] = pos[i].IsFake() ? 1 : 0;
+}
+
+vector<string> Track::GDFColumns()
+{
+	static const char* names[] = {
+		"index", "x", "y", "z", "time",
+		"x1", "y1", "ori1", "x2", "y2", "ori2",
+		"x3", "y3", "ori3", "x4", "y4", "ori4",
+		"info", "fake"
+	};
+	return vector<string>(names, names + sizeof(names) / sizeof(names[0]));
 }
@@ -0,0 +1,51 @@
+/*
+ *  TrackOutput.cpp
+ *
+ *  The GDF track output, and the choice between the track output formats.
+ *
+ */
+
+#include <TrackOutput.h>
+#include <CompactTrack.h>
+#include <TrackStore.h>
+
+using namespace std;
+
+// one row per point, through a GDFWriter
+class GDFTrackOutput : public TrackOutput {
+public:
+	GDFTrackOutput(const string& filename, double ifps, const string& precision, int framing)
+	throw(runtime_error, invalid_argument)
+	: outfile(filename, Track::GDFColumns(), precision, framing), fps(ifps)
+	{}
+
+	void Write(const Track& t, double index) throw(runtime_error)
+	{
+		t.WriteGDF(outfile, index, fps);
+	}
+
+	void Close() throw(runtime_error)
+	{
+		outfile.Close();
+	}
+
+private:
+	GDFWriter outfile;
+	double fps;
+};
+
+TrackOutput* TrackOutput::Create(const string& format, const string& filename, double fps,
+                                 const string& precision, int framing) throw(runtime_error, invalid_argument)
+{
+	size_t colon = format.find(':');
+	string name = format.substr(0, colon);
+	string options = (colon == string::npos) ? string() : format.substr(colon + 1);
+	if (name == "gdf") {
+		return new GDFTrackOutput(filename, fps, precision, framing);
+	} else if (name == "compact") {
+		return new CompactTrackWriter(filename, fps, options);
+	} else if (name == "columnar") {
+		return new TrackStoreWriter(filename, fps, options);
+	}
+	throw invalid_argument("Unknown track output format \"" + name + "\" (use gdf, compact or columnar)");
+}
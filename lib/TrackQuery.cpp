@@ -0,0 +1,375 @@
+/*
+ *  TrackQuery.cpp
+ *
+ *  Implementation of the space-time track queries.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <TrackQuery.h>
+
+using namespace std;
+
+QueryBox::QueryBox()
+{
+	for (int d = 0; d < NDIMS; ++d) {
+		lo[d] = -numeric_limits<double>::infinity();
+		hi[d] = numeric_limits<double>::infinity();
+	}
+}
+
+QueryBox QueryBox::Empty()
+{
+	QueryBox b;
+	for (int d = 0; d < NDIMS; ++d) {
+		swap(b.lo[d], b.hi[d]);
+	}
+	return b;
+}
+
+void QueryBox::Add(const double* p)
+{
+	for (int d = 0; d < NDIMS; ++d) {
+		lo[d] = min(lo[d], p[d]);
+		hi[d] = max(hi[d], p[d]);
+	}
+}
+
+void QueryBox::Add(const QueryBox& b)
+{
+	for (int d = 0; d < NDIMS; ++d) {
+		lo[d] = min(lo[d], b.lo[d]);
+		hi[d] = max(hi[d], b.hi[d]);
+	}
+}
+
+void QueryBox::Parse(const string& s) throw(invalid_argument)
+{
+	static const char names[] = "xyzt";
+	size_t colon = s.find(':');
+	if (s.size() < 2 || s[1] != '=' || colon == string::npos) {
+		throw invalid_argument("Bad query range \"" + s + "\" (use x=lo:hi, y=, z= or t=)");
+	}
+	const char* d = strchr(names, s[0]);
+	if (d == NULL || *d == '\0') {
+		throw invalid_argument("Bad query dimension in \"" + s + "\" (use x, y, z or t)");
+	}
+	string a = s.substr(2, colon - 2);
+	string b = s.substr(colon + 1);
+	if (!a.empty()) {
+		lo[d - names] = atof(a.c_str());
+	}
+	if (!b.empty()) {
+		hi[d - names] = atof(b.c_str());
+	}
+}
+
+// finds the bounding box of each track it is given
+class BoundsVisitor : public TrackVisitor {
+public:
+	BoundsVisitor(const Trackfile& f, vector<QueryBox>& b) : file(f), boxes(b) {}
+
+	void Visit(int thread, int track, const TrackView& t)
+	{
+		GDFColumn c[QueryBox::NDIMS] = {
+			t.Column(file.XColumn()), t.Column(file.YColumn()),
+			t.Column(file.ZColumn()), t.Column(file.TimeColumn())
+		};
+		QueryBox b = QueryBox::Empty();
+		for (int i = 0; i < t.Length(); ++i) {
+			double p[QueryBox::NDIMS] = { c[0][i], c[1][i], c[2][i], c[3][i] };
+			b.Add(p);
+		}
+		boxes[track] = b;
+	}
+
+private:
+	const Trackfile& file;
+	vector<QueryBox>& boxes;
+};
+
+// orders tracks by the centre of their boxes along one dimension
+class CentreLess {
+public:
+	CentreLess(const vector<QueryBox>& b, int dim) : boxes(b), d(dim) {}
+
+	bool operator()(int a, int b) const
+	{
+		return boxes[a].lo[d] + boxes[a].hi[d] < boxes[b].lo[d] + boxes[b].hi[d];
+	}
+
+private:
+	const vector<QueryBox>& boxes;
+	int d;
+};
+
+// sidecar layout: magic, version, file size, modification time, the tracks
+// (see Trackfile::WriteTracks), then the boxes, the nodes and the order, each
+// after its count
+static const int TQXMAGIC = 82995;
+static const int TQXVERSION = 1;
+
+TrackQuery::TrackQuery(const Trackfile& f, int nthreads)
+: file(f), loaded(false)
+{
+	Index(nthreads);
+}
+
+TrackQuery::TrackQuery(Trackfile& f, const string& sidecar, int nthreads)
+: file(f), loaded(false)
+{
+	if (Load(f, sidecar)) {
+		loaded = true;
+		return;
+	}
+	f.FindTracks();
+	Index(nthreads);
+	if (!Save(sidecar)) {
+		cerr << "\tCould not write track query index " << sidecar << endl;
+	}
+}
+
+void TrackQuery::Index(int nthreads)
+{
+	boxes.assign(file.NumTracks(), QueryBox());
+	BoundsVisitor v(file, boxes);
+	file.ForEachTrack(v, nthreads);
+
+	order.resize(boxes.size());
+	for (unsigned int i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	if (!order.empty()) {
+		nodes.reserve(2 * order.size() / LEAFSIZE + 1);
+		Build(0, order.size());
+	}
+}
+
+static void WriteBox(ostream& out, const QueryBox& b)
+{
+	out.write(reinterpret_cast<const char*>(b.lo), sizeof(b.lo));
+	out.write(reinterpret_cast<const char*>(b.hi), sizeof(b.hi));
+}
+
+static void ReadBox(istream& in, QueryBox& b)
+{
+	in.read(reinterpret_cast<char*>(b.lo), sizeof(b.lo));
+	in.read(reinterpret_cast<char*>(b.hi), sizeof(b.hi));
+}
+
+bool TrackQuery::Save(const string& name) const
+{
+	ofstream outfile(name.c_str(), ios::out | ios::binary);
+	if (!outfile.is_open()) {
+		return false;
+	}
+	int tmpi = TQXMAGIC;
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	tmpi = TQXVERSION;
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	long long size = file.Size();
+	outfile.write(reinterpret_cast<const char*>(&size), 8);
+	long long mtime = file.ModTime();
+	outfile.write(reinterpret_cast<const char*>(&mtime), 8);
+	file.WriteTracks(outfile);
+
+	tmpi = boxes.size();
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	for (unsigned int i = 0; i < boxes.size(); ++i) {
+		WriteBox(outfile, boxes[i]);
+	}
+	tmpi = nodes.size();
+	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	for (unsigned int i = 0; i < nodes.size(); ++i) {
+		WriteBox(outfile, nodes[i].box);
+		outfile.write(reinterpret_cast<const char*>(&nodes[i].left), 4);
+		outfile.write(reinterpret_cast<const char*>(&nodes[i].right), 4);
+		outfile.write(reinterpret_cast<const char*>(&nodes[i].first), 4);
+		outfile.write(reinterpret_cast<const char*>(&nodes[i].count), 4);
+	}
+	if (!order.empty()) {
+		outfile.write(reinterpret_cast<const char*>(&order[0]), 4 * order.size());
+	}
+	return outfile.good();
+}
+
+bool TrackQuery::Load(Trackfile& f, const string& name)
+{
+	ifstream infile(name.c_str(), ios::in | ios::binary);
+	if (!infile.is_open()) {
+		return false;
+	}
+	int magic, version;
+	long long size, mtime;
+	infile.read(reinterpret_cast<char*>(&magic), 4);
+	infile.read(reinterpret_cast<char*>(&version), 4);
+	infile.read(reinterpret_cast<char*>(&size), 8);
+	infile.read(reinterpret_cast<char*>(&mtime), 8);
+	if (!infile.good() || magic != TQXMAGIC || version != TQXVERSION || size != f.Size() || mtime != f.ModTime()) {
+		// not ours, or the track file has changed since
+		return false;
+	}
+	if (!f.ReadTracks(infile)) {
+		return false;
+	}
+
+	// one box per track, and the nodes and order must fit them
+	int nboxes, nnodes;
+	infile.read(reinterpret_cast<char*>(&nboxes), 4);
+	if (!infile.good() || nboxes != f.NumTracks()) {
+		return false;
+	}
+	vector<QueryBox> b(nboxes);
+	for (int i = 0; i < nboxes; ++i) {
+		ReadBox(infile, b[i]);
+	}
+	infile.read(reinterpret_cast<char*>(&nnodes), 4);
+	if (!infile.good() || nnodes < 0 || nnodes > 2 * nboxes + 1 || (nnodes == 0) != (nboxes == 0)) {
+		return false;
+	}
+	vector<Node> n(nnodes);
+	for (int i = 0; i < nnodes; ++i) {
+		ReadBox(infile, n[i].box);
+		infile.read(reinterpret_cast<char*>(&n[i].left), 4);
+		infile.read(reinterpret_cast<char*>(&n[i].right), 4);
+		infile.read(reinterpret_cast<char*>(&n[i].first), 4);
+		infile.read(reinterpret_cast<char*>(&n[i].count), 4);
+	}
+	vector<int> o(nboxes);
+	if (nboxes > 0) {
+		infile.read(reinterpret_cast<char*>(&o[0]), 4 * nboxes);
+	}
+	if (!infile.good()) {
+		return false;
+	}
+	// a node is a leaf (no children) or has two children made after it, so
+	// that a search always ends
+	for (int i = 0; i < nnodes; ++i) {
+		bool leaf = (n[i].left == -1 && n[i].right == -1);
+		bool inner = (n[i].left > i && n[i].left < nnodes && n[i].right > i && n[i].right < nnodes);
+		if ((!leaf && !inner) || n[i].first < 0 || n[i].first > nboxes || n[i].count < 0
+		    || n[i].count > nboxes - n[i].first) {
+			return false;
+		}
+	}
+	for (int i = 0; i < nboxes; ++i) {
+		if (o[i] < 0 || o[i] >= nboxes) {
+			return false;
+		}
+	}
+	boxes.swap(b);
+	nodes.swap(n);
+	order.swap(o);
+	return true;
+}
+
+int TrackQuery::Build(int begin, int end)
+{
+	int n = nodes.size();
+	nodes.push_back(Node());
+	QueryBox box = QueryBox::Empty();
+	QueryBox centres = QueryBox::Empty();
+	for (int i = begin; i < end; ++i) {
+		const QueryBox& b = boxes[order[i]];
+		box.Add(b);
+		double c[QueryBox::NDIMS];
+		for (int d = 0; d < QueryBox::NDIMS; ++d) {
+			c[d] = 0.5 * (b.lo[d] + b.hi[d]);
+		}
+		centres.Add(c);
+	}
+	nodes[n].box = box;
+	nodes[n].first = begin;
+	nodes[n].count = end - begin;
+	nodes[n].left = -1;
+	nodes[n].right = -1;
+	if (end - begin <= LEAFSIZE) {
+		return n;
+	}
+
+	// split at the median along the dimension the centres spread over most,
+	// relative to the size of the whole box in that dimension
+	int dim = 0;
+	double spread = -1;
+	for (int d = 0; d < QueryBox::NDIMS; ++d) {
+		double size = box.hi[d] - box.lo[d];
+		double s = (size > 0) ? (centres.hi[d] - centres.lo[d]) / size : 0;
+		if (s > spread) {
+			spread = s;
+			dim = d;
+		}
+	}
+	int mid = begin + (end - begin) / 2;
+	nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, CentreLess(boxes, dim));
+	int left = Build(begin, mid);
+	int right = Build(mid, end);
+	nodes[n].left = left;
+	nodes[n].right = right;
+	return n;
+}
+
+void TrackQuery::Candidates(const QueryBox& q, vector<int>& tracks) const
+{
+	tracks.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	vector<int> stack(1, 0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!q.Overlaps(node.box)) {
+			continue;
+		}
+		if (node.left < 0) {
+			for (int i = node.first; i < node.first + node.count; ++i) {
+				if (q.Overlaps(boxes[order[i]])) {
+					tracks.push_back(order[i]);
+				}
+			}
+		} else {
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+		}
+	}
+	sort(tracks.begin(), tracks.end());
+}
+
+void TrackQuery::Find(const QueryBox& q, vector<TrackSlice>& slices) const
+{
+	slices.clear();
+	vector<int> tracks;
+	Candidates(q, tracks);
+	for (unsigned int k = 0; k < tracks.size(); ++k) {
+		TrackView t = file.GetTrack(tracks[k]);
+		GDFColumn c[QueryBox::NDIMS] = {
+			t.Column(file.XColumn()), t.Column(file.YColumn()),
+			t.Column(file.ZColumn()), t.Column(file.TimeColumn())
+		};
+		TrackSlice s;
+		s.track = tracks[k];
+		s.id = t.Id();
+		s.begin = -1;
+		for (int i = 0; i < t.Length(); ++i) {
+			double p[QueryBox::NDIMS] = { c[0][i], c[1][i], c[2][i], c[3][i] };
+			bool inside = q.Contains(p);
+			if (inside && s.begin < 0) {
+				s.begin = i;
+			} else if (!inside && s.begin >= 0) {
+				s.end = i;
+				slices.push_back(s);
+				s.begin = -1;
+			}
+		}
+		if (s.begin >= 0) {
+			s.end = t.Length();
+			slices.push_back(s);
+		}
+	}
+}
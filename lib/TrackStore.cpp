@@ -0,0 +1,445 @@
+/*
+ *  TrackStore.cpp
+ *
+ *  Implementation of the columnar track store.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <TrackStore.h>
+
+using namespace std;
+
+TrackStoreWriter::TrackStoreWriter(const string& name, double ifps, const string& options)
+throw(runtime_error, invalid_argument)
+: fd(-1), filename(name), fps(ifps), chunkrows(DEFAULT_CHUNKROWS), used(0), nrows(0), written(0)
+{
+	if (!options.empty()) {
+		if (options.compare(0, 5, "rows=") != 0 || atoi(options.c_str() + 5) <= 0) {
+			throw invalid_argument("Bad track store option \"" + options + "\" (use rows=N)");
+		}
+		chunkrows = atoi(options.c_str() + 5);
+	}
+	names = Track::GDFColumns();
+	chunk.assign(names.size(), vector<double>(chunkrows));
+
+	if (filename == "-") {
+		// our own descriptor for stdout, so that Close() can close it
+		fd = dup(STDOUT_FILENO);
+	} else {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (fd < 0) {
+		throw runtime_error("Could not open track store " + filename + ": " + strerror(errno));
+	}
+	int tmpi = MAGIC;
+	Put(&tmpi, 4);
+	tmpi = VERSION;
+	Put(&tmpi, 4);
+	Put(&fps, 8);
+	tmpi = names.size();
+	Put(&tmpi, 4);
+	Put(&chunkrows, 4);
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		tmpi = names[i].size();
+		Put(&tmpi, 4);
+		Put(names[i].data(), names[i].size());
+	}
+}
+
+TrackStoreWriter::~TrackStoreWriter()
+{
+	try {
+		Close();
+	} catch (runtime_error&) {
+		// nothing sensible to do about it here
+	}
+}
+
+void TrackStoreWriter::Put(const void* p, size_t n) throw(runtime_error)
+{
+	const char* c = static_cast<const char*>(p);
+	pending.insert(pending.end(), c, c + n);
+	written += n;
+	if (pending.size() >= BUFFERSIZE) {
+		WriteOut();
+	}
+}
+
+void TrackStoreWriter::WriteOut() throw(runtime_error)
+{
+	const char* data = pending.empty() ? NULL : &pending[0];
+	size_t len = pending.size();
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			throw runtime_error("Could not write to track store " + filename + ": " + strerror(errno));
+		}
+		data += n;
+		len -= n;
+	}
+	pending.clear();
+}
+
+void TrackStoreWriter::Write(const Track& t, double index) throw(runtime_error)
+{
+	int len = t.Length();
+	TrackInfo info;
+	info.id = static_cast<long long>(index);
+	info.first = nrows;
+	info.rows = len;
+	tracks.push_back(info);
+
+	int ncols = names.size();
+	double row[Track::GDFCOLUMNS];
+	for (int i = 0; i < len; ++i) {
+		t.GDFRow(i, index, fps, row);
+		for (int c = 0; c < ncols; ++c) {
+			chunk[c][used] = row[c];
+		}
+		// widen the row range of this point's frame
+		map<int, pair<long long, long long> >::iterator f = frames.find(t.GetTime(i));
+		if (f == frames.end()) {
+			frames[t.GetTime(i)] = make_pair(nrows, nrows + 1);
+		} else {
+			f->second.first = min(f->second.first, nrows);
+			f->second.second = max(f->second.second, nrows + 1);
+		}
+		++nrows;
+		if (++used == chunkrows) {
+			Flush();
+		}
+	}
+}
+
+void TrackStoreWriter::Flush() throw(runtime_error)
+{
+	if (used == 0) {
+		return;
+	}
+	ChunkInfo info;
+	info.rows = used;
+	for (unsigned int c = 0; c < chunk.size(); ++c) {
+		const vector<double>& v = chunk[c];
+		double lo = v[0];
+		double hi = v[0];
+		for (int i = 1; i < used; ++i) {
+			if (v[i] < lo) {
+				lo = v[i];
+			}
+			if (v[i] > hi) {
+				hi = v[i];
+			}
+		}
+		info.offsets.push_back(written);
+		info.mins.push_back(lo);
+		info.maxs.push_back(hi);
+		Put(&v[0], used * sizeof(double));
+	}
+	chunks.push_back(info);
+	used = 0;
+}
+
+void TrackStoreWriter::Close() throw(runtime_error)
+{
+	if (fd < 0) {
+		return;
+	}
+	Flush();
+
+	long long footer = written;
+	long long n = chunks.size();
+	Put(&n, 8);
+	for (unsigned int i = 0; i < chunks.size(); ++i) {
+		Put(&chunks[i].rows, 4);
+		for (unsigned int c = 0; c < names.size(); ++c) {
+			Put(&chunks[i].offsets[c], 8);
+			Put(&chunks[i].mins[c], 8);
+			Put(&chunks[i].maxs[c], 8);
+		}
+	}
+	n = tracks.size();
+	Put(&n, 8);
+	for (unsigned int i = 0; i < tracks.size(); ++i) {
+		Put(&tracks[i].id, 8);
+		Put(&tracks[i].first, 8);
+		Put(&tracks[i].rows, 4);
+	}
+	n = frames.size();
+	Put(&n, 8);
+	for (map<int, pair<long long, long long> >::const_iterator f = frames.begin(); f != frames.end(); ++f) {
+		Put(&f->first, 4);
+		Put(&f->second.first, 8);
+		Put(&f->second.second, 8);
+	}
+	Put(&footer, 8);
+	int tmpi = MAGIC;
+	Put(&tmpi, 4);
+
+	WriteOut();
+	int result = close(fd);
+	fd = -1;
+	if (result != 0) {
+		throw runtime_error("Could not close track store " + filename + ": " + strerror(errno));
+	}
+}
+
+TrackStoreReader::TrackStoreReader(const string& name) throw(runtime_error)
+: filename(name), fps(1), chunkrows(0), nrows(0), filesize(0), columnsread(0)
+{
+	infile.open(filename.c_str(), ios::in | ios::binary);
+	if (!infile.is_open()) {
+		throw runtime_error("Could not open track store " + filename);
+	}
+	int magic, version, ncols;
+	Get(&magic, 4);
+	Get(&version, 4);
+	if (magic != TrackStoreWriter::MAGIC) {
+		throw runtime_error("Not a track store: " + filename);
+	}
+	if (version != TrackStoreWriter::VERSION) {
+		throw runtime_error("Unsupported track store version: " + filename);
+	}
+	Get(&fps, 8);
+	Get(&ncols, 4);
+	Get(&chunkrows, 4);
+	if (ncols <= 0 || ncols > 1024 || chunkrows <= 0) {
+		throw runtime_error("Corrupt header in track store " + filename);
+	}
+	for (int i = 0; i < ncols; ++i) {
+		int len;
+		Get(&len, 4);
+		if (len < 0 || len > 1024) {
+			throw runtime_error("Corrupt header in track store " + filename);
+		}
+		string n(len, ' ');
+		if (len > 0) {
+			Get(&n[0], len);
+		}
+		names.push_back(n);
+	}
+
+	// the footer, found from the end of the file
+	long long header = infile.tellg();
+	long long footer;
+	infile.seekg(0, ios::end);
+	filesize = infile.tellg();
+	if (filesize < header + 12) {
+		throw runtime_error("Track store has no footer (was it finished?): " + filename);
+	}
+	infile.seekg(-12, ios::end);
+	Get(&footer, 8);
+	Get(&magic, 4);
+	if (magic != TrackStoreWriter::MAGIC) {
+		throw runtime_error("Track store has no footer (was it finished?): " + filename);
+	}
+	if (footer < header || footer > filesize - 12) {
+		throw runtime_error("Corrupt footer in track store " + filename);
+	}
+	infile.seekg(footer, ios::beg);
+	// every chunk but the last is full, and its columns lie before the footer
+	long long n = Count(4 + 24LL * ncols);
+	chunks.resize(n);
+	for (long long i = 0; i < n; ++i) {
+		ChunkInfo& c = chunks[i];
+		Get(&c.rows, 4);
+		if (c.rows <= 0 || c.rows > chunkrows || (c.rows < chunkrows && i < n - 1)) {
+			throw runtime_error("Corrupt footer in track store " + filename);
+		}
+		c.start = nrows;
+		nrows += c.rows;
+		c.offsets.resize(ncols);
+		c.mins.resize(ncols);
+		c.maxs.resize(ncols);
+		for (int j = 0; j < ncols; ++j) {
+			Get(&c.offsets[j], 8);
+			Get(&c.mins[j], 8);
+			Get(&c.maxs[j], 8);
+			if (c.offsets[j] < header || c.offsets[j] > footer - 8LL * c.rows) {
+				throw runtime_error("Corrupt footer in track store " + filename);
+			}
+		}
+	}
+	// and the tracks and frames lie within the rows
+	n = Count(20);
+	tracks.resize(n);
+	for (long long i = 0; i < n; ++i) {
+		Get(&tracks[i].id, 8);
+		Get(&tracks[i].first, 8);
+		Get(&tracks[i].rows, 4);
+		if (tracks[i].first < 0 || tracks[i].rows <= 0 || tracks[i].rows > nrows - tracks[i].first) {
+			throw runtime_error("Corrupt footer in track store " + filename);
+		}
+	}
+	n = Count(20);
+	frames.resize(n);
+	for (long long i = 0; i < n; ++i) {
+		Get(&frames[i].frame, 4);
+		Get(&frames[i].first, 8);
+		Get(&frames[i].end, 8);
+		if (frames[i].first < 0 || frames[i].end <= frames[i].first || frames[i].end > nrows
+		    || (i > 0 && frames[i].frame <= frames[i - 1].frame)) {
+			throw runtime_error("Corrupt footer in track store " + filename);
+		}
+	}
+	// the tracks come in the order they ended, not by id
+	for (unsigned int i = 1; i < tracks.size(); ++i) {
+		if (tracks[i].id < tracks[i - 1].id) {
+			sort(tracks.begin(), tracks.end(), TrackOrder);
+			break;
+		}
+	}
+}
+
+void TrackStoreReader::Get(void* p, size_t n) throw(runtime_error)
+{
+	infile.read(static_cast<char*>(p), n);
+	if (infile.gcount() != static_cast<streamsize>(n)) {
+		throw runtime_error("Track store ends early: " + filename);
+	}
+}
+
+long long TrackStoreReader::Count(long long recordbytes) throw(runtime_error)
+{
+	long long n;
+	Get(&n, 8);
+	long long left = filesize - static_cast<long long>(infile.tellg());
+	if (n < 0 || n > left / recordbytes) {
+		throw runtime_error("Corrupt footer in track store " + filename);
+	}
+	return n;
+}
+
+bool TrackStoreReader::TrackLess(const TrackInfo& t, long long id)
+{
+	return t.id < id;
+}
+
+bool TrackStoreReader::TrackOrder(const TrackInfo& a, const TrackInfo& b)
+{
+	return a.id < b.id;
+}
+
+bool TrackStoreReader::FrameLess(const FrameInfo& f, int frame)
+{
+	return f.frame < frame;
+}
+
+int TrackStoreReader::Column(const string& name) const
+{
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		if (names[i] == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void TrackStoreReader::ReadColumn(int chunk, int col, vector<double>& values) throw(runtime_error)
+{
+	values.resize(chunks[chunk].rows);
+	++columnsread;
+	infile.clear();
+	infile.seekg(chunks[chunk].offsets[col], ios::beg);
+	if (!values.empty()) {
+		Get(&values[0], values.size() * sizeof(double));
+	}
+}
+
+bool TrackStoreReader::FindTrack(long long id, long long& first, int& rows) const
+{
+	vector<TrackInfo>::const_iterator t = lower_bound(tracks.begin(), tracks.end(), id, TrackLess);
+	if (t == tracks.end() || t->id != id) {
+		return false;
+	}
+	first = t->first;
+	rows = t->rows;
+	return true;
+}
+
+bool TrackStoreReader::ReadTrack(long long id, const vector<int>& cols, vector< vector<double> >& values)
+throw(runtime_error)
+{
+	long long first;
+	int rows;
+	if (!FindTrack(id, first, rows)) {
+		return false;
+	}
+	values.assign(cols.size(), vector<double>());
+	// the chunks the track runs through
+	int c0 = first / chunkrows;
+	int c1 = (first + rows - 1) / chunkrows;
+	for (int c = c0; c <= c1 && c < NumChunks(); ++c) {
+		long long lo = max(first, chunks[c].start) - chunks[c].start;
+		long long hi = min(first + rows, chunks[c].start + chunks[c].rows) - chunks[c].start;
+		for (unsigned int k = 0; k < cols.size(); ++k) {
+			ReadColumn(c, cols[k], scratch);
+			values[k].insert(values[k].end(), scratch.begin() + lo, scratch.begin() + hi);
+		}
+	}
+	return true;
+}
+
+bool TrackStoreReader::FindFrame(int frame, long long& first, long long& end) const
+{
+	vector<FrameInfo>::const_iterator f = lower_bound(frames.begin(), frames.end(), frame, FrameLess);
+	if (f == frames.end() || f->frame != frame) {
+		return false;
+	}
+	first = f->first;
+	end = f->end;
+	return true;
+}
+
+bool TrackStoreReader::ReadFrame(int frame, const vector<int>& cols, vector< vector<double> >& values)
+throw(runtime_error)
+{
+	long long first, end;
+	values.assign(cols.size(), vector<double>());
+	if (!FindFrame(frame, first, end)) {
+		return false;
+	}
+	int tcol = Column("time");
+	if (tcol < 0) {
+		throw runtime_error("Track store has no time column: " + filename);
+	}
+	// the time the Tracker wrote for this frame
+	double t = static_cast<double>(frame) / fps;
+
+	vector<double> times;
+	int c0 = first / chunkrows;
+	int c1 = (end - 1) / chunkrows;
+	for (int c = c0; c <= c1 && c < NumChunks(); ++c) {
+		if (!ChunkOverlaps(c, tcol, t, t)) {
+			continue;
+		}
+		long long lo = max(first, chunks[c].start) - chunks[c].start;
+		long long hi = min(end, chunks[c].start + chunks[c].rows) - chunks[c].start;
+		ReadColumn(c, tcol, times);
+		vector<int> rows;
+		for (long long i = lo; i < hi; ++i) {
+			if (times[i] == t) {
+				rows.push_back(i);
+			}
+		}
+		if (rows.empty()) {
+			continue;
+		}
+		for (unsigned int k = 0; k < cols.size(); ++k) {
+			ReadColumn(c, cols[k], scratch);
+			for (unsigned int i = 0; i < rows.size(); ++i) {
+				values[k].push_back(scratch[rows[i]]);
+			}
+		}
+	}
+	return true;
+}
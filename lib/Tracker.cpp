@@ -39,29 +39,14 @@
 
 using namespace std;
 
-Tracker::Tracker(TrackMode m, double md, int mem, double ifps, string name /* = "track" */)
+Tracker::Tracker(TrackMode m, double md, int mem, double ifps, string name /* = "track" */,
+                 string precision /* = "double" */, int framing /* = GDFWriter::AUTO */,
+                 string format /* = "gdf" */)
 : too_short(0), ntracks(0), ntotalpoints(0), mode(m), outname(name),
 max_disp(md), memory(mem), fps(ifps)
 {
-	// open the output file with a temporary header
-	outfile.open(outname.c_str(), ios::out | ios::binary);
-	int magic = 82991;
-	outfile.write(reinterpret_cast<const char*>(&magic), 4);
-	// number of dimensions
-  int tmpi = 2;
-  outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-  // number of columns
-  tmpi = 19;
-  outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-  // number of rows: we don't know this yet!
-  tmpi = 0;
-  outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-  // a 4 means floating point numbers
-  tmpi = 5;
-  outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
-  // number of total points: we don't know this yet!
-  tmpi = 0;
-  outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	// open the output file; the header is finished when it is closed
+	outfile = TrackOutput::Create(format, outname, fps, precision, framing);
 }
 
 void Tracker::MakeTracks(vector<Frame>& f)
@@ -171,19 +156,15 @@ void Tracker::MakeTracks(vector<Frame>& f)
 	for (deque<int>::const_iterator tr = activelist.begin(); tr != tr_end; ++tr) {
 		Track* t = tracks.find(*tr)->second;
 		if (t->Length() >= MINTRACK) {
-		  t->WriteGDF(outfile, ntracks, fps);
+		  outfile->Write(*t, ntracks);
 		  ++ntracks;
 		  ntotalpoints += t->Length();
 		}
 		// free memory
 		delete t;
 	}
-	// now fix up the header with the proper sizes
-	outfile.seekp(12, ios::beg);
-	outfile.write(reinterpret_cast<const char*>(&ntotalpoints), 4);
-	outfile.seekp(4, ios::cur);
-	int tmpi = 19 * ntotalpoints;
-	outfile.write(reinterpret_cast<const char*>(&tmpi), 4);
+	// write out the last rows and fix up the header with the proper sizes
+	outfile->Close();
   
 #ifdef TIME
   struct timeval t2;
@@ -233,18 +214,20 @@ void Tracker::PadTracks(deque<int>& activelist, int framenum)
       }
 			
       // don't bother with the times in our estimate -- they'll cancel out.
-			const Position last = t->Last();
-			const Position penultimate = t->Penultimate();
-			const Position antepenultimate = t->Antepenultimate();
+			const Vec3 last(t->Last());
+			const Vec3 penultimate(t->Penultimate());
+			const Vec3 antepenultimate(t->Antepenultimate());
 			
-			Position velocity = last - penultimate;
-			Position acceleration = 0.5 * (last - 2.0 * penultimate + antepenultimate);
-			Position estimate = last + velocity + 0.5 * acceleration;
-			if (Distance(estimate, last) > (max_disp * max_disp)) {
-				estimate = last;
+			Vec3 velocity = last - penultimate;
+			Vec3 acceleration = 0.5 * (last - 2.0 * penultimate + antepenultimate);
+			Vec3 predicted = last + velocity + 0.5 * acceleration;
+			if (Distance(predicted, last) > (max_disp * max_disp)) {
+				predicted = last;
 			}
 			
-      // keep track of the fact that this position is an estimate
+      // keep track of the fact that this position is an estimate; it was
+      // seen on no camera
+      Position estimate(predicted.x, predicted.y, predicted.z, 0);
       estimate.SetFake();
       t->Add(estimate, framenum);
 			
@@ -259,7 +242,7 @@ void Tracker::PadTracks(deque<int>& activelist, int framenum)
 	list<int>::const_iterator tr_end = writelist.end();
 	for (list<int>::const_iterator tr = writelist.begin(); tr != tr_end; ++tr) {
 		Track* t = tracks.find(*tr)->second;
-		t->WriteGDF(outfile, ntracks, fps);
+		outfile->Write(*t, ntracks);
 		++ntracks;
 		ntotalpoints += t->Length();
 		// free memory
@@ -280,13 +263,13 @@ void Tracker::MakeLinks(const deque<int>& activelist, Frame& fr1, Frame& fr2,
     // the current track
 		Track* t = tracks.find(*tr)->second;
     // the current position
-    Position now = t->Last();
+    Vec3 now(t->Last());
 		
 		int len = t->Length();
 		
     // we'll need a velocity and an estimated future position
-    Position velocity;
-    Position estimate;
+    Vec3 velocity;
+    Vec3 estimate;
     
     // does the current track have more than one point? Or are we using 
     // nearest neighbor search?
@@ -294,12 +277,12 @@ void Tracker::MakeLinks(const deque<int>& activelist, Frame& fr1, Frame& fr2,
       estimate = now;
     } else {
 			// this track was at least two points long; use it to get an estimate of the velocity
-			velocity = now - t->Penultimate();
+			velocity = now - Vec3(t->Penultimate());
 			// if the track contains more than two particles, also calculate
 			// an acceleration to help with the estimate
 			if (len > 2) {
 				// this track contains multiple particles
-				Position acceleration = now - 2.0 * t->Penultimate() + t->Antepenultimate();
+				Vec3 acceleration = now - 2.0 * Vec3(t->Penultimate()) + Vec3(t->Antepenultimate());
 				estimate = now + velocity + 0.5 * acceleration;
 			} else {
 				// this track doesn't contain multiple particles, so just use the 
@@ -326,9 +309,9 @@ void Tracker::MakeLinks(const deque<int>& activelist, Frame& fr1, Frame& fr2,
 }
 
 pair<int, float> Tracker::ComputeCost(Frame& fr1, Frame& fr2, 
-                                      const Position& estimate, 
-                                      const Position& velocity, 
-                                      const Position& now, bool stopflag)
+                                      const Vec3& estimate, 
+                                      const Vec3& velocity, 
+                                      const Vec3& now, bool stopflag)
 {
   // find possible continuations in the next frame.
   
@@ -339,7 +322,8 @@ pair<int, float> Tracker::ComputeCost(Frame& fr1, Frame& fr2,
   
 	Frame::const_iterator fitend = fr1.end();
 	for (Frame::const_iterator fit = fr1.begin(); fit != fitend; ++fit) {
-    float mag = Distance(estimate, *fit);
+    Vec3 candidate(*fit);
+    float mag = Distance(estimate, candidate);
     if (mag > max_disp * max_disp) {
       continue;
     }
@@ -352,10 +336,10 @@ pair<int, float> Tracker::ComputeCost(Frame& fr1, Frame& fr2,
       }
     } else {
       // project again!
-      Position new_velocity = *fit - now;
-			Position acceleration = new_velocity - velocity;
-			Position new_estimate = *fit + new_velocity + 0.5 * acceleration;
-      pair<int, float> cost = ComputeCost(fr2, fr2, new_estimate, new_velocity, *fit, true);
+      Vec3 new_velocity = candidate - now;
+			Vec3 acceleration = new_velocity - velocity;
+			Vec3 new_estimate = candidate + new_velocity + 0.5 * acceleration;
+      pair<int, float> cost = ComputeCost(fr2, fr2, new_estimate, new_velocity, candidate, true);
       match_costs.push_back(cost.second);
       if (mincost > cost.second) {
         mincost = cost.second;
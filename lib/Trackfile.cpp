@@ -1,6 +1,6 @@
 /*
  *  Trackfile.cpp
- *  
+ *
  *
  *  Created by Nicholas Ouellette on 7/28/08.
  *  Copyright 2008 __MyCompanyName__. All rights reserved.
@@ -16,127 +16,290 @@
  */
 
 #include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <Trackfile.h>
+#include <Track.h>
+#include <GDFWriter.h>
 
 using namespace std;
 
-Trackfile::Trackfile(string filename) throw(invalid_argument)
+Trackfile::Trackfile(string name, bool findtracks) throw(invalid_argument)
+: filename(name), mapped(NULL), mapsize(0), mtime(0), data(NULL), npoints(0), rowbytes(0), found(false), current(0)
 {
-  ntracks = -1;
-	
-  file.open(filename.c_str(), ios::in | ios::binary);
-  
-  int magic = 82991;
-  int tmpi;
-  file.read(reinterpret_cast<char*>(&tmpi), 4);
-  if (tmpi != magic) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw invalid_argument("Could not open track file " + filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 24) {
+    close(fd);
+    throw invalid_argument("Not a GDF file!");
+  }
+  mapsize = st.st_size;
+  mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  void* p = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    throw invalid_argument("Could not map track file " + filename);
+  }
+  mapped = static_cast<char*>(p);
+
+  int header[6];
+  memcpy(header, mapped, 24);
+  // header: magic, dimensions, columns, rows, type, total
+  int ncol = header[2];
+  int rows = header[3];
+  int type = header[4];
+  if (header[0] != 82991) {
+    munmap(mapped, mapsize);
     throw invalid_argument("Not a GDF file!");
   }
-  
-  int ndim;
-  file.read(reinterpret_cast<char*>(&ndim), 4);
-  
-  int ncol;
-  file.read(reinterpret_cast<char*>(&ncol), 4);
-  
-  file.read(reinterpret_cast<char*>(&npoints), 4);
-  
-  int code;
-  file.read(reinterpret_cast<char*>(&code), 4);
-  
-  int total;
-  file.read(reinterpret_cast<char*>(&total), 4);
-  
-  // read the track index of the first track
-  float cur;
-  file.read(reinterpret_cast<char*>(&cur), 4);
-  current_index = static_cast<int>(cur);
-  // reset the get pointer
-  file.seekg(-4, ios::cur);
+  if (ncol == Track::GDFCOLUMNS) {
+    cindex = 0;
+    cx = 1;
+    cy = 2;
+    cz = 3;
+    ct = 4;
+    cfake = Track::GDFCOLUMNS - 1;
+  } else if (ncol == L_FAKE + 1) {
+    cindex = L_INDEX;
+    cx = L_X;
+    cy = L_Y;
+    cz = L_Z;
+    ct = L_T;
+    cfake = L_FAKE;
+  } else {
+    munmap(mapped, mapsize);
+    throw invalid_argument("Not a track file: wrong number of columns");
+  }
+  size_t pos = 24;
+  types.assign(ncol, type);
+  if (type == GDFWriter::MIXED) {
+    if (mapsize < pos + 4 * ncol) {
+      munmap(mapped, mapsize);
+      throw invalid_argument("Not a GDF file!");
+    }
+    memcpy(&types[0], mapped + pos, 4 * ncol);
+    pos += 4 * ncol;
+  }
+  for (int i = 0; i < ncol; ++i) {
+    if (types[i] != GDFWriter::FLOAT && types[i] != GDFWriter::DOUBLE) {
+      munmap(mapped, mapsize);
+      throw invalid_argument("Unsupported GDF data type!");
+    }
+    offsets.push_back(rowbytes);
+    rowbytes += (types[i] == GDFWriter::FLOAT) ? 4 : 8;
+  }
+
+  if (rows >= 0) {
+    // one run of rows; trust the file size over the header
+    data = mapped + pos;
+    npoints = (mapsize - pos) / rowbytes;
+  } else {
+    // a streamed file: gather the rows out of the chunks, up to the
+    // end-of-data chunk or as far as the file goes
+    while (pos + 4 <= mapsize) {
+      int n;
+      memcpy(&n, mapped + pos, 4);
+      pos += 4;
+      if (n <= 0) {
+        break;
+      }
+      size_t bytes = static_cast<size_t>(n) * rowbytes;
+      if (pos + bytes > mapsize) {
+        bytes = (mapsize - pos) / rowbytes * rowbytes;
+      }
+      gathered.insert(gathered.end(), mapped + pos, mapped + pos + bytes);
+      pos += bytes;
+    }
+    npoints = gathered.size() / rowbytes;
+    data = gathered.empty() ? NULL : &gathered[0];
+  }
+  if (findtracks) {
+    FindTracks();
+  }
 }
 
-int Trackfile::NumTracks()
+Trackfile::~Trackfile()
 {
-  // have we already computed this?
-  if (ntracks != -1) {
-    return ntracks;
-  }
-  
-  // no, so compute it now
-  ntracks = 1;
-  streampos current_position = file.tellg();
-  int old_current_index = current_index;
-  
-  // loop over the whole file
-  while (!file.eof()) {
-    float index;
-		file.read(reinterpret_cast<char*>(&index), 4);
-		if (file.eof()) {
-			break;
-		}
-		if (current_index != static_cast<int>(index)) {
-			// this is a new track
-			++ntracks;
-			current_index = static_cast<int>(index);
-		}
-		// read the rest of the values for this position
-		char buffer[20];
-		file.read(buffer, 20);
-  }
-  
-  // now reset everything
-  file.clear();
-  current_index = old_current_index;
-  file.seekg(current_position);
-  
-  return ntracks;
+  if (mapped) {
+    munmap(mapped, mapsize);
+  }
+}
+
+void Trackfile::FindTracks()
+{
+  if (found) {
+    return;
+  }
+  found = true;
+  madvise(mapped, mapsize, MADV_SEQUENTIAL);
+  GDFColumn index(data + offsets[cindex], rowbytes, types[cindex], npoints);
+  for (long long i = 0; i < npoints; ++i) {
+    long long id = static_cast<long long>(index[i]);
+    if (tracks.empty() || tracks.back().id != id) {
+      // this is a new track
+      TrackEntry e;
+      e.id = id;
+      e.first = i;
+      e.length = 0;
+      tracks.push_back(e);
+    }
+    ++tracks.back().length;
+  }
+  madvise(mapped, mapsize, MADV_NORMAL);
+  SortById();
+}
+
+void Trackfile::WriteTracks(ostream& out) const
+{
+  int n = tracks.size();
+  out.write(reinterpret_cast<const char*>(&n), 4);
+  for (int i = 0; i < n; ++i) {
+    out.write(reinterpret_cast<const char*>(&tracks[i].id), 8);
+    out.write(reinterpret_cast<const char*>(&tracks[i].first), 8);
+    out.write(reinterpret_cast<const char*>(&tracks[i].length), 4);
+  }
+}
+
+bool Trackfile::ReadTracks(istream& in)
+{
+  int n;
+  in.read(reinterpret_cast<char*>(&n), 4);
+  if (!in.good() || n < 0 || n > npoints) {
+    return false;
+  }
+  // the tracks must follow each other and cover every row
+  vector<TrackEntry> loaded(n);
+  long long next = 0;
+  for (int i = 0; i < n; ++i) {
+    in.read(reinterpret_cast<char*>(&loaded[i].id), 8);
+    in.read(reinterpret_cast<char*>(&loaded[i].first), 8);
+    in.read(reinterpret_cast<char*>(&loaded[i].length), 4);
+    if (!in.good() || loaded[i].first != next || loaded[i].length <= 0) {
+      return false;
+    }
+    next += loaded[i].length;
+  }
+  if (next != npoints) {
+    return false;
+  }
+  tracks.swap(loaded);
+  found = true;
+  SortById();
+  return true;
+}
+
+void Trackfile::SortById()
+{
+  // the Tracker numbers tracks in the order it writes them, so this is
+  // normally sorted already
+  byid = tracks;
+  for (unsigned int i = 1; i < byid.size(); ++i) {
+    if (byid[i].id < byid[i - 1].id) {
+      stable_sort(byid.begin(), byid.end(), IdOrder);
+      break;
+    }
+  }
+}
+
+bool Trackfile::IdLess(const TrackEntry& e, long long id)
+{
+  return e.id < id;
+}
+
+bool Trackfile::IdOrder(const TrackEntry& a, const TrackEntry& b)
+{
+  return a.id < b.id;
+}
+
+bool Trackfile::FindTrack(long long id, TrackView& t) const
+{
+  vector<TrackEntry>::const_iterator e = lower_bound(byid.begin(), byid.end(), id, IdLess);
+  if (e == byid.end() || e->id != id) {
+    return false;
+  }
+  t = View(*e);
+  return true;
+}
+
+// one thread's share of ForEachTrack
+struct TrackRun {
+  const Trackfile* file;
+  TrackVisitor* visitor;
+  int thread;
+  int begin;
+  int end;
+};
+
+static void* VisitTracks(void* arg)
+{
+  TrackRun* run = static_cast<TrackRun*>(arg);
+  for (int i = run->begin; i < run->end; ++i) {
+    run->visitor->Visit(run->thread, i, run->file->GetTrack(i));
+  }
+  return NULL;
+}
+
+void Trackfile::ForEachTrack(TrackVisitor& v, int nthreads) const
+{
+  int n = NumTracks();
+  if (nthreads > n) {
+    nthreads = n;
+  }
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+  vector<TrackRun> runs(nthreads);
+  for (int k = 0; k < nthreads; ++k) {
+    runs[k].file = this;
+    runs[k].visitor = &v;
+    runs[k].thread = k;
+    runs[k].begin = static_cast<long long>(n) * k / nthreads;
+    runs[k].end = static_cast<long long>(n) * (k + 1) / nthreads;
+  }
+  // the first run is done on this thread
+  vector<pthread_t> threads(nthreads);
+  vector<bool> started(nthreads, false);
+  for (int k = 1; k < nthreads; ++k) {
+    started[k] = (pthread_create(&threads[k], NULL, VisitTracks, &runs[k]) == 0);
+    if (!started[k]) {
+      VisitTracks(&runs[k]);
+    }
+  }
+  VisitTracks(&runs[0]);
+  for (int k = 1; k < nthreads; ++k) {
+    if (started[k]) {
+      pthread_join(threads[k], NULL);
+    }
+  }
 }
 
 void Trackfile::SkipNextTrack()
 {
-  int index = current_index;
-  while (current_index == index) {
-    float tmpf;
-    file.read(reinterpret_cast<char*>(&tmpf), 4);
-		if (file.eof()) {
-			break;
-		}
-		index = static_cast<int>(tmpf);
-    char buffer[20];
-		file.read(buffer, 20);
-  }
-  
-  if (!file.eof()) {
-    file.seekg(-4, ios::cur);
-    current_index = static_cast<int>(index);
+  if (!eof()) {
+    ++current;
   }
 }
 
 void Trackfile::GetNextTrack(deque<float>* x, deque<float>* y, deque<float>* z, deque<float>* t, deque<float>* fake)
-{  
-  int index = current_index;
-  while (current_index == index) {
-    float tmpf;
-    file.read(reinterpret_cast<char*>(&tmpf), 4);
-		if (file.eof()) {
-			break;
-		}
-		index = static_cast<int>(tmpf);
-		
-    float buffer[5];
-		file.read(reinterpret_cast<char*>(buffer), 20);
-		x->push_back(buffer[0]);
-		y->push_back(buffer[1]);
-		z->push_back(buffer[2]);
-		t->push_back(buffer[3]);
-		fake->push_back(buffer[4]);
-  }
-  
-  float tmpf;
-  file.read(reinterpret_cast<char*>(&tmpf), 4);
-  if (!file.eof()) {
-    file.seekg(-4, ios::cur);
-    current_index = static_cast<int>(tmpf);
+{
+  if (eof()) {
+    return;
+  }
+  TrackView v = GetTrack(current++);
+  GDFColumn cols[5] = { v.Column(cx), v.Column(cy), v.Column(cz), v.Column(ct), v.Column(cfake) };
+  for (int i = 0; i < v.Length(); ++i) {
+    x->push_back(cols[0][i]);
+    y->push_back(cols[1][i]);
+    z->push_back(cols[2][i]);
+    t->push_back(cols[3][i]);
+    fake->push_back(cols[4][i]);
   }
 }
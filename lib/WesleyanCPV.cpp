@@ -21,13 +21,15 @@
 #include <iostream>
 #include <cmath>
 #include <string.h>
+#include <sstream>
 
 #include <WesleyanCPV.h>
+#include <PixelTraits.h>
 
 using namespace std;
 
-WesleyanCPV::WesleyanCPV(const string& name, int start, int end) throw(runtime_error, out_of_range)
-: filename(name)
+WesleyanCPV::WesleyanCPV(const string& name, int start, int end, IOBackend* io) throw(runtime_error, out_of_range)
+: filename(name), file(name, io), region(NULL)
 {
 	try {
 		Open();
@@ -69,11 +71,20 @@ WesleyanCPV::WesleyanCPV(const string& name, int start, int end) throw(runtime_e
 
 WesleyanCPV::~WesleyanCPV()
 {
-  file.close();
-  delete []buffer;
 }
 
-int WesleyanCPV::DecodeNextFrame(int** pixels, int frame) throw(runtime_error, out_of_range)
+void WesleyanCPV::SetRegion(const RegionOfInterest* roi) throw(runtime_error)
+{
+	if (roi != NULL && !roi->Whole() && (roi->Rows() != rows || roi->Cols() != cols)) {
+		stringstream msg;
+		msg << "The region of interest is " << roi->Cols() << "x" << roi->Rows()
+		    << ", but the frames of " << filename << " are " << cols << "x" << rows;
+		throw runtime_error(msg.str());
+	}
+	region = (roi != NULL && !roi->Whole()) ? roi : NULL;
+}
+
+int WesleyanCPV::DecodeNextFrame(Image8& pixels, int frame) throw(runtime_error, out_of_range)
 {	
 	
 	while(!waiting_to_be_written) {
@@ -96,15 +107,11 @@ int WesleyanCPV::DecodeNextFrame(int** pixels, int frame) throw(runtime_error, o
 			file.read(reinterpret_cast<char*>(&currentFrameNum), 4);
 			file.read(reinterpret_cast<char*>(&Buffer), 4);
 			numPixels=((unsigned char)Buffer[3]<<14)+((unsigned char)Buffer[2]<<6)+((unsigned char)Buffer[1]>>2);
-			for (int i = 0; i < numPixels; i++) {	
-				file.read(reinterpret_cast<char*>(&Buffer), 4);
-				buffer[cols*(((unsigned char)Buffer[2]>>3)+(((unsigned char)Buffer[3])<<5))+((unsigned char)Buffer[1]+(((unsigned char)Buffer[2]&07)<<8))]=(unsigned char)Buffer[0];
-			}
-			for (int i = 0; i < rows; ++i) {
-				for (int j = 0; j < cols; ++j) {
-					pixels[i][j] = static_cast<int>(buffer[cols * i + j]);
-					memset(&buffer[cols * i + j], 0, sizeof(unsigned char));
-				}
+			// fetch all of this frame's pixel records with a single read; they
+			// are written into an image only once the frame is asked for
+			records.resize(4 * numPixels);
+			if (numPixels > 0) {
+				file.read(reinterpret_cast<char*>(&records[0]), 4 * numPixels);
 			}
 			waiting_to_be_written = 1;
 			prevFrameNum = currentFrameNum;
@@ -119,6 +126,7 @@ int WesleyanCPV::DecodeNextFrame(int** pixels, int frame) throw(runtime_error, o
 		}
 	}
 	if(currentFrameNum == frame) {
+		Scatter(pixels);
 		missedFrame = 0;
 		waiting_to_be_written = 0;
 	}
@@ -129,13 +137,38 @@ int WesleyanCPV::DecodeNextFrame(int** pixels, int frame) throw(runtime_error, o
 	return (missedFrame);
 }
 
+void WesleyanCPV::Scatter(Image8& pixels) throw(out_of_range)
+{
+	// the records only list the lit pixels: everything else is dark
+	pixels.Clear();
+	lit.clear();
+	int n = records.size() / 4;
+	for (int i = 0; i < n; i++) {
+		const unsigned char* rec = &records[4 * i];
+		int r = (rec[2]>>3)+(rec[3]<<5);
+		int c = rec[1]+((rec[2]&07)<<8);
+		// a corrupt record must not write outside the image
+		if (r >= pixels.Rows() || c >= pixels.Cols()) {
+			stringstream msg;
+			msg << "Pixel record at row " << r << ", column " << c << " of frame " << currentFrameNum
+			    << " in " << filename << " is outside the " << pixels.Cols() << "x" << pixels.Rows() << " image";
+			throw out_of_range(msg.str());
+		}
+		// pixels outside the region of interest are dropped here
+		if (region != NULL && !region->Contains(r, c)) {
+			continue;
+		}
+		pixels(r, c) = rec[0];
+		lit.push_back(r * cols + c);
+	}
+	CheckPixelRange(pixels, Colors());
+}
+
 // Open .cpv file, based on CPVPlayer decoder.cpp
 void WesleyanCPV::Open() throw(runtime_error)
 {
-	try {
-		file.open(filename.c_str(), ios::in | ios::binary);
-	} 
-	catch (...) {
+	// the file itself was opened when the reader was constructed
+	if (!file.is_open()) {
 		throw runtime_error("Cannot open .CPV file!");
 	}
 	if (file.good()) {
@@ -149,22 +182,4 @@ void WesleyanCPV::Open() throw(runtime_error)
 		cerr << "Failed to open file" << endl;
 		exit (1);
 	}
-	// finally, allocate the pixel buffer
-	try {
-		buffer = new unsigned char[rows * cols];
-		
-		for (int i = 0; i < rows; ++i) {
-			for (int j = 0; j < cols; ++j) {
-				memset(&buffer[cols * i + j], 0, sizeof(unsigned char));
-				if (static_cast<int>(buffer[cols * i + j]) != 0){
-					cerr << "Failure to empty buffer in WesleyanCPV::Open" << endl;
-					exit(1);
-				}
-			}
-		}
-		
-	} 
-	catch (bad_alloc&) {
-		throw runtime_error("Failure to allocate buffer in WesleyanCPV::Open");
-	}	
 }
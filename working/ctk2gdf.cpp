@@ -0,0 +1,52 @@
+/*
+ * ctk2gdf: turn a compact track file (see CompactTrack.h) back into a track
+ * GDF file with the same columns as the tracker writes.
+ *
+ * Usage: ctk2gdf <compact track file> <GDF file> [precision]
+ *
+ * The precision is as in the tracking configuration file (double, float, or
+ * mixed with per-column overrides, e.g. mixed:float:time=double); "-" writes
+ * to stdout.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <CompactTrack.h>
+#include <GDFWriter.h>
+
+using namespace std;
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		cerr << "Usage: " << argv[0] << " <compact track file> <GDF file> [precision]" << endl;
+		exit(1);
+	}
+	string precision = (argc > 3) ? argv[3] : "double";
+
+	try {
+		CompactTrackReader in(argv[1]);
+		vector<string> columns;
+		for (int c = 0; c < in.NumColumns(); ++c) {
+			columns.push_back(in.ColumnName(c));
+		}
+		GDFWriter out(argv[2], columns, precision);
+
+		CompactTrack t;
+		vector<double> row(columns.size());
+		while (in.Next(t)) {
+			for (int i = 0; i < t.Length(); ++i) {
+				in.Row(t, i, &row[0]);
+				out.AppendRow(&row[0]);
+			}
+		}
+		out.Close();
+		cerr << in.NumTracks() << " tracks, " << in.NumPoints() << " points" << endl;
+	} catch (exception& e) {
+		cerr << "Error: " << e.what() << endl;
+		exit(1);
+	}
+	return 0;
+}
@@ -31,13 +31,24 @@
 #include <string>
 #include <deque>
 #include <vector>
+#include <algorithm>
+#include <unistd.h>
 
 #include <GDF.h>
 #include <WesleyanCPV.h>
 #include <ParticleFinder.h>
+#include <Detector.h>
+#include <DetectionStore.h>
+#include <PeakScan.h>
+#include <Threshold.h>
+#include <Background.h>
+#include <Image.h>
 #include <Frame.h>
 #include <Calibration.h>
+#include <Projection.h>
 #include <Tracker.h>
+#include <IOBackend.h>
+#include <GDFWriter.h>
 
 using namespace std;
 
@@ -56,13 +67,25 @@ struct ConfigFile {
 	int last;
 	string stereomatched;
 	string outname;
+	string iobackend;
+	int iodepth;
+	string precision;
+	GDFWriter::Framing framing;
+	string trackformat;
+	int findthreads;
+	ParticleFinder::Engine finder;
+	ParticleFinder::Estimator estimator;
+	string thresholding;
+	string background;
+	string featuregate;
 };
 
 // globals
-deque<Frame> *f;
+DetectionStore *f;
 struct ConfigFile config;
 
 void ImportConfiguration(struct ConfigFile* config, char* name);
+bool NextEntry(ifstream& file, string& value);
 
 int main(int argc, char** argv) {
 		if (argc < 2) {
@@ -72,16 +95,41 @@ int main(int argc, char** argv) {
 
 	ImportConfiguration(&config, argv[1]);
 
+	// an output may go to stdout ("-"); keep our messages out of its way
+	if (config.stereomatched == "-" && config.outname == "-") {
+		cerr << "Error: only one output can be written to stdout!" << endl;
+		exit(1);
+	}
+	if (config.stereomatched == "-" || config.outname == "-") {
+		cout.rdbuf(cerr.rdbuf());
+	}
+	cout << "Configuration read from " << argv[1] << endl;
+
 	// are we trying to track with too much future information?
 	if (config.npredict > 2) {
 		cerr << "Error: too many predicted frames requested!" << endl;
 		exit(1);
 	}
 
-	f = new deque<Frame>[config.ncams];
+	f = new DetectionStore[config.ncams];
+
+	// one I/O backend (and queue) shared by the readers of all cameras
+	IOBackend* io = IOBackend::Create(config.iobackend, config.iodepth);
+	cout << "Reading input with the " << io->Name() << " backend, queue depth " << io->Depth() << endl;
+	if (config.finder == ParticleFinder::BLOBS) {
+		cout << "Finding particles as blobs, " << config.findthreads << " thread(s) per frame" << endl;
+	} else {
+		cout << "Finding particles with the " << PeakScanName() << " peak scan and the "
+		     << ParticleFinder::EstimatorName(config.estimator) << " estimator, " << config.findthreads << " thread(s) per frame" << endl;
+	}
+
+	cout << "Background: " << config.background << endl;
+	cout << "Thresholding: " << config.thresholding << " (histograms: " << HistogramName() << ")" << endl;
 
 	// read the camera calibration information
 	Calibration calib(config.setupfile);
+	calib.SetFeatureGate(config.featuregate);
+	cout << "Stereomatching feature gate: " << config.featuregate << " (projections: " << ProjectionName() << ")" << endl;
 		int first = config.first;
 		int last = config.last;
 		int threshold = config.threshold;
@@ -95,65 +143,88 @@ int main(int argc, char** argv) {
 			std::cout << camid+1 << " .cpv file(s) detected." << std::endl;
 			cout << "Processing CPV file " << files << endl;
 			
-			WesleyanCPV movie(files, first, last);
+			WesleyanCPV movie(files, first, last, io);
 			
-			int rows = movie.Rows();
-			int cols = movie.Cols();
-			//int nframes = movie.Frames();
-			int** pixels = new int*[rows];
-			for (int i = 0; i < rows; ++i) {
-				pixels[i] = new int[cols];
+			// pixels outside the camera's region of interest are never decoded
+			const RegionOfInterest& roi = calib.ROI(camid);
+			movie.SetRegion(&roi);
+			if (!roi.Whole()) {
+				cout << "\tRegion of interest: " << roi.Size() << " pixels, in rows " << roi.FirstRow() << " to "
+				     << roi.EndRow() - 1 << " and columns " << roi.FirstCol() << " to " << roi.EndCol() - 1 << endl;
+			}
+
+			// the frames are decoded a batch at a time (one frame per finder
+			// thread) into contiguous 8-bit images reused for the whole movie,
+			// and their particles found together
+			int batch = max(config.findthreads, 1);
+			vector<Image8*> images(batch);
+			for (int k = 0; k < batch; ++k) {
+				images[k] = new Image8(movie.Rows(), movie.Cols());
 			}
+			vector<const Image8*> frames(batch);
+			vector<int> thresholds(batch);
+			Detector detector(movie.Colors(), config.findthreads, config.finder, config.estimator, &roi, cluster_rad);
+			// the threshold of this camera, following its illumination if asked to
+			AdaptiveThreshold thresh(config.thresholding, threshold);
+			// and its background, from the pixels the movie lists as lit
+			BackgroundModel background(config.background);
 			//int avgnum = 0;
 					
+				int queued = 0;
 				for (int n = first; n < last; ++n) {
 					cout << "\tReading frame " << n << " of " << last << " in movie " << camid+1 << endl;
 					
-					//Set pixel array to zero
-					for (int i = 0; i < rows; ++i) {
-						memset(pixels[i], 0, cols * sizeof(int));
-					}
-					
+					Image8& pixels = *images[queued];
 					int missed = movie.DecodeNextFrame(pixels, n);
 					if (!missed) {
 						cout << "push_back Frame: " << n << endl;
-						ParticleFinder p(pixels, rows, cols, movie.Colors(), threshold);
-						p.Squash(cluster_rad);
-						f[camid].push_back(p.CreateFrame());
+						background.Subtract(pixels, &movie.LitPixels());
+						int t = thresh.Update(pixels, movie.Colors());
+						if (thresh.GetMode() != AdaptiveThreshold::FIXED) {
+							cout << "\tThreshold: " << t << endl;
+						}
+						frames[queued] = &pixels;
+						thresholds[queued] = t;
 						//avgnum += (f[camid][n]).NumParticles();
 						//cout << "\t(f[camid][n]).NumParticles(): " << (f[camid][n]).NumParticles() << endl;
 					}
 					else {
 						cout << "push_back empty Frame" << endl;
-						f[camid].push_back(Frame(Position())); //push_back empty frame
+						frames[queued] = NULL; //push_back empty frame
 					}
+					if (++queued == batch || n + 1 == last) {
+						detector.Detect(&frames[0], &thresholds[0], queued, f[camid]);
+						queued = 0;
+					}
+				}
+				for (int k = 0; k < batch; ++k) {
+					delete images[k];
 				}
 				
 			//cout << "\tAveraged " << static_cast<double>(avgnum)/static_cast<double>(nframes) << " particles per frame in movie " << camid+1 << endl;
-			
-			for (int i = 0; i < rows; ++i) {
-				delete []pixels[i];
-			}
-			delete []pixels;
 		} 
 		else if(files.substr(files.find_last_of(".") + 1) == "gdf") {
 			std::cout << camid+1 << " .gdf file(s) detected." << std::endl;
 			cout << "Processing GDF-file " << files << endl;
 			
 			//Read header information and seek to first frame
-			GDF g(files);
+			GDF g(files, io);
 			first = g.seekGDF(first);
+			// the particles of a frame, reused for every frame of this file
+			Detections found;
+			vector<double> ori;
             
 			for (int n = first; n <= last; ++n) {
 				cout << "\tReading frame " << n << " of " << last << " in GDF-file " << camid+1 << endl;	
 				int missed = g.readGDF2D(n); //read in frame and find wrong and missing frame(s)
 				if (!missed) {
 				cout << "\tpush_back Frame: " << n << endl;
-				f[camid].push_back(g.CreateFrame());
+				g.CreateDetections(found, ori);
+				f[camid].Append(found, &ori);
 				}
 				else {
 				cout << "\tBad Frame" << endl;
-				f[camid].push_back(Frame()); //push_back empty frame
+				f[camid].AppendEmpty(); //push_back empty frame
 				}
 			}
 		}
@@ -162,31 +233,37 @@ int main(int argc, char** argv) {
 			exit(1);
 		}
 	}
+	delete io;
 	
 	// do the stereomatching
 	cout << "Stereomatching..." << endl;			
-	calib.writeGDFHeader(config.stereomatched);
+	calib.OpenOutput(config.stereomatched, config.precision, config.framing);
 	
 	vector<Frame> matched;
 	int nr = 0;
+	// the features of each camera's particles, for the feature gate
+	bool gated = (config.featuregate != "none");
+	deque<Detections> features(config.ncams);
 
 	for (int i = 0; i < (last - first); ++i) {
 		cout << "\tProcessing frame " << first+i << " of " << last << endl;
 		deque<Frame> toMatch;
 		for (int camid = 0; camid < config.ncams; ++camid) {
 			//cout << "f[camid][i]: " << f[camid][i] << endl;			
-			toMatch.push_back(f[camid][i]);
+			toMatch.push_back(f[camid].CreateFrame(i));
+			if (gated) {
+				f[camid].Get(i, features[camid]);
+			}
 		}
-		Frame all(calib.Stereomatch(toMatch,i));
+		Frame all(calib.Stereomatch(toMatch, i, gated ? &features : NULL));
 		nr += all.end()-all.begin();
 		cout << "\tCurrent Frame Number = " << i << "; nr = " << nr << endl;	
 		matched.push_back(all);
 	}
 	
 	cout << "\tTotal number of stereomatched particles: " << nr << endl;
-	// first argument: total number of particles; second argument: number of columns in .gdf file;
 	// framenumber, x, y, z, intersect, xy+ori, xy+ori, xy+ori, xy+ori;
-	calib.fixHeader(nr,5+3*config.ncams);
+	calib.CloseOutput();
     		
 	// finally, do the tracking
 	cout << "Tracking..." << endl;
@@ -203,7 +280,7 @@ int main(int argc, char** argv) {
 	}
 
 	Tracker t(mode, config.max_disp, config.memory, config.fps, 
-	config.outname);
+	config.outname, config.precision, config.framing, config.trackformat);
 	t.MakeTracks(matched);
 
 	delete []f;
@@ -214,7 +291,6 @@ int main(int argc, char** argv) {
 }
 
 void ImportConfiguration(struct ConfigFile* config, char* name) {
-		cout << "Reading configuration file..." << endl;
 		ifstream file(name, ios::in);
 		string line;
 
@@ -271,4 +347,65 @@ void ImportConfiguration(struct ConfigFile* config, char* name) {
 		getline(file, line);
 		line.erase(line.find_first_of(' '));
 		config->outname = line;
+
+		// optional entries: older configuration files end here
+		config->iobackend = "pread";
+		config->iodepth = 8;
+		config->precision = "double";
+		if (NextEntry(file, line)) {
+			config->iobackend = line;
+		}
+		if (NextEntry(file, line)) {
+			config->iodepth = atoi(line.c_str());
+		}
+		if (NextEntry(file, line)) {
+			config->precision = line;
+		}
+		config->framing = GDFWriter::AUTO;
+		if (NextEntry(file, line)) {
+			config->framing = GDFWriter::ParseFraming(line);
+		}
+		config->trackformat = "gdf";
+		if (NextEntry(file, line)) {
+			config->trackformat = line;
+		}
+		config->findthreads = 1;
+		if (NextEntry(file, line)) {
+			config->findthreads = atoi(line.c_str());
+		}
+		if (config->findthreads <= 0) {
+			// one per core
+			config->findthreads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+		}
+		config->finder = ParticleFinder::PEAKS;
+		config->estimator = ParticleFinder::GAUSSIAN3;
+		if (NextEntry(file, line)) {
+			ParticleFinder::ParseFinder(line, config->finder, config->estimator);
+		}
+		config->thresholding = "fixed";
+		if (NextEntry(file, line)) {
+			config->thresholding = line;
+		}
+		config->background = "none";
+		if (NextEntry(file, line)) {
+			config->background = line;
+		}
+		config->featuregate = "none";
+		if (NextEntry(file, line)) {
+			config->featuregate = line;
+		}
+}
+
+bool NextEntry(ifstream& file, string& value) {
+		// read the value of the next entry, if there is one
+		string line;
+		if (!getline(file, line)) {
+			return false;
+		}
+		size_t end = line.find_first_of(" \t#");
+		if (end != string::npos) {
+			line.erase(end);
+		}
+		value = line;
+		return !value.empty();
 }
@@ -0,0 +1,103 @@
+/*
+ * store-query: print some columns of the points of some frames or tracks from
+ * a columnar track store (see TrackStore.h).
+ *
+ * Usage: store-query [columns=x,y,z] [frame=N]... [track=ID]... <track store>
+ *
+ * The columns default to all of them.  Every point is printed as a line of
+ * its column values, frame by frame and then track by track.  Only the
+ * columns asked for are read, and for a frame only the chunks that can hold
+ * it; the number of column chunks read is printed at the end.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <TrackStore.h>
+
+using namespace std;
+
+static void Print(const vector< vector<double> >& values)
+{
+	if (values.empty()) {
+		return;
+	}
+	for (unsigned int i = 0; i < values[0].size(); ++i) {
+		for (unsigned int k = 0; k < values.size(); ++k) {
+			cout << (k ? "\t" : "") << values[k][i];
+		}
+		cout << endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	string file;
+	string columns;
+	vector<int> frames;
+	vector<long long> tracks;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg.compare(0, 8, "columns=") == 0) {
+			columns = arg.substr(8);
+		} else if (arg.compare(0, 6, "frame=") == 0) {
+			frames.push_back(atoi(arg.c_str() + 6));
+		} else if (arg.compare(0, 6, "track=") == 0) {
+			tracks.push_back(atoll(arg.c_str() + 6));
+		} else {
+			file = arg;
+		}
+	}
+	if (file.empty() || (frames.empty() && tracks.empty())) {
+		cerr << "Usage: " << argv[0] << " [columns=x,y,z] [frame=N]... [track=ID]... <track store>" << endl;
+		exit(1);
+	}
+
+	try {
+		TrackStoreReader in(file);
+		vector<int> cols;
+		size_t start = 0;
+		while (start < columns.size()) {
+			size_t comma = columns.find(',', start);
+			string name = columns.substr(start, comma == string::npos ? string::npos : comma - start);
+			start = (comma == string::npos) ? columns.size() : comma + 1;
+			int col = in.Column(name);
+			if (col < 0) {
+				cerr << "Error: " << file << " has no column " << name << endl;
+				exit(1);
+			}
+			cols.push_back(col);
+		}
+		if (cols.empty()) {
+			for (int c = 0; c < in.NumColumns(); ++c) {
+				cols.push_back(c);
+			}
+		}
+
+		cout.precision(8);
+		vector< vector<double> > values;
+		long long npoints = 0;
+		for (unsigned int i = 0; i < frames.size(); ++i) {
+			if (!in.ReadFrame(frames[i], cols, values)) {
+				cerr << "No points in frame " << frames[i] << endl;
+			}
+			Print(values);
+			npoints += values[0].size();
+		}
+		for (unsigned int i = 0; i < tracks.size(); ++i) {
+			if (!in.ReadTrack(tracks[i], cols, values)) {
+				cerr << "No track " << tracks[i] << endl;
+				continue;
+			}
+			Print(values);
+			npoints += values[0].size();
+		}
+		cerr << npoints << " points; read " << in.ColumnsRead() << " of "
+		     << static_cast<long long>(in.NumChunks()) * in.NumColumns() << " column chunks" << endl;
+	} catch (exception& e) {
+		cerr << "Error: " << file << ": " << e.what() << endl;
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * track-query: list the tracks passing through a box in space and time.
+ *
+ * Usage: track-query [x=lo:hi] [y=lo:hi] [z=lo:hi] [t=lo:hi] [threads=N] <track GDF file>...
+ *
+ * Either bound of a range may be left out, as in t=2.5: for everything from
+ * t = 2.5 on.  Every stretch of a track inside the box is printed as a line
+ *   file  track id  first point  one past the last point  first time  last time
+ * with the points counted from the start of the track.
+ *
+ * The track bounds and the hierarchy over them are kept next to each file, in
+ * <file>.tqx, and read back instead of passing over the file again for as
+ * long as the file is unchanged.
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include <Trackfile.h>
+#include <TrackQuery.h>
+
+using namespace std;
+
+static double Seconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+int main(int argc, char** argv) {
+	QueryBox box;
+	int nthreads = 1;
+	vector<string> files;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg.compare(0, 8, "threads=") == 0) {
+			nthreads = atoi(arg.c_str() + 8);
+		} else if (arg.size() > 1 && arg[1] == '=') {
+			try {
+				box.Parse(arg);
+			} catch (invalid_argument& e) {
+				cerr << "Error: " << e.what() << endl;
+				exit(1);
+			}
+		} else {
+			files.push_back(arg);
+		}
+	}
+	if (files.empty()) {
+		cerr << "Usage: " << argv[0] << " [x=lo:hi] [y=lo:hi] [z=lo:hi] [t=lo:hi] [threads=N] <track GDF file>..." << endl;
+		exit(1);
+	}
+
+	cout.precision(8);
+	long long nslices = 0;
+	double indexing = 0;
+	double searching = 0;
+	for (unsigned int k = 0; k < files.size(); ++k) {
+		try {
+			double t0 = Seconds();
+			Trackfile f(files[k], false);
+			TrackQuery q(f, TrackQuery::SidecarName(files[k]), nthreads);
+			double t1 = Seconds();
+			vector<TrackSlice> slices;
+			q.Find(box, slices);
+			double t2 = Seconds();
+			indexing += t1 - t0;
+			searching += t2 - t1;
+
+			for (unsigned int i = 0; i < slices.size(); ++i) {
+				GDFColumn time = f.GetTrack(slices[i].track).Column(f.TimeColumn());
+				cout << files[k] << "\t" << slices[i].id << "\t" << slices[i].begin << "\t" << slices[i].end
+				     << "\t" << time[slices[i].begin] << "\t" << time[slices[i].end - 1] << endl;
+			}
+			nslices += slices.size();
+		} catch (invalid_argument& e) {
+			cerr << "Error: " << files[k] << ": " << e.what() << endl;
+			exit(1);
+		}
+	}
+	cerr << nslices << " stretches of track; " << indexing << " s indexing, "
+	     << searching << " s searching" << endl;
+	return 0;
+}